@@ -0,0 +1,373 @@
+#define RUN_ME /*
+set -e
+
+CURRENT="$PWD"
+SELF=$(readlink -f "$0")
+EXEC=$(basename "$SELF" .c)
+BASE="$(dirname "$SELF")/../"
+
+(cd "$BASE"; cargo build  --release --target-dir "$CURRENT/target")
+
+CC_FLAGS="$CFLAGS -O2 -W -Wall -I$BASE/include"
+cc $CC_FLAGS "$SELF" "$CURRENT/target/release/libslitter.a" -lpthread -ldl -o "$EXEC"
+cc $CC_FLAGS -DBENCH_MALLOC "$SELF" -lpthread -o "$EXEC-malloc"
+
+# Set JEMALLOC and MIMALLOC to the path of the corresponding shared
+# library to compare against them as well.
+for workload in ${WORKLOADS:-single cross classes churn grow}; do
+	"./$EXEC" "$workload"
+	BENCH_ALLOCATOR=glibc "./$EXEC-malloc" "$workload"
+	if [ -n "$JEMALLOC" ]; then
+		BENCH_ALLOCATOR=jemalloc LD_PRELOAD="$JEMALLOC" "./$EXEC-malloc" "$workload"
+	fi
+	if [ -n "$MIMALLOC" ]; then
+		BENCH_ALLOCATOR=mimalloc LD_PRELOAD="$MIMALLOC" "./$EXEC-malloc" "$workload"
+	fi
+done
+exit 0
+*/
+/*
+ * Micro-benchmarks for slitter and malloc, one workload per process
+ * so that the reported peak RSS only reflects that workload:
+ *
+ * - single: alloc/free loops in one thread, LIFO batches of
+ *   `BATCH_SIZE` objects: mostly the inline `slitter_allocate` /
+ *   `slitter_release` magazine fast path, plus a few slow-path
+ *   magazine exchanges with the depot per batch, since a batch is
+ *   larger than a default magazine;
+ * - cross: a producer thread allocates objects and a consumer frees
+ *   them, so magazines constantly flow through the depot;
+ * - classes: round-robins over `NUM_CLASSES` classes, more than
+ *   `SLITTER__CACHE_PAGE_CLASSES`, so caches have to grow;
+ * - churn: short-lived threads, which exercise cache setup and
+ *   teardown (`Cache::drop`);
+ * - grow: allocates and touches many objects without freeing them,
+ *   which exercises span allocation in the mill and first-touch
+ *   page faults.
+ *
+ * Each run prints the workload, allocator, nanoseconds per operation
+ * (an operation is an allocation and its release, or a single
+ * allocation for "grow") and the peak RSS.  The optional second
+ * argument scales the number of operations.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#ifndef BENCH_MALLOC
+#include <slitter.h>
+#endif
+
+#define BATCH_SIZE 64
+#define NUM_CLASSES 64
+#define OBJECT_SIZE 64
+#define RING_SIZE 4096
+#define CHURN_CONCURRENCY 8
+#define CHURN_OPS_PER_THREAD 1000
+
+static size_t scale = 1;
+
+#ifdef BENCH_MALLOC
+static const char *
+allocator_name(void)
+{
+	const char *name = getenv("BENCH_ALLOCATOR");
+
+	return (name != NULL) ? name : "malloc";
+}
+
+static void
+setup(void)
+{
+
+	return;
+}
+
+static inline void *
+bench_allocate(size_t class_index)
+{
+
+	return malloc(OBJECT_SIZE + 16 * class_index);
+}
+
+static inline void
+bench_release(size_t class_index, void *ptr)
+{
+
+	(void)class_index;
+	free(ptr);
+	return;
+}
+#else
+static struct slitter_class classes[NUM_CLASSES];
+
+static const char *
+allocator_name(void)
+{
+
+	return "slitter";
+}
+
+static void
+setup(void)
+{
+	static char names[NUM_CLASSES][32];
+
+	for (size_t i = 0; i < NUM_CLASSES; i++) {
+		snprintf(names[i], sizeof(names[i]), "bench_%zu", i);
+		classes[i] = slitter_class_register(
+		    &(struct slitter_class_config) {
+			.name = names[i],
+			.size = OBJECT_SIZE + 16 * i,
+		    });
+	}
+
+	return;
+}
+
+static inline void *
+bench_allocate(size_t class_index)
+{
+
+	return slitter_allocate(classes[class_index]);
+}
+
+static inline void
+bench_release(size_t class_index, void *ptr)
+{
+
+	slitter_release(classes[class_index], ptr);
+	return;
+}
+#endif
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long
+max_rss_kb(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+	return usage.ru_maxrss;
+}
+
+/* Keeps the compiler from eliding allocations. */
+static void
+touch(void *ptr)
+{
+
+	*(volatile char *)ptr = 1;
+	return;
+}
+
+static size_t
+run_single(void)
+{
+	void *batch[BATCH_SIZE];
+	size_t rounds = scale * (1UL << 18);
+
+	for (size_t i = 0; i < rounds; i++) {
+		for (size_t j = 0; j < BATCH_SIZE; j++) {
+			batch[j] = bench_allocate(0);
+			touch(batch[j]);
+		}
+
+		for (size_t j = BATCH_SIZE; j-- > 0; )
+			bench_release(0, batch[j]);
+	}
+
+	return rounds * BATCH_SIZE;
+}
+
+struct ring {
+	_Atomic size_t head;
+	char pad[64 - sizeof(size_t)];
+	_Atomic size_t tail;
+	size_t count;
+	void *slots[RING_SIZE];
+};
+
+static void *
+cross_consumer(void *arg)
+{
+	struct ring *ring = arg;
+
+	for (size_t i = 0; i < ring->count; i++) {
+		void *ptr;
+
+		while (atomic_load_explicit(&ring->head,
+		    memory_order_acquire) == i)
+			sched_yield();
+
+		ptr = ring->slots[i % RING_SIZE];
+		atomic_store_explicit(&ring->tail, i + 1,
+		    memory_order_release);
+		bench_release(0, ptr);
+	}
+
+	return NULL;
+}
+
+static size_t
+run_cross(void)
+{
+	static struct ring ring;
+	pthread_t consumer;
+
+	ring.count = scale * (1UL << 22);
+	if (pthread_create(&consumer, NULL, cross_consumer, &ring) != 0)
+		abort();
+
+	for (size_t i = 0; i < ring.count; i++) {
+		void *ptr = bench_allocate(0);
+
+		touch(ptr);
+		while (i - atomic_load_explicit(&ring.tail,
+		    memory_order_acquire) >= RING_SIZE)
+			sched_yield();
+
+		ring.slots[i % RING_SIZE] = ptr;
+		atomic_store_explicit(&ring.head, i + 1, memory_order_release);
+	}
+
+	pthread_join(consumer, NULL);
+	return ring.count;
+}
+
+static size_t
+run_classes(void)
+{
+	void *objects[NUM_CLASSES];
+	size_t rounds = scale * (1UL << 18);
+
+	for (size_t i = 0; i < rounds; i++) {
+		for (size_t j = 0; j < NUM_CLASSES; j++) {
+			objects[j] = bench_allocate(j);
+			touch(objects[j]);
+		}
+
+		for (size_t j = 0; j < NUM_CLASSES; j++)
+			bench_release(j, objects[j]);
+	}
+
+	return rounds * NUM_CLASSES;
+}
+
+static void *
+churn_worker(void *arg)
+{
+	void *batch[BATCH_SIZE];
+
+	(void)arg;
+	for (size_t i = 0; i < CHURN_OPS_PER_THREAD / BATCH_SIZE; i++) {
+		for (size_t j = 0; j < BATCH_SIZE; j++) {
+			batch[j] = bench_allocate(j % 4);
+			touch(batch[j]);
+		}
+
+		for (size_t j = 0; j < BATCH_SIZE; j++)
+			bench_release(j % 4, batch[j]);
+	}
+
+	return NULL;
+}
+
+static size_t
+run_churn(void)
+{
+	pthread_t threads[CHURN_CONCURRENCY];
+	size_t waves = scale * 256;
+
+	for (size_t i = 0; i < waves; i++) {
+		for (size_t j = 0; j < CHURN_CONCURRENCY; j++) {
+			if (pthread_create(&threads[j], NULL,
+			    churn_worker, NULL) != 0)
+				abort();
+		}
+
+		for (size_t j = 0; j < CHURN_CONCURRENCY; j++)
+			pthread_join(threads[j], NULL);
+	}
+
+	return waves * CHURN_CONCURRENCY *
+	    (CHURN_OPS_PER_THREAD / BATCH_SIZE) * BATCH_SIZE;
+}
+
+static size_t
+run_grow(void)
+{
+	size_t count = scale * (1UL << 22);
+	void **objects;
+
+	objects = calloc(count, sizeof(*objects));
+	if (objects == NULL)
+		abort();
+
+	for (size_t i = 0; i < count; i++) {
+		objects[i] = bench_allocate(0);
+		touch(objects[i]);
+	}
+
+	/* Leak everything: the process exits right after. */
+	return count;
+}
+
+static const struct {
+	const char *name;
+	size_t (*fn)(void);
+} workloads[] = {
+	{ "single", run_single },
+	{ "cross", run_cross },
+	{ "classes", run_classes },
+	{ "churn", run_churn },
+	{ "grow", run_grow },
+};
+
+int
+main(int argc, char **argv)
+{
+	uint64_t begin, end;
+	size_t ops;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s workload [scale]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 3)
+		scale = strtoul(argv[2], NULL, 10);
+
+	setup();
+	for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		if (strcmp(argv[1], workloads[i].name) != 0)
+			continue;
+
+		begin = now_ns();
+		ops = workloads[i].fn();
+		end = now_ns();
+
+		printf("%-8s %-10s %8.2f ns/op %10ld KB max RSS\n",
+		    workloads[i].name, allocator_name(),
+		    (double)(end - begin) / ops, max_rss_kb());
+		return 0;
+	}
+
+	fprintf(stderr, "unknown workload %s\n", argv[1]);
+	return 1;
+}
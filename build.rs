@@ -5,7 +5,21 @@ fn main() {
     #[cfg(feature = "test_only_small_constants")]
     build.define("SLITTER__SMALL_CONSTANTS", "1");
 
-    for file in ["cache", "constants", "mag", "map", "span_metadata", "stack"].iter() {
+    #[cfg(feature = "per_cpu_cache")]
+    build.define("SLITTER__PER_CPU", "1");
+
+    for file in [
+        "backtrace",
+        "cache",
+        "constants",
+        "mag",
+        "map",
+        "per_cpu",
+        "span_metadata",
+        "stack",
+    ]
+    .iter()
+    {
         println!("cargo:rerun-if-changed=c/{}.c", file);
         println!("cargo:rerun-if-changed=c/{}.h", file);
 
@@ -16,6 +30,9 @@ fn main() {
     // export the symbols...
     println!("cargo:rustc-cdylib-link-arg=-uslitter_allocate");
     println!("cargo:rustc-cdylib-link-arg=-uslitter_release");
+    println!("cargo:rustc-cdylib-link-arg=-uslitter_allocate_many");
+    println!("cargo:rustc-cdylib-link-arg=-uslitter_release_many");
+    println!("cargo:rustc-cdylib-link-arg=-uslitter_release_any");
 
     build
         .include("include")
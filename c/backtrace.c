@@ -0,0 +1,16 @@
+#include "backtrace.h"
+
+#include <execinfo.h>
+#include <limits.h>
+
+size_t
+slitter__backtrace(void **frames, size_t max_frames)
+{
+	int ret;
+
+	if (max_frames > INT_MAX)
+		max_frames = INT_MAX;
+
+	ret = backtrace(frames, (int)max_frames);
+	return (ret > 0) ? (size_t)ret : 0;
+}
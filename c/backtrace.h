@@ -0,0 +1,15 @@
+#pragma once
+/**
+ * Stack trace capture for the sampling heap profiler.
+ *
+ * The corresponding Rust definition lives in `src/heap_profile.rs`.
+ */
+
+#include <stddef.h>
+
+/**
+ * Overwrites `frames[0 ... max_frames - 1]` with the return addresses
+ * of the calling thread's stack frames, innermost first, and returns
+ * the number of frames written.
+ */
+size_t slitter__backtrace(void **frames, size_t max_frames);
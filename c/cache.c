@@ -3,17 +3,19 @@
 #include <assert.h>
 
 #include "constants.h"
+#include "per_cpu.h"
 #include "span_metadata.h"
 
 struct thread_cache {
+	/* Class ids below `n` have an entry in `pages`. */
 	size_t n;
-	struct cache_magazines *mags;
+	struct cache_magazines *pages[SLITTER__CACHE_NUM_PAGES];
 };
 
 struct thread_allocation {
         struct thread_cache cache;
-        /* Add one more for the dummy class (and to avoid zero-sized arrays). */
-        struct cache_magazines preallocated[1 + SLITTER__CACHE_PREALLOC];
+        /* The first page, including the dummy class. */
+        struct cache_magazines preallocated[SLITTER__CACHE_PAGE_CLASSES];
 };
 
 static __thread struct thread_allocation slitter_cache
@@ -24,6 +26,9 @@ static __thread struct thread_allocation slitter_cache
  */
 extern void *slitter__allocate_slow(struct slitter_class);
 extern void slitter__release_slow(struct slitter_class, void *);
+extern void slitter__allocate_many_slow(struct slitter_class, void **, size_t);
+extern void slitter__release_many_slow(struct slitter_class, void **, size_t);
+extern void slitter__release_unmanaged(void *);
 
 struct cache_magazines *
 slitter__cache_borrow(size_t *OUT_n)
@@ -35,27 +40,59 @@ slitter__cache_borrow(size_t *OUT_n)
 }
 
 void
-slitter__cache_register(struct cache_magazines *mags, size_t n)
+slitter__cache_register(struct cache_magazines *const *pages,
+    size_t num_pages)
 {
-	slitter_cache.cache = (struct thread_cache) {
-		.n = n,
-		.mags = mags,
-	};
 
+	if (num_pages > SLITTER__CACHE_NUM_PAGES)
+		num_pages = SLITTER__CACHE_NUM_PAGES;
+
+	for (size_t i = 0; i < num_pages; i++)
+		slitter_cache.cache.pages[i] = pages[i];
+
+	slitter_cache.cache.n = num_pages * SLITTER__CACHE_PAGE_CLASSES;
 	return;
 }
 
+/**
+ * Returns the cached magazines for class `id`, or NULL if the class is
+ * not in the thread's cache.
+ */
+static inline struct cache_magazines *
+cache_lookup(uint32_t id)
+{
+
+	if (__builtin_expect(id >= slitter_cache.cache.n, 0))
+		return NULL;
+
+	return &slitter_cache.cache.pages[id / SLITTER__CACHE_PAGE_CLASSES]
+	    [id % SLITTER__CACHE_PAGE_CLASSES];
+}
+
 void *
 slitter_allocate(struct slitter_class class)
 {
+	struct cache_magazines *restrict mags;
 	struct magazine *restrict mag;
 	size_t next_index;
 	uint32_t id = class.id;
 
-	if (__builtin_expect(id >= slitter_cache.cache.n, 0))
+#if SLITTER__PER_CPU
+	if (__builtin_expect(slitter__per_cpu_enabled(id), 1)) {
+		void *ret = slitter__per_cpu_get(id);
+
+		if (__builtin_expect(ret != NULL, 1))
+			return ret;
+
+		return slitter__per_cpu_allocate_slow(class);
+	}
+#endif
+
+	mags = cache_lookup(id);
+	if (__builtin_expect(mags == NULL, 0))
 		return slitter__allocate_slow(class);
 
-	mag = &slitter_cache.cache.mags[id].alloc;
+	mag = &mags->alloc;
 	if (__builtin_usubl_overflow(mag->top_of_stack, 2, &next_index)) {
 		next_index++;
 	}
@@ -68,38 +105,119 @@ slitter_allocate(struct slitter_class class)
 	 * by more than 1.
 	 */
 	__builtin_prefetch(mag->storage->allocations[next_index], 1);
+	mags->allocated++;
 	return slitter__magazine_get_non_empty(mag);
 }
 
+void
+slitter_allocate_many(struct slitter_class class, void **dst, size_t count)
+{
+	struct cache_magazines *restrict mags;
+	struct magazine *restrict mag;
+	size_t copied;
+	uint32_t id = class.id;
+
+	mags = cache_lookup(id);
+	if (__builtin_expect(mags == NULL, 0))
+		return slitter__allocate_many_slow(class, dst, count);
+
+	mag = &mags->alloc;
+	copied = slitter__magazine_get_many(mag, dst, count);
+	mags->allocated += copied;
+	if (__builtin_expect(copied < count, 0))
+		return slitter__allocate_many_slow(class, dst + copied,
+		    count - copied);
+
+	return;
+}
+
+/**
+ * Checks that non-NULL `ptr` belongs to `class`, according to its
+ * span metadata.
+ */
+static inline void
+check_class(struct slitter_class class, const void *ptr)
+{
+	const struct span_metadata *span = slitter__span_metadata_of(ptr);
+
+	assert(class.id == span->class_id && "class mismatch");
+	(void)span;
+	return;
+}
+
 void
 slitter_release(struct slitter_class class, void *ptr)
 {
-	uintptr_t address = (uintptr_t)ptr;
-	uintptr_t chunk_base = address & -SLITTER__DATA_ALIGNMENT;
-	uintptr_t chunk_offset = address % SLITTER__DATA_ALIGNMENT;
-	size_t span_index = chunk_offset / SLITTER__SPAN_ALIGNMENT;
-	uintptr_t meta_base = chunk_base -
-	    (SLITTER__GUARD_PAGE_SIZE + SLITTER__METADATA_PAGE_SIZE);
+	struct cache_magazines *restrict mags;
 	struct magazine *restrict mag;
 	uint32_t id = class.id;
 
 	if (ptr == NULL)
 		return;
 
-	/* Check the span metadata. */
-	{
-		const struct span_metadata *meta = (void *)meta_base;
-		const struct span_metadata *span = &meta[span_index];
+	check_class(class, ptr);
 
-		assert(class.id == span->class_id && "class mismatch");
+#if SLITTER__PER_CPU
+	if (__builtin_expect(slitter__per_cpu_enabled(id), 1)) {
+		if (__builtin_expect(slitter__per_cpu_put(id, ptr), 1))
+			return;
+
+		return slitter__per_cpu_release_slow(class, ptr);
 	}
+#endif
 
-	if (__builtin_expect(id >= slitter_cache.cache.n, 0))
+	mags = cache_lookup(id);
+	if (__builtin_expect(mags == NULL, 0))
 		return slitter__release_slow(class, ptr);
 
-	mag = &slitter_cache.cache.mags[id].release;
+	mag = &mags->release;
 	if (__builtin_expect(slitter__magazine_is_exhausted(mag), 0))
 		return slitter__release_slow(class, ptr);
 
+	mags->released++;
 	return slitter__magazine_put_non_full(mag, ptr);
 }
+
+void
+slitter_release_many(struct slitter_class class, void **ptrs, size_t count)
+{
+	struct cache_magazines *restrict mags;
+	struct magazine *restrict mag;
+	ssize_t top_of_stack;
+	size_t consumed;
+	uint32_t id = class.id;
+
+	for (size_t i = 0; i < count; i++) {
+		if (ptrs[i] != NULL)
+			check_class(class, ptrs[i]);
+	}
+
+	mags = cache_lookup(id);
+	if (__builtin_expect(mags == NULL, 0))
+		return slitter__release_many_slow(class, ptrs, count);
+
+	mag = &mags->release;
+	top_of_stack = mag->top_of_stack;
+	consumed = slitter__magazine_put_many(mag, ptrs, count);
+	mags->released += (uint64_t)(mag->top_of_stack - top_of_stack);
+	if (__builtin_expect(consumed < count, 0))
+		return slitter__release_many_slow(class, ptrs + consumed,
+		    count - consumed);
+
+	return;
+}
+
+void
+slitter_release_any(void *ptr)
+{
+	struct slitter_class class;
+
+	if (ptr == NULL)
+		return;
+
+	class.id = slitter__class_id_of(ptr);
+	if (__builtin_expect(class.id == 0, 0))
+		return slitter__release_unmanaged(ptr);
+
+	return slitter_release(class, ptr);
+}
@@ -2,6 +2,7 @@
 #include "slitter.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "mag.h"
 
@@ -11,19 +12,30 @@
 struct cache_magazines {
 	struct magazine alloc;
 	struct magazine release;
+	/*
+	 * Fast-path allocations and releases, not yet folded into the
+	 * class's totals by the slow path.
+	 */
+	uint64_t allocated;
+	uint64_t released;
 };
 
 /**
- * Returns the thread's pre-allocated array of `cache_magazines`.
+ * Returns the thread's pre-allocated page of `cache_magazines`.
  *
- * That array lives next to the fast-path's internal thread-local data
- * structure, so using that array improves locality.
+ * That page lives next to the fast-path's internal thread-local data
+ * structure, so using it as the first page improves locality.
  */
 struct cache_magazines *slitter__cache_borrow(size_t *OUT_n);
 
 /**
- * Registers an array of `n` `cache_magazines` for this thread.
+ * Registers `num_pages` pages of `SLITTER__CACHE_PAGE_CLASSES`
+ * `cache_magazines` for this thread: `pages[i]` holds the entries for
+ * class ids `[i * SLITTER__CACHE_PAGE_CLASSES, (i + 1) *
+ * SLITTER__CACHE_PAGE_CLASSES)`.  Pages past
+ * `SLITTER__CACHE_NUM_PAGES` are ignored.
  *
- * That array may be the same one returned by `slitter__cache_borrow`.
+ * The first page may be the one returned by `slitter__cache_borrow`.
  */
-void slitter__cache_register(struct cache_magazines *, size_t n);
+void slitter__cache_register(struct cache_magazines *const *pages,
+    size_t num_pages);
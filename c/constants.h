@@ -9,36 +9,65 @@
 # define SLITTER__MAGAZINE_SIZE 30
 # define SLITTER__DATA_ALIGNMENT (1UL << 30)
 # define SLITTER__GUARD_PAGE_SIZE (2UL << 20)
-# define SLITTER__METADATA_PAGE_SIZE (2UL << 20)
+/* 2 MB of span metadata, and a 16 MB free bitmap (1 bit per 8 bytes). */
+# define SLITTER__METADATA_PAGE_SIZE (18UL << 20)
 # define SLITTER__SPAN_ALIGNMENT (16UL << 10)
 
 /*
- * The default of classes we can handle in the thread-local cache's
- * preallocated array of `cache_magazines`.  We need one more for the
- * dummy 0 class.
+ * The thread-local cache is a two-level table: a thread-local
+ * directory of `SLITTER__CACHE_NUM_PAGES` pointers to pages of
+ * `SLITTER__CACHE_PAGE_CLASSES` `cache_magazines` each.  The
+ * first page (including the dummy 0 class) is preallocated in
+ * thread-local storage.
  *
- * At 32 bytes per class, 15 classes take up 512 thread-local bytes.
+ * At 48 bytes per class, a page takes up 768 bytes, and the
+ * directory another 512 bytes.  Classes with ids past
+ * `SLITTER__CACHE_PAGE_CLASSES * SLITTER__CACHE_NUM_PAGES` (1024)
+ * always take the slow path.
+ *
+ * Must match `CACHE_PAGE_CLASSES` and `CACHE_NUM_PAGES` in cache.rs.
  */
-#ifndef SLITTER__CACHE_PREALLOC
-# define SLITTER__CACHE_PREALLOC 15
-#endif
+# define SLITTER__CACHE_PAGE_CLASSES 16
+# define SLITTER__CACHE_NUM_PAGES 64
 
 #else
 # define SLITTER__MAGAZINE_SIZE 6
 # define SLITTER__DATA_ALIGNMENT (2UL << 20)
 # define SLITTER__GUARD_PAGE_SIZE (16UL << 10)
-# define SLITTER__METADATA_PAGE_SIZE (16UL << 10)
+# define SLITTER__METADATA_PAGE_SIZE (48UL << 10)
 # define SLITTER__SPAN_ALIGNMENT (4UL << 10)
 
-#ifndef SLITTER__CACHE_PREALLOC
-# define SLITTER__CACHE_PREALLOC 3
+/* Tiny pages, but the same 1024 classes in the fast path. */
+# define SLITTER__CACHE_PAGE_CLASSES 4
+# define SLITTER__CACHE_NUM_PAGES 256
+
 #endif
 
+/*
+ * The per-CPU cache (`per_cpu_cache` feature) is off by default, and
+ * only works with rseq on x86-64 Linux.
+ */
+#ifndef SLITTER__PER_CPU
+# define SLITTER__PER_CPU 0
+#endif
+
+#if SLITTER__PER_CPU && !(defined(__x86_64__) && defined(__linux__))
+# error "The per-CPU cache requires x86-64 Linux."
+#endif
+
+/*
+ * Only classes with id < SLITTER__PER_CPU_MAX_CLASSES use the
+ * per-CPU cache; at 16 bytes per class, 64 classes take up 1 KB
+ * per CPU.  The others use the thread-local cache.
+ */
+#ifndef SLITTER__PER_CPU_MAX_CLASSES
+# define SLITTER__PER_CPU_MAX_CLASSES 64
 #endif
 
 /**
  * Returns the value of the `SLITTER__MAGAZINE_SIZE` constant on the C
- * side.
+ * side.  This is only the default capacity: each magazine's storage
+ * records its own capacity.
  *
  * The Rust code uses this function to confirm that the constant has
  * the same value on both sides.
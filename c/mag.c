@@ -1,8 +1,19 @@
 #include "mag.h"
 
+#include <assert.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(struct magazine_storage) == 2 * sizeof(void *),
+    "Magazine size buckets assume a two-word storage header.");
+
 extern bool slitter__magazine_is_exhausted(const struct magazine *);
 extern void *slitter__magazine_get_non_empty(struct magazine *);
 extern void slitter__magazine_put_non_full(struct magazine *, void *);
+extern size_t slitter__magazine_get_many(struct magazine *, void **, size_t);
+extern size_t slitter__magazine_put_many(struct magazine *, void *const *, size_t);
 
 void *
 slitter__magazine_get(struct magazine *restrict mag)
@@ -45,3 +56,39 @@ slitter__magazine_sizeof(void)
 
 	return sizeof(struct magazine);
 }
+
+/**
+ * Zero-fills the `count` objects of `size` bytes in `allocations`
+ * with non-temporal stores, when the target supports them.
+ */
+void
+slitter__zero_non_temporal(void *const *allocations, size_t count, size_t size)
+{
+#if defined(__x86_64__)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (size_t i = 0; i < count; i++) {
+		uintptr_t begin = (uintptr_t)allocations[i];
+		uintptr_t end = begin + size;
+		uintptr_t aligned_begin = (begin + 15) & -(uintptr_t)16;
+		uintptr_t aligned_end = end & -(uintptr_t)16;
+
+		if (aligned_begin >= aligned_end) {
+			memset((void *)begin, 0, size);
+			continue;
+		}
+
+		memset((void *)begin, 0, aligned_begin - begin);
+		for (uintptr_t p = aligned_begin; p < aligned_end; p += 16)
+			_mm_stream_si128((__m128i *)p, zero);
+		memset((void *)aligned_end, 0, end - aligned_end);
+	}
+
+	/* Order the streaming stores before handing out the objects. */
+	_mm_sfence();
+#else
+	for (size_t i = 0; i < count; i++)
+		memset(allocations[i], 0, size);
+#endif
+	return;
+}
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include "constants.h"
@@ -11,20 +12,26 @@
  * Matches `MagazineStorage` on the Rust side.
  */
 struct magazine_storage {
-	void *allocations[SLITTER__MAGAZINE_SIZE];
         /*
          * The `link` pointer is only used by the C side.
          * It's always NULL (None) on the Rust side.
          */
 	struct magazine_storage *volatile link;
-	uint32_t num_allocated_slow;
+	uint16_t num_allocated_slow;
+	/* Number of elements in `allocations`; never changes. */
+	uint16_t capacity;
+	/* Effective capacity (<= capacity): push magazines fill up to `limit`. */
+	uint16_t limit;
+	/* The first `num_zeroed` allocations are known to be zero-filled. */
+	uint16_t num_zeroed;
+	void *allocations[];
 };
 
 /**
  * Matches `MagazineImpl` on the Rust side.
  *
- * `top_of_stack` goes from SLITTER__MAGAZINE_SIZE to 0 when popping,
- * and from -SLITTER__MAGAZINE_SIZE to 0 when pushing.  In both cases,
+ * `top_of_stack` goes from `storage->limit` to 0 when popping,
+ * and from `-storage->limit` to 0 when pushing.  In both cases,
  * `storage->allocations` is populated with cached objects
  * at low indices, and empty / garbage at high ones.
  */
@@ -66,11 +73,57 @@ inline void
 slitter__magazine_put_non_full(struct magazine *restrict mag, void *alloc)
 {
 
-	mag->storage->allocations
-	    [SLITTER__MAGAZINE_SIZE + mag->top_of_stack++] = alloc;
+	struct magazine_storage *storage = mag->storage;
+
+	storage->allocations
+	    [(ssize_t)storage->limit + mag->top_of_stack++] = alloc;
 	return;
 }
 
+/**
+ * Copies up to `n` cached allocations from a "Pop" magazine to `dst`.
+ *
+ * Returns the number of allocations copied to the beginning of `dst`.
+ */
+inline size_t
+slitter__magazine_get_many(struct magazine *restrict mag,
+    void **restrict dst, size_t n)
+{
+	size_t available = mag->top_of_stack;
+
+	if (n > available)
+		n = available;
+
+	if (n == 0)
+		return 0;
+
+	mag->top_of_stack -= n;
+	memcpy(dst, &mag->storage->allocations[mag->top_of_stack],
+	    n * sizeof(*dst));
+	return n;
+}
+
+/**
+ * Pushes allocations from the front of `src` to a "Push" magazine,
+ * until the magazine is full or `src` is exhausted.  NULL entries
+ * are skipped.
+ *
+ * Returns the number of entries consumed at the beginning of `src`.
+ */
+inline size_t
+slitter__magazine_put_many(struct magazine *restrict mag,
+    void *const *restrict src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n && !slitter__magazine_is_exhausted(mag); i++) {
+		if (src[i] != NULL)
+			slitter__magazine_put_non_full(mag, src[i]);
+	}
+
+	return i;
+}
+
 /**
  * Attempts to consume one cached allocation from a "Pop" magazine.
  *
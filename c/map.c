@@ -1,10 +1,21 @@
+#define _GNU_SOURCE
 #include "map.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+/* Support up to 1024 NUMA nodes, like glibc's `cpu_set_t` for CPUs. */
+#define NODEMASK_BITS 1024
+#define NODEMASK_WORD_BITS (CHAR_BIT * sizeof(unsigned long))
+
 static_assert(sizeof(size_t) == sizeof(uintptr_t),
     "Our rust code assumes usize == size_t, but rust-the-language "
     "only guarantees usize == uintptr_t.");
@@ -21,6 +32,19 @@ slitter__page_size(void)
 	return ret;
 }
 
+int32_t
+slitter__getcpu(uint32_t *OUT_cpu, uint32_t *OUT_node)
+{
+	unsigned int cpu, node;
+
+	if (getcpu(&cpu, &node) != 0)
+		return -errno;
+
+	*OUT_cpu = cpu;
+	*OUT_node = node;
+	return 0;
+}
+
 void *
 slitter__reserve_region(size_t desired_size, int32_t *OUT_errno)
 {
@@ -38,6 +62,29 @@ slitter__reserve_region(size_t desired_size, int32_t *OUT_errno)
 	return NULL;
 }
 
+/* Linux 4.17+; older kernels treat the address as a hint. */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+int32_t
+slitter__reserve_fixed_region(void *base, size_t size)
+{
+	void *ret;
+
+	ret = mmap(base, size, PROT_NONE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (ret == MAP_FAILED)
+		return -errno;
+
+	if (ret != base) {
+		munmap(ret, size);
+		return -EEXIST;
+	}
+
+	return 0;
+}
+
 int32_t
 slitter__release_region(void *base, size_t size)
 {
@@ -48,28 +95,194 @@ slitter__release_region(void *base, size_t size)
 	return -errno;
 }
 
+/**
+ * Asks the kernel to back `[base, base + size)` with memory from
+ * `node`, when `node` is non-negative.  This is only a preference,
+ * so we ignore failures (e.g., on kernels without NUMA support).
+ */
+static void
+prefer_node(void *base, size_t size, int32_t node)
+{
+	unsigned long nodemask[NODEMASK_BITS / NODEMASK_WORD_BITS];
+	int saved_errno = errno;
+
+	if (node < 0 || node >= NODEMASK_BITS)
+		return;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / NODEMASK_WORD_BITS] |= 1UL << (node % NODEMASK_WORD_BITS);
+	/* The kernel drops the last bit of `maxnode`. */
+	(void)syscall(SYS_mbind, base, size, MPOL_PREFERRED,
+	    nodemask, (unsigned long)NODEMASK_BITS + 1, 0);
+	errno = saved_errno;
+	return;
+}
+
 int32_t
-slitter__allocate_region(void *base, size_t size)
+slitter__allocate_region(void *base, size_t size, int32_t node)
 {
 	void *ret;
 
 	ret = mmap(base, size, PROT_READ | PROT_WRITE,
 	    MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (ret != MAP_FAILED)
+	if (ret == MAP_FAILED)
+		return -errno;
+
+	prefer_node(base, size, node);
+	return 0;
+}
+
+/*
+ * Moves fresh hugetlb pages over the reservation at `base`.  Returns 0
+ * on success, 1 if the caller should fall back to regular pages in
+ * the (still reserved) range, and `-errno` if the range was lost.
+ */
+static int32_t
+allocate_hugetlb_region(void *base, size_t size)
+{
+	void *probe;
+	int32_t r;
+
+	/*
+	 * A failed `MAP_FIXED` mmap may unmap the old range before it
+	 * gives up, and another thread could map into the hole.  Get
+	 * the huge pages wherever the kernel likes first, and only
+	 * replace the reservation once we have them.
+	 */
+	probe = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (probe == MAP_FAILED)
+		return 1;
+
+	if (mremap(probe, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+	    base) != MAP_FAILED)
 		return 0;
 
-	return -errno;
+	munmap(probe, size);
+
+	/*
+	 * Kernels that can't move hugetlb mappings unmap `base` before
+	 * failing: reserve it again.  If the range is already mapped,
+	 * we can't tell our reservation from someone else's mapping,
+	 * so don't clobber it.
+	 */
+	r = slitter__reserve_fixed_region(base, size);
+	return (r == 0) ? 1 : r;
 }
 
 int32_t
-slitter__allocate_fd_region(int fd, size_t offset, void *base, size_t size)
+slitter__allocate_huge_region(void *base, size_t size, int32_t node,
+    bool hugetlb)
+{
+	void *ret;
+
+	if (hugetlb) {
+		int32_t r;
+
+		r = allocate_hugetlb_region(base, size);
+		if (r < 0)
+			return r;
+
+		if (r == 0) {
+			prefer_node(base, size, node);
+			return 0;
+		}
+	}
+
+	ret = mmap(base, size, PROT_READ | PROT_WRITE,
+	    MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED)
+		return -errno;
+
+	prefer_node(base, size, node);
+	/* Like `mbind`, `madvise` is only a hint. */
+	(void)madvise(base, size, MADV_HUGEPAGE);
+	return 0;
+}
+
+int32_t
+slitter__allocate_fd_region(int fd, size_t offset, void *base, size_t size,
+    int32_t node)
 {
 	void *ret;
 
 	ret = mmap(base, size, PROT_READ | PROT_WRITE,
             MAP_FIXED | MAP_SHARED, fd, (off_t)offset);
-	if (ret != MAP_FAILED)
+	if (ret == MAP_FAILED)
+		return -errno;
+
+	prefer_node(base, size, node);
+	return 0;
+}
+
+/* Linux 5.14+; older kernels fail with EINVAL. */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+int32_t
+slitter__populate_region(void *base, size_t size)
+{
+	long page_size;
+
+	if (madvise(base, size, MADV_POPULATE_WRITE) == 0)
 		return 0;
 
-	return -errno;
+	if (errno != EINVAL)
+		return -errno;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		return -EINVAL;
+
+	/*
+	 * Fault in each page with an atomic no-op: a plain load would
+	 * only map the shared zero page, and a plain store could race
+	 * with concurrent writes to the same word.
+	 */
+	for (size_t i = 0; i < size; i += (size_t)page_size)
+		(void)__atomic_fetch_add((uint64_t *)((char *)base + i), 0,
+		    __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int32_t
+slitter__purge_region(void *base, size_t size)
+{
+
+	if (madvise(base, size, MADV_FREE) != 0)
+		return -errno;
+
+	return 0;
+}
+
+int32_t
+slitter__punch_fd_region(int fd, size_t offset, size_t size)
+{
+
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	    (off_t)offset, (off_t)size) != 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Linux 5.4+; older kernels fail with EINVAL. */
+#ifndef MADV_COLD
+#define MADV_COLD 20
+#endif
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+int32_t
+slitter__advise_cold_region(void *base, size_t size, bool pageout)
+{
+
+	if (madvise(base, size, pageout ? MADV_PAGEOUT : MADV_COLD) != 0)
+		return -errno;
+
+	return 0;
 }
@@ -6,6 +6,7 @@
  * The corresponding Rust definition live in `src/map.rs`.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -14,6 +15,14 @@
  */
 int64_t slitter__page_size(void);
 
+/**
+ * Overwrites `OUT_cpu` and `OUT_node` with the CPU and NUMA node the
+ * calling thread is currently running on.
+ *
+ * Returns 0 on success, and `-errno` on failure.
+ */
+int32_t slitter__getcpu(uint32_t *OUT_cpu, uint32_t *OUT_node);
+
 /**
  * Attempts to reserve a region of address space of `desired_size`
  * bytes.
@@ -27,6 +36,16 @@ int64_t slitter__page_size(void);
 void *slitter__reserve_region(size_t desired_size,
     int32_t *OUT_errno);
 
+/**
+ * Attempts to reserve the region of address space starting at `base`
+ * and continuing for `size` bytes, like `slitter__reserve_region`,
+ * but at that exact address.
+ *
+ * Returns 0 on success, and `-errno` on failure (`EEXIST` if the
+ * region overlaps an existing mapping).
+ */
+int32_t slitter__reserve_fixed_region(void *base, size_t size);
+
 /**
  * Attempts to release the region of address space starting at `base`,
  * and continuing for `size` bytes.
@@ -42,11 +61,30 @@ int32_t slitter__release_region(void *base, size_t size);
  * `slitter__reserve_region`.
  *
  * The region will be safe for read and writes, but may be
- * demand-faulted later.
+ * demand-faulted later.  If `node` is non-negative, the kernel will
+ * try to back the region with memory from that NUMA node.
  *
  * Returns 0 on success, and `-errno` on failure.
  */
-int32_t slitter__allocate_region(void *base, size_t size);
+int32_t slitter__allocate_region(void *base, size_t size, int32_t node);
+
+/**
+ * Like `slitter__allocate_region`, but asks for huge pages.
+ *
+ * If `hugetlb` is true, first tries to back the region with explicit
+ * huge pages from the default hugetlbfs pool; `base` and `size` must
+ * be aligned to the huge page size for that to work.  If that fails,
+ * or if `hugetlb` is false, falls back to regular memory with a
+ * `MADV_HUGEPAGE` hint for transparent huge pages.
+ *
+ * The reservation is only replaced once the huge pages are mapped;
+ * if a failed attempt loses the range to another mapping, this
+ * function fails with `-EEXIST` rather than clobber it.
+ *
+ * Returns 0 on success, and `-errno` on failure.
+ */
+int32_t slitter__allocate_huge_region(void *base, size_t size,
+    int32_t node, bool hugetlb);
 
 /**
  * Attempts to back the region of address space starting at `base` and
@@ -55,9 +93,54 @@ int32_t slitter__allocate_region(void *base, size_t size);
  * address space with `slitter__reserve_region`.
  *
  * The region will be safe for read and writes, but may be
- * demand-faulted later.
+ * demand-faulted later.  If `node` is non-negative, the kernel will
+ * try to back the region with memory from that NUMA node.
  *
  * Returns 0 on success, and `-errno` on failure.
  */
 int32_t slitter__allocate_fd_region(int fd, size_t offset,
-    void *base, size_t size);
+    void *base, size_t size, int32_t node);
+
+/**
+ * Populates the pages in the region starting at `base` and continuing
+ * for `size` bytes, as if they had been written to, without changing
+ * their contents.  The region must have been backed with one of the
+ * `slitter__allocate_*region` functions.
+ *
+ * This is safe to call while other threads read and write the
+ * region.
+ *
+ * Returns 0 on success, and `-errno` on failure.
+ */
+int32_t slitter__populate_region(void *base, size_t size);
+
+/**
+ * Lets the kernel reclaim the pages in the region starting at `base`
+ * and continuing for `size` bytes, with `MADV_FREE`.  The region
+ * remains mapped, but its contents become undefined: each page may
+ * read back as zeros, or keep its old contents.
+ *
+ * Returns 0 on success, and `-errno` on failure (e.g., `EINVAL` for
+ * shared or huge page mappings).
+ */
+int32_t slitter__purge_region(void *base, size_t size);
+
+/**
+ * Deallocates the `size` bytes at `offset` in the file `fd`, without
+ * changing the file's size.  Shared mappings of that range read back
+ * as zeros.
+ *
+ * Returns 0 on success, and `-errno` on failure.
+ */
+int32_t slitter__punch_fd_region(int fd, size_t offset, size_t size);
+
+/**
+ * Tells the kernel that the pages in the region starting at `base`
+ * and continuing for `size` bytes are cold, with `MADV_COLD`, or,
+ * if `pageout` is true, asks it to reclaim them right away, with
+ * `MADV_PAGEOUT`.  The contents of the region do not change.
+ *
+ * Returns 0 on success, and `-errno` on failure (e.g., `EINVAL` on
+ * kernels older than 5.4).
+ */
+int32_t slitter__advise_cold_region(void *base, size_t size, bool pageout);
@@ -0,0 +1,147 @@
+#include "per_cpu.h"
+
+#if SLITTER__PER_CPU
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/rseq.h>
+#include <unistd.h>
+
+extern bool slitter__per_cpu_enabled(uint32_t);
+extern char *slitter__per_cpu_rseq(void);
+extern void *slitter__per_cpu_get(uint32_t);
+extern bool slitter__per_cpu_put(uint32_t, void *);
+
+/**
+ * Defined in per_cpu.rs
+ */
+extern void *slitter__per_cpu_refill(struct slitter_class,
+    struct magazine_storage **out_storage);
+extern struct magazine_storage *slitter__per_cpu_clear(struct slitter_class,
+    void *spilled);
+extern void slitter__per_cpu_release(struct slitter_class, bool release,
+    struct magazine_storage *);
+
+struct per_cpu_table slitter__per_cpu;
+
+/*
+ * glibc (2.35+) registers every thread's rseq area, unless disabled
+ * with the `glibc.pthread.rseq=0` tunable; we only enable per-CPU
+ * mode if it did so for the main thread.
+ */
+__attribute__((__constructor__))
+static void
+per_cpu_init(void)
+{
+	struct per_cpu_magazines *slots;
+	const struct rseq *rseq;
+	long n_cpus;
+
+	if (__rseq_size == 0)
+		return;
+
+	rseq = (const void *)((char *)__builtin_thread_pointer() + __rseq_offset);
+	if ((int32_t)rseq->cpu_id < 0)
+		return;
+
+	n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (n_cpus <= 0 || n_cpus > UINT32_MAX / SLITTER__PER_CPU_MAX_CLASSES)
+		return;
+
+	slots = calloc((size_t)n_cpus * SLITTER__PER_CPU_MAX_CLASSES,
+	    sizeof(*slots));
+	if (slots == NULL)
+		return;
+
+	slitter__per_cpu.n_cpus = (uint32_t)n_cpus;
+	slitter__per_cpu.rseq_offset = __rseq_offset;
+	__atomic_store_n(&slitter__per_cpu.slots, slots, __ATOMIC_RELEASE);
+	return;
+}
+
+struct magazine_storage *
+slitter__per_cpu_exchange(uint32_t id, bool release,
+    struct magazine_storage *fresh)
+{
+	char *rseq = slitter__per_cpu_rseq();
+	struct per_cpu_magazines *slots = &slitter__per_cpu.slots[id];
+	struct magazine_storage **slot = release ? &slots->release : &slots->alloc;
+	struct magazine_storage *old;
+	uint64_t cpu;
+
+	asm volatile(
+	    SLITTER__RSEQ_ENTER("%[cpu]")
+	    "1:\n\t"
+	    SLITTER__RSEQ_CPU_OFFSET("[cpu]")
+	    "movq (%[slot], %[cpu]), %[old]\n\t"
+	    /* Commit. */
+	    "movq %[fresh], (%[slot], %[cpu])\n\t"
+	    "2:\n\t"
+	    "jmp 7f\n\t"
+	    "5:\n\t"
+	    "movq %[fresh], %[old]\n\t"
+	    "7:\n\t"
+	    SLITTER__RSEQ_ABORT()
+	    : [old] "=&r"(old), [cpu] "=&r"(cpu)
+	    : [slot] "r"(slot), [fresh] "r"(fresh), SLITTER__RSEQ_INPUTS
+	    : "memory", "cc");
+
+	return old;
+}
+
+void *
+slitter__per_cpu_allocate_slow(struct slitter_class class)
+{
+	struct magazine_storage *fresh = NULL;
+	struct magazine_storage *old;
+	void *ret;
+
+	/*
+	 * We may have migrated since the miss, so first try again:
+	 * this is cheap compared to the Rust slow path.
+	 */
+	ret = slitter__per_cpu_get(class.id);
+	if (ret != NULL)
+		return ret;
+
+	ret = slitter__per_cpu_refill(class, &fresh);
+	if (fresh == NULL)
+		return ret;
+
+	old = slitter__per_cpu_exchange(class.id, /*release=*/false, fresh);
+	if (old != NULL)
+		slitter__per_cpu_release(class, /*release=*/false, old);
+
+	return ret;
+}
+
+void
+slitter__per_cpu_release_slow(struct slitter_class class, void *ptr)
+{
+	struct magazine_storage *fresh;
+	struct magazine_storage *old;
+
+	if (slitter__per_cpu_put(class.id, ptr))
+		return;
+
+	fresh = slitter__per_cpu_clear(class, ptr);
+	if (fresh == NULL)
+		return;
+
+	old = slitter__per_cpu_exchange(class.id, /*release=*/true, fresh);
+	if (old != NULL)
+		slitter__per_cpu_release(class, /*release=*/true, old);
+
+	return;
+}
+#endif
+
+bool
+slitter__per_cpu_active(void)
+{
+
+#if SLITTER__PER_CPU
+	return __atomic_load_n(&slitter__per_cpu.slots, __ATOMIC_ACQUIRE) != NULL;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,240 @@
+#pragma once
+/*
+ * Per-CPU magazines, indexed by the current CPU with Linux
+ * restartable sequences (rseq), instead of by thread.
+ *
+ * Each CPU has one pair of `magazine_storage` pointers per class.
+ * Every access to these slots happens in an rseq critical section
+ * that ends with a single commit store: the section restarts if the
+ * thread is preempted, migrated, or interrupted by a signal before the
+ * commit, so there is never more than one writer per CPU.
+ *
+ * Per-CPU slots don't use `struct magazine`: the cached allocations
+ * are `allocations[0 ... num_allocated_slow - 1]`, for both the
+ * alloc and the release slots, and release slots are full at
+ * `limit`.  That's the same representation as magazines in the
+ * Rust code's global stacks, so the slow path can pass storage back
+ * and forth without conversion.
+ */
+#include "slitter.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "mag.h"
+
+#if SLITTER__PER_CPU
+
+/* The signature glibc registers for rseq on x86-64. */
+#define SLITTER__RSEQ_SIG 0x53053053
+
+/* Offsets in the kernel's `struct rseq`. */
+#define SLITTER__RSEQ_CPU_ID_OFFSET 4
+#define SLITTER__RSEQ_CS_OFFSET 8
+
+struct per_cpu_magazines {
+	struct magazine_storage *alloc;
+	struct magazine_storage *release;
+};
+
+struct per_cpu_table {
+	/*
+	 * The slots for class `id` on CPU `cpu` are at
+	 * `slots[cpu * SLITTER__PER_CPU_MAX_CLASSES + id]`.
+	 *
+	 * NULL until (and unless) rseq is known to work.
+	 */
+	struct per_cpu_magazines *slots;
+	/* Number of CPUs in `slots`. */
+	uint32_t n_cpus;
+	/* Offset of the thread's `struct rseq` from the thread pointer. */
+	ptrdiff_t rseq_offset;
+};
+
+extern struct per_cpu_table slitter__per_cpu;
+
+/*
+ * Emits the rseq critical section descriptor for a section that
+ * starts at label 1, commits right before label 2, and aborts to
+ * label 4, then points the thread's rseq area at it (label 6).
+ * The descriptor itself is label 3.
+ */
+#define SLITTER__RSEQ_ENTER(SCRATCH)					\
+	".pushsection __rseq_cs, \"aw\"\n\t"				\
+	".balign 32\n\t"						\
+	"3:\n\t"							\
+	".long 0x0, 0x0\n\t"						\
+	".quad 1f, (2f - 1f), 4f\n\t"					\
+	".popsection\n\t"						\
+	"6:\n\t"							\
+	"leaq 3b(%%rip), " SCRATCH "\n\t"				\
+	"movq " SCRATCH ", %c[cs_off](%[rseq])\n\t"
+
+/*
+ * The abort handler must be preceded by the signature; it restarts
+ * the whole sequence from label 6.
+ */
+#define SLITTER__RSEQ_ABORT()						\
+	".pushsection __rseq_failure, \"ax\"\n\t"			\
+	".byte 0x0f, 0xb9, 0x3d\n\t"					\
+	".long 0x53053053\n\t"						\
+	"4:\n\t"							\
+	"jmp 6b\n\t"							\
+	".popsection\n\t"
+
+/*
+ * Loads the current CPU id in `CPU` (zero-extended), jumps to the
+ * local label 5 if it's out of range, and otherwise converts it to a
+ * byte offset in the slots table.
+ */
+#define SLITTER__RSEQ_CPU_OFFSET(CPU)					\
+	"movl %c[cpu_off](%[rseq]), %k" CPU "\n\t"			\
+	"cmpl %[n_cpus], %k" CPU "\n\t"					\
+	"jae 5f\n\t"							\
+	"imulq %[row], %" CPU "\n\t"
+
+#define SLITTER__RSEQ_INPUTS						\
+	[rseq] "r"(rseq), [n_cpus] "r"(slitter__per_cpu.n_cpus),	\
+	[row] "r"((uint64_t)SLITTER__PER_CPU_MAX_CLASSES *		\
+	    sizeof(struct per_cpu_magazines)),				\
+	[cs_off] "i"(SLITTER__RSEQ_CS_OFFSET),				\
+	[cpu_off] "i"(SLITTER__RSEQ_CPU_ID_OFFSET),			\
+	[num_off] "i"(offsetof(struct magazine_storage, num_allocated_slow)), \
+	[limit_off] "i"(offsetof(struct magazine_storage, limit)),	\
+	[allocs_off] "i"(offsetof(struct magazine_storage, allocations))
+
+/**
+ * Returns whether class `id` should use the per-CPU cache.
+ */
+inline bool
+slitter__per_cpu_enabled(uint32_t id)
+{
+
+	return id < SLITTER__PER_CPU_MAX_CLASSES &&
+	    __atomic_load_n(&slitter__per_cpu.slots, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/**
+ * Returns the calling thread's rseq area.
+ */
+inline char *
+slitter__per_cpu_rseq(void)
+{
+
+	return (char *)__builtin_thread_pointer() + slitter__per_cpu.rseq_offset;
+}
+
+/**
+ * Attempts to pop one allocation from the current CPU's alloc slot
+ * for class `id`.  Returns NULL on miss.
+ *
+ * `slitter__per_cpu_enabled(id)` must be true.
+ */
+inline void *
+slitter__per_cpu_get(uint32_t id)
+{
+	char *rseq = slitter__per_cpu_rseq();
+	struct magazine_storage **slot = &slitter__per_cpu.slots[id].alloc;
+	void *ret;
+	uint64_t cpu, count;
+	struct magazine_storage *storage;
+
+	asm volatile(
+	    SLITTER__RSEQ_ENTER("%[cpu]")
+	    "1:\n\t"
+	    SLITTER__RSEQ_CPU_OFFSET("[cpu]")
+	    "movq (%[slot], %[cpu]), %[storage]\n\t"
+	    "testq %[storage], %[storage]\n\t"
+	    "jz 5f\n\t"
+	    "movzwl %c[num_off](%[storage]), %k[count]\n\t"
+	    "testl %k[count], %k[count]\n\t"
+	    "jz 5f\n\t"
+	    "subl $1, %k[count]\n\t"
+	    "movq %c[allocs_off](%[storage], %[count], 8), %[ret]\n\t"
+	    /* Commit. */
+	    "movw %w[count], %c[num_off](%[storage])\n\t"
+	    "2:\n\t"
+	    "jmp 7f\n\t"
+	    "5:\n\t"
+	    "xorl %k[ret], %k[ret]\n\t"
+	    "7:\n\t"
+	    SLITTER__RSEQ_ABORT()
+	    : [ret] "=&r"(ret), [cpu] "=&r"(cpu), [count] "=&r"(count),
+	      [storage] "=&r"(storage)
+	    : [slot] "r"(slot), SLITTER__RSEQ_INPUTS
+	    : "memory", "cc");
+
+	return ret;
+}
+
+/**
+ * Attempts to push `ptr` to the current CPU's release slot for
+ * class `id`.  Returns false on miss.
+ *
+ * `slitter__per_cpu_enabled(id)` must be true.
+ */
+inline bool
+slitter__per_cpu_put(uint32_t id, void *ptr)
+{
+	char *rseq = slitter__per_cpu_rseq();
+	struct magazine_storage **slot = &slitter__per_cpu.slots[id].release;
+	uint64_t cpu, count, ok;
+	struct magazine_storage *storage;
+
+	asm volatile(
+	    SLITTER__RSEQ_ENTER("%[cpu]")
+	    "1:\n\t"
+	    SLITTER__RSEQ_CPU_OFFSET("[cpu]")
+	    "movq (%[slot], %[cpu]), %[storage]\n\t"
+	    "testq %[storage], %[storage]\n\t"
+	    "jz 5f\n\t"
+	    "movzwl %c[num_off](%[storage]), %k[count]\n\t"
+	    /* We're done with the CPU offset; reuse the register. */
+	    "movzwl %c[limit_off](%[storage]), %k[cpu]\n\t"
+	    "cmpl %k[cpu], %k[count]\n\t"
+	    "jae 5f\n\t"
+	    "movq %[ptr], %c[allocs_off](%[storage], %[count], 8)\n\t"
+	    "addl $1, %k[count]\n\t"
+	    /* Commit. */
+	    "movw %w[count], %c[num_off](%[storage])\n\t"
+	    "2:\n\t"
+	    "movl $1, %k[ok]\n\t"
+	    "jmp 7f\n\t"
+	    "5:\n\t"
+	    "xorl %k[ok], %k[ok]\n\t"
+	    "7:\n\t"
+	    SLITTER__RSEQ_ABORT()
+	    : [ok] "=&r"(ok), [cpu] "=&r"(cpu), [count] "=&r"(count),
+	      [storage] "=&r"(storage)
+	    : [slot] "r"(slot), [ptr] "r"(ptr), SLITTER__RSEQ_INPUTS
+	    : "memory", "cc");
+
+	return ok != 0;
+}
+
+/**
+ * Installs `fresh` in the current CPU's alloc (or release, if
+ * `release` is true) slot for class `id`, and returns the slot's
+ * previous contents, which now belong to the caller.
+ *
+ * If the current CPU has no slot, returns `fresh`.
+ */
+struct magazine_storage *slitter__per_cpu_exchange(uint32_t id,
+    bool release, struct magazine_storage *fresh);
+
+/**
+ * Per-CPU slow paths: these refill or flush the current CPU's slots
+ * via the Rust slow path, and (like in the per-thread cache) never
+ * fail.
+ */
+void *slitter__per_cpu_allocate_slow(struct slitter_class);
+void slitter__per_cpu_release_slow(struct slitter_class, void *);
+
+#endif
+
+/**
+ * Returns whether the per-CPU cache is active.
+ */
+bool slitter__per_cpu_active(void);
@@ -1,8 +1,30 @@
 #include "span_metadata.h"
 
+uint64_t slitter__managed_chunks[SLITTER__MANAGED_CHUNK_WORDS];
+
 size_t
 slitter__span_metadata_size(void)
 {
 
 	return sizeof(struct span_metadata);
 }
+
+void
+slitter__register_chunk(uintptr_t data)
+{
+	uintptr_t chunk = data / SLITTER__DATA_ALIGNMENT;
+
+	if (chunk >= 64 * SLITTER__MANAGED_CHUNK_WORDS)
+		return;
+
+	__atomic_fetch_or(&slitter__managed_chunks[chunk / 64],
+	    1ULL << (chunk % 64), __ATOMIC_RELEASE);
+	return;
+}
+
+uint32_t
+slitter__class_id_of_address(const void *ptr)
+{
+
+	return slitter__class_id_of(ptr);
+}
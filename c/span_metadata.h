@@ -3,6 +3,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "constants.h"
+
 /**
  * Must match `SpanMetadata` in `mill.rs`.
  */
@@ -13,7 +15,80 @@ struct span_metadata {
 	uintptr_t span_begin;
 };
 
+/*
+ * We only track chunks in the bottom 2^48 bytes of address space,
+ * where mmap places regions unless asked otherwise.
+ */
+#define SLITTER__MANAGED_ADDRESS_BITS 48
+
+/*
+ * One bit per `SLITTER__DATA_ALIGNMENT`-aligned chunk of data: 32 KB
+ * with the default constants.  Bits are only ever set: chunks are
+ * immortal.
+ */
+#define SLITTER__MANAGED_CHUNK_WORDS \
+	((1ULL << SLITTER__MANAGED_ADDRESS_BITS) / SLITTER__DATA_ALIGNMENT / 64)
+
+extern uint64_t slitter__managed_chunks[SLITTER__MANAGED_CHUNK_WORDS];
+
 /**
  * Returns the size of `struct span_metadata` in C.
  */
 size_t slitter__span_metadata_size(void);
+
+/**
+ * Marks the `SLITTER__DATA_ALIGNMENT`-aligned chunk of data that
+ * starts at `data` as managed by Slitter.  Its metadata page must
+ * already be backed by memory.
+ *
+ * Chunks past `SLITTER__MANAGED_ADDRESS_BITS` can't be marked; they
+ * work normally, except that the class of their allocations can't be
+ * inferred from their address.
+ */
+void slitter__register_chunk(uintptr_t data);
+
+/**
+ * Out-of-line version of `slitter__class_id_of`, for the Rust side.
+ */
+uint32_t slitter__class_id_of_address(const void *ptr);
+
+/**
+ * Returns the span metadata for `ptr`, which must be in a chunk that
+ * Slitter manages.
+ */
+static inline const struct span_metadata *
+slitter__span_metadata_of(const void *ptr)
+{
+	uintptr_t address = (uintptr_t)ptr;
+	uintptr_t chunk_base = address & -SLITTER__DATA_ALIGNMENT;
+	uintptr_t chunk_offset = address % SLITTER__DATA_ALIGNMENT;
+	size_t span_index = chunk_offset / SLITTER__SPAN_ALIGNMENT;
+	uintptr_t meta_base = chunk_base -
+	    (SLITTER__GUARD_PAGE_SIZE + SLITTER__METADATA_PAGE_SIZE);
+	const struct span_metadata *meta = (void *)meta_base;
+
+	return &meta[span_index];
+}
+
+/**
+ * Returns the class id for `ptr`, or 0 if `ptr` is not in a span
+ * that Slitter manages.  Any `ptr` value is safe.
+ */
+static inline uint32_t
+slitter__class_id_of(const void *ptr)
+{
+	uintptr_t chunk = (uintptr_t)ptr / SLITTER__DATA_ALIGNMENT;
+	uint64_t word;
+
+	if (__builtin_expect(chunk >= 64 * SLITTER__MANAGED_CHUNK_WORDS, 0))
+		return 0;
+
+	word = __atomic_load_n(&slitter__managed_chunks[chunk / 64],
+	    __ATOMIC_ACQUIRE);
+	if (__builtin_expect((word & (1ULL << (chunk % 64))) == 0, 0))
+		return 0;
+
+	/* Spans that were never milled have a zero class id. */
+	return __atomic_load_n(&slitter__span_metadata_of(ptr)->class_id,
+	    __ATOMIC_RELAXED);
+}
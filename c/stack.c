@@ -1,17 +1,158 @@
 #include "stack.h"
 
 #include <assert.h>
+#include <stddef.h>
 
-static_assert(sizeof(struct stack) == 2 * sizeof(void *),
-    "A stack must consist of exactly two pointers.");
+static_assert(offsetof(struct stack, bits) == 0
+    && sizeof(((struct stack *)NULL)->bits) == 2 * sizeof(void *),
+    "A stack must start with exactly two pointers.");
+static_assert(offsetof(struct stack, cas_failures) == 64
+    && sizeof(struct stack) == 2 * 64,
+    "A stack's statistics must sit on their own cache line.");
 
 #define LOAD_ACQUIRE(X) __atomic_load_n(&(X), __ATOMIC_ACQUIRE)
 #define STORE_RELEASE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELEASE)
+#define ADD_RELAXED(X, V) __atomic_fetch_add(&(X), (V), __ATOMIC_RELAXED)
+
+/* Number of slots in the elimination array; must be a power of 2. */
+#define ELIMINATION_SLOTS 64
+
+/* A push waits this many spins for a pop to take its magazine. */
+#define ELIMINATION_SPINS 128
+
+/* Backoff after the n-th CAS failure spins min(2^n, MAX_BACKOFF) times. */
+#define MAX_BACKOFF 1024
+
+/*
+ * An elimination slot is empty, or holds a magazine that a concurrent
+ * push wants to add to `stack`.  Slots are shared by all stacks,
+ * indexed by a hash of the stack's address.
+ */
+struct __attribute__((__aligned__(64))) elimination_slot {
+	union {
+		struct {
+			struct stack *stack;
+			struct magazine_storage *mag;
+		};
+		__uint128_t bits;
+	};
+};
+
+static struct elimination_slot elimination[ELIMINATION_SLOTS];
+
+static inline void
+spin_pause(void)
+{
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+	return;
+}
+
+static void
+backoff(size_t failures)
+{
+	size_t spins = MAX_BACKOFF;
+
+	if (failures < __builtin_ctzll(MAX_BACKOFF))
+		spins = (size_t)1 << failures;
+
+	for (size_t i = 0; i < spins; i++)
+		spin_pause();
+
+	return;
+}
+
+/*
+ * Adds the CAS failures of one push or pop to the stack's count: one
+ * atomic per contended operation, rather than one per failure.
+ */
+static inline void
+count_cas_failures(struct stack *stack, size_t failures)
+{
+
+	if (failures > 0)
+		ADD_RELAXED(stack->cas_failures, failures);
+
+	return;
+}
+
+static struct elimination_slot *
+elimination_slot(const struct stack *stack)
+{
+	/* Stacks are 128-byte objects: mix in the higher bits. */
+	uintptr_t hash = (uintptr_t)stack / sizeof(*stack);
+
+	hash ^= hash >> 7;
+	return &elimination[hash % ELIMINATION_SLOTS];
+}
+
+/*
+ * Offers `mag` to a concurrent pop from `stack`, and returns true if
+ * a pop took it.  Otherwise, the caller still owns `mag`.
+ *
+ * Whoever withdraws a `(stack, mag)` pair from a slot is responsible
+ * for pushing `mag` to `stack`: even if `mag` was popped and pushed
+ * again in the meantime, the slot is only ever a transfer for `mag`.
+ */
+static bool
+eliminate_push(struct stack *stack, struct magazine_storage *mag)
+{
+	struct elimination_slot *slot = elimination_slot(stack);
+	struct elimination_slot empty = { .bits = 0 };
+	struct elimination_slot offer = { .stack = stack, .mag = mag };
+
+	if (LOAD_ACQUIRE(slot->mag) != NULL)
+		return false;
+
+	/* The magazine must look unlinked to the pop that takes it. */
+	mag->link = NULL;
+	/* The legacy `__sync` builtins are full barriers. */
+	if (!__sync_bool_compare_and_swap(&slot->bits, empty.bits, offer.bits))
+		return false;
+
+	for (size_t i = 0; i < ELIMINATION_SPINS; i++) {
+		if (LOAD_ACQUIRE(slot->mag) != mag)
+			break;
+
+		spin_pause();
+	}
+
+	/* If we can't withdraw the offer, a pop took it. */
+	return !__sync_bool_compare_and_swap(&slot->bits, offer.bits, empty.bits);
+}
+
+/*
+ * Attempts to take a magazine offered by a concurrent push to `stack`.
+ */
+static struct magazine_storage *
+eliminate_pop(struct stack *stack)
+{
+	struct elimination_slot *slot = elimination_slot(stack);
+	struct elimination_slot offer;
+	struct elimination_slot empty = { .bits = 0 };
+
+	offer.stack = LOAD_ACQUIRE(slot->stack);
+	offer.mag = LOAD_ACQUIRE(slot->mag);
+	if (offer.stack != stack || offer.mag == NULL)
+		return NULL;
+
+	/* The CAS fails if tearing gave us an inconsistent snapshot. */
+	if (!__sync_bool_compare_and_swap(&slot->bits, offer.bits, empty.bits))
+		return NULL;
+
+	ADD_RELAXED(stack->eliminations, 1);
+	return offer.mag;
+}
 
 void
 slitter__stack_push(struct stack *stack, struct magazine_storage *mag)
 {
 	struct stack curr, next;
+	size_t failures = 0;
 
 	/*
 	 * Make sure to load `generation` first: it's our monotonic
@@ -70,11 +211,24 @@ slitter__stack_push(struct stack *stack, struct magazine_storage *mag)
 		 * than the release path.
 		 */
 		if (__builtin_expect(actual.generation == curr.generation, 1))
-			return;
+			break;
 
-		curr = actual;
+		if (eliminate_push(stack, mag)) {
+			failures++;
+			break;
+		}
+
+		backoff(failures++);
+		/*
+		 * `actual` is stale by now.  Reload in the same order
+		 * as on entry, so the snapshot is still consistent
+		 * when the CAS succeeds.
+		 */
+		curr.generation = LOAD_ACQUIRE(stack->generation);
+		curr.top_of_stack = LOAD_ACQUIRE(stack->top_of_stack);
 	}
 
+	count_cas_failures(stack, failures);
 	return;
 }
 
@@ -82,6 +236,7 @@ bool
 slitter__stack_pop(struct stack *stack, struct magazine_storage **out)
 {
 	struct stack curr, next;
+	size_t failures = 0;
 
 	curr.generation = LOAD_ACQUIRE(stack->generation);
 	curr.top_of_stack = LOAD_ACQUIRE(stack->top_of_stack);
@@ -92,8 +247,10 @@ slitter__stack_pop(struct stack *stack, struct magazine_storage **out)
 		struct stack actual;
 		struct magazine_storage *tos = curr.top_of_stack;
 
-		if (__builtin_expect(tos == NULL, 0))
+		if (__builtin_expect(tos == NULL, 0)) {
+			count_cas_failures(stack, failures);
 			return false;
+		}
 
 		/*
 		 * The ordering semantics of
@@ -112,12 +269,22 @@ slitter__stack_pop(struct stack *stack, struct magazine_storage **out)
 		actual.bits = __sync_val_compare_and_swap(&stack->bits,
 		    curr.bits, next.bits);
 		if (__builtin_expect(actual.generation == curr.generation, 1)) {
+			count_cas_failures(stack, failures);
 			tos->link = NULL;
 			*out = tos;
 			return true;
 		}
 
-		curr = actual;
+		tos = eliminate_pop(stack);
+		if (tos != NULL) {
+			count_cas_failures(stack, failures + 1);
+			*out = tos;
+			return true;
+		}
+
+		backoff(failures++);
+		curr.generation = LOAD_ACQUIRE(stack->generation);
+		curr.top_of_stack = LOAD_ACQUIRE(stack->top_of_stack);
 	}
 
 	return false;
@@ -149,5 +316,6 @@ slitter__stack_try_pop(struct stack *stack, struct magazine_storage **out)
 		return true;
 	}
 
+	ADD_RELAXED(stack->cas_failures, 1);
 	return false;
 }
@@ -12,8 +12,13 @@
  * logic, with a generation counter for ABA protection: we don't have
  * to worry about safe memory reclamation because `struct
  * magazine_storage` are immortal.
+ *
+ * When the CAS fails, pushes and pops back off exponentially (up to
+ * a bound), and first try to pair up in a global elimination array:
+ * a pop may directly take the magazine of a concurrent push to the
+ * same stack, without touching `top_of_stack`.
  */
-struct __attribute__((__aligned__(16))) stack {
+struct __attribute__((__aligned__(64))) stack {
 	union {
 		struct {
 			struct magazine_storage *top_of_stack;
@@ -21,6 +26,16 @@ struct __attribute__((__aligned__(16))) stack {
 		};
 		__uint128_t bits;
 	};
+	/*
+	 * The statistics live on their own cache line, so updating
+	 * them doesn't slow down CASes on `bits`.
+	 */
+	struct __attribute__((__aligned__(64))) {
+		/* Number of failed CASes on `bits`. */
+		uint64_t cas_failures;
+		/* Number of pushes that were handed directly to a pop. */
+		uint64_t eliminations;
+	};
 };
 
 /**
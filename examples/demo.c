@@ -70,6 +70,51 @@ main()
         slitter_release(base_tag, base);
         slitter_release(derived_tag, derived);
 
+        /* Batch calls work the same way, and skip NULL on release. */
+        {
+                struct base *bases[100];
+                struct base *hole;
+
+                slitter_allocate_many(base_tag, (void **)bases, 100);
+                for (size_t i = 0; i < 100; i++)
+                        assert(bases[i]->x == 0);
+
+                hole = bases[50];
+                bases[50] = NULL;
+                slitter_release_many(base_tag, (void **)bases, 100);
+                slitter_release(base_tag, hole);
+        }
+
+        /* Families pick the smallest class that fits each size. */
+        {
+                const struct slitter_class_family *buffers;
+                char *small, *large;
+
+                buffers = slitter_class_family_register(
+                    &(struct slitter_class_family_config) {
+                        .name_prefix = "buffer",
+                        .min_size = 16,
+                        .max_size = 4096,
+                    });
+
+                small = slitter_allocate_size(buffers, 10);
+                large = slitter_allocate_size(buffers, 1000);
+                small[9] = large[999] = 'x';
+
+                slitter_release_size(buffers, small, 10);
+                slitter_release_size(buffers, large, 1000);
+        }
+
+        /* Slitter can also find the class from the address. */
+        {
+                int local;
+
+                derived = slitter_allocate(derived_tag);
+                assert(slitter_usable_size(derived) == sizeof(*derived));
+                assert(slitter_usable_size(&local) == 0);
+                slitter_release_any(derived);
+        }
+
 #ifdef MISMATCH
         /* Allocate from the "derived" tag. */
         derived = slitter_allocate(derived_tag);
@@ -77,7 +122,7 @@ main()
         /*
          * Free its "base" member.  This will crash with
          * something like
-         * `demo: c/cache.c:94: slitter_release: Assertion `class.id == span->class_id && "class mismatch"' failed.`
+         * `demo: c/cache.c:123: check_class: Assertion `class.id == span->class_id && "class mismatch"' failed.`
          */
         slitter_release(base_tag, &derived->base);
 #endif
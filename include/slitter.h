@@ -15,6 +15,23 @@ struct slitter_class {
 	uint32_t id;
 };
 
+/**
+ * How a class populates the pages that back its objects.
+ */
+enum slitter_prefault {
+	/* Let the kernel demand-fault pages on first write. */
+	SLITTER_PREFAULT_NEVER = 0,
+	/* Populate each new span before allocating from it. */
+	SLITTER_PREFAULT_INLINE = 1,
+	/* Populate each new span in a background thread. */
+	SLITTER_PREFAULT_BACKGROUND = 2,
+};
+
+/**
+ * The largest object alignment a class may request.
+ */
+#define SLITTER_MAX_ALIGNMENT 4096
+
 struct slitter_class_config {
 	/*
 	 * The name of the object class. Nullable. 
@@ -25,7 +42,8 @@ struct slitter_class_config {
 
 	/*
 	 * The size of each object in the allocation class.  Allocations
-	 * are only guaranteed alignment to 8 bytes.
+	 * are only guaranteed alignment to 8 bytes, unless the class
+	 * asks for more with `alignment`.
 	 */
 	size_t size;
 
@@ -37,9 +55,51 @@ struct slitter_class_config {
         /*
          * The name of the underlying mapper, or NULL for default.
          *
-         * A mapper name of "file" will use the file-backed mapper.
+         * A mapper name of "file" will use the file-backed mapper,
+         * which backs all its data with one sparse temporary file.
+         * "thp" backs object data with transparent huge pages, and
+         * "hugetlb" with explicit huge pages from the hugetlbfs pool,
+         * falling back to transparent huge pages when the pool is
+         * empty.
          */
         const char *mapper_name;
+
+	/*
+	 * The initial number of objects each magazine in the class's
+	 * caches holds, or 0 for the default (30).
+	 *
+	 * Larger magazines amortise global synchronisation over more
+	 * allocations, at the expense of caching more objects in each
+	 * thread.  The effective size adapts to how often threads
+	 * refill or flush magazines, between a quarter and twice the
+	 * initial value (at most 510).
+	 */
+	size_t magazine_size;
+
+	/*
+	 * Whether to populate the pages of each new span of objects
+	 * (e.g., with `MADV_POPULATE_WRITE`), rather than take page
+	 * faults on first write.  Defaults to SLITTER_PREFAULT_NEVER.
+	 */
+	enum slitter_prefault prefault;
+
+	/*
+	 * The alignment of each object in the class, a power of two
+	 * up to `SLITTER_MAX_ALIGNMENT`, or 0 for the default (8).
+	 *
+	 * Alignments below 8 bytes are rounded up to 8, and object
+	 * sizes are rounded up to a multiple of their alignment.
+	 */
+	size_t alignment;
+	/*
+	 * If true, objects that go to different threads' caches never
+	 * share a (pair of) cache line(s), to avoid false sharing.
+	 * Objects are not padded; instead, the class carves objects
+	 * out of a span in runs that cover whole cache lines.  Single
+	 * allocations without a thread cache leave the rest of their
+	 * run in the class's depot.
+	 */
+	bool isolate_cache_lines;
 };
 
 #define DEFINE_SLITTER_CLASS(NAME, ...)					\
@@ -62,6 +122,84 @@ struct slitter_class_config {
  */
 struct slitter_class slitter_class_register(const struct slitter_class_config *);
 
+/**
+ * Class families split each power of two between their minimum and
+ * maximum size in this many classes by default.
+ */
+#define SLITTER_CLASS_FAMILY_DEFAULT_CLASSES_PER_DOUBLING 4
+
+/**
+ * Families map sizes to classes in steps of this many bytes.
+ */
+#define SLITTER_CLASS_FAMILY_GRANULE 16
+
+/**
+ * The largest `max_size` for a class family.
+ */
+#define SLITTER_CLASS_FAMILY_MAX_SIZE (1UL << 20)
+
+struct slitter_class_family_config {
+	/*
+	 * The prefix for the name of each class in the family.  Nullable.
+	 *
+	 * Each class is named "<name_prefix>_<object size>".  Must point
+	 * to a NUL-terminated string of utf-8 bytes if non-NULL.
+	 */
+	const char *name_prefix;
+
+	/*
+	 * The object size for the smallest class in the family, rounded
+	 * up to a multiple of `SLITTER_CLASS_FAMILY_GRANULE`.
+	 */
+	size_t min_size;
+
+	/*
+	 * The largest size the family services, at most
+	 * `SLITTER_CLASS_FAMILY_MAX_SIZE`.
+	 */
+	size_t max_size;
+
+	/*
+	 * The number of classes between consecutive powers of two, or 0
+	 * for the default (4).  Internal fragmentation is at most
+	 * 1 / classes_per_doubling.
+	 */
+	uint32_t classes_per_doubling;
+
+	/*
+	 * If true, zero-fill recycled allocations.
+	 */
+	bool zero_init;
+
+	/*
+	 * The name of the underlying mapper, or NULL for default.  See
+	 * `struct slitter_class_config`.
+	 */
+	const char *mapper_name;
+};
+
+/**
+ * A family of object classes with geometrically increasing sizes,
+ * returned by `slitter_class_family_register`.  Families are
+ * immortal and immutable.
+ *
+ * The fields are internal; use `slitter_class_family_lookup`,
+ * `slitter_allocate_size` and `slitter_release_size`.
+ */
+struct slitter_class_family {
+	size_t max_size;
+	/* `classes[ceil(size / SLITTER_CLASS_FAMILY_GRANULE)]` fits `size`. */
+	const struct slitter_class *classes;
+};
+
+/**
+ * Registers a new family of allocation classes, or dies trying.
+ *
+ * The config must be a valid pointer.  On error, this function will abort.
+ */
+const struct slitter_class_family *slitter_class_family_register(
+    const struct slitter_class_family_config *);
+
 /**
  * Updates the parent directory for the file-backed slabs' backing
  * files.  NULL resets to the default.
@@ -75,6 +213,183 @@ struct slitter_class slitter_class_register(const struct slitter_class_config *)
  */
 void slitter_set_file_backed_slab_directory(const char *directory);
 
+/**
+ * Registers a persistent mapper called `name`, for the heap in the
+ * directory `dir`.  Classes that use this mapper allocate from files
+ * in `dir`, at fixed addresses from `base` (aligned to 1 GB) for up
+ * to `max_size` bytes of objects, and twice that much address space.
+ *
+ * If `dir` already holds a heap from a previous process, the heap's
+ * objects come back at the same addresses, and each class registered
+ * with this mapper recovers its objects by name; registration fails
+ * if the class's size, alignment, or `isolate_cache_lines` flag
+ * changed.  Persistent classes must have a name.  Call
+ * `slitter_thread_cache_flush` in all threads before exiting: objects
+ * in thread caches stay allocated after a restart.  Recovery is not
+ * crash-safe, and a heap must only be used by one process at a time.
+ *
+ * Returns 0 on success, and `-errno` on failure.  Registration is not
+ * idempotent: it fails with `-EEXIST` for a known persistent mapper.
+ */
+int slitter_register_persistent_mapper(const char *name, const char *dir,
+    uintptr_t base, size_t max_size);
+
+/**
+ * Returns the address of the root pointer for the persistent mapper
+ * `name`, or NULL if there is no such mapper.  The root is NULL in a
+ * new heap, and survives restarts.
+ */
+void **slitter_persistent_root(const char *name);
+
+/**
+ * Updates the fill level, in percent, at which Slitter starts
+ * mapping the next 1 GB chunk of data in a background thread, so
+ * that allocations don't wait for `mmap` when the current chunk is
+ * exhausted.  The default is 50; 100 or more disables pre-mapping.
+ *
+ * It is safe to call this function at any time.
+ */
+void slitter_set_chunk_premap_threshold(uint32_t percent);
+
+/**
+ * Sizes the calling thread's cache for all the object classes
+ * registered so far, in one call.  Otherwise, the thread grows its
+ * cache the first time it allocates from or releases to a class
+ * registered after its cache was last sized.
+ *
+ * Programs with many classes may call this function when they
+ * create each thread, after registering their classes.
+ */
+void slitter_prepare_thread_cache(void);
+
+/**
+ * Returns all the magazines in the calling thread's cache to their
+ * object classes, so that other threads may reuse the objects they
+ * hold.  The cache refills as usual on the thread's next allocations.
+ *
+ * Long-lived threads may call this function before going idle.
+ */
+void slitter_thread_cache_flush(void);
+
+/**
+ * Updates the period, in milliseconds, between two scans of the
+ * background thread cache scavenger, and starts the scavenger if
+ * necessary.  The scavenger is paused by default, and when
+ * `period_ms` is 0.
+ *
+ * Threads that do not enter their slow path (i.e., do not refill or
+ * spill a magazine) for a full period are idle: the scavenger
+ * reclaims the spare magazines and inboxes of idle threads.  It only
+ * scavenges these; the magazines of the allocation and release fast
+ * paths stay in the thread's cache until `slitter_thread_cache_flush`
+ * or thread exit.
+ *
+ * It is safe to call this function at any time.
+ */
+void slitter_set_cache_scavenge_period(uint64_t period_ms);
+
+/**
+ * Prepares the object class for `count` live allocations: allocates
+ * that many objects, populates the pages that back them, and
+ * releases them back to the class's caches.
+ *
+ * This is meant to be called once, at startup, so that the first
+ * allocations don't stall on page faults.
+ */
+void slitter_class_warmup(struct slitter_class, size_t count);
+
+/**
+ * A snapshot of an object class's statistics.
+ *
+ * Allocations and releases on the fast path only update plain
+ * per-thread counters, which each thread folds into the class's
+ * totals when it hits a slow path, or exits.  Counts thus lag, but
+ * `live_objects` is only off by about a magazine's worth of objects
+ * per thread (or per CPU, with the per-CPU cache).
+ */
+struct slitter_class_stats {
+	/* Number of objects currently allocated. */
+	uint64_t live_objects;
+	/* Total number of allocations and releases. */
+	uint64_t allocations;
+	uint64_t releases;
+	/* Number of (immortal) spans of objects, and their size in bytes. */
+	uint64_t span_count;
+	uint64_t bytes_mapped;
+	/* Number of cached magazines in the global depot, and their objects. */
+	uint64_t depot_magazines;
+	uint64_t depot_objects;
+	/* Number of magazine refills and flushes on the slow path. */
+	uint64_t slow_allocations;
+	uint64_t slow_releases;
+	/* Depot magazines found in the local NUMA shard, or stolen. */
+	uint64_t depot_local_pops;
+	uint64_t depot_remote_pops;
+	/*
+	 * Failed updates to the depot's stacks under contention, and
+	 * magazines directly handed from a releasing to an allocating
+	 * thread.
+	 */
+	uint64_t depot_cas_failures;
+	uint64_t depot_eliminations;
+};
+
+/**
+ * Returns a snapshot of the class's statistics.
+ *
+ * It is safe to call this function at any time.
+ */
+struct slitter_class_stats slitter_class_stats(struct slitter_class);
+
+/**
+ * Lets the operating system reclaim (with `MADV_FREE`) the pages that
+ * only back free objects cached in the class's global depot, but
+ * holds back at least `keep` of the most recently cached objects.
+ *
+ * Purged objects stay mapped and keep their class, so the stable-type
+ * guarantee holds; their contents are undefined until reallocated.
+ * Objects in per-thread (or per-CPU) caches are never purged.
+ *
+ * Returns the number of bytes purged.  It is safe to call this
+ * function at any time, e.g., periodically or after a traffic spike.
+ */
+size_t slitter_class_purge(struct slitter_class, size_t keep);
+
+/**
+ * Tells the operating system that all the pages that back the
+ * class's objects, live or free, are cold, with `MADV_COLD`: under
+ * memory pressure, they are reclaimed (swapped out to the backing
+ * file, for the "file" mapper) before hotter pages.  If `pageout` is
+ * true, asks the kernel to reclaim them right away, with
+ * `MADV_PAGEOUT`.
+ *
+ * Objects keep their contents, but accessing them may page fault.
+ *
+ * Returns 0 on success, and a negated errno on failure (e.g.,
+ * `-EINVAL` on kernels older than 5.4).  It is safe to call this
+ * function at any time.
+ */
+int slitter_class_advise_cold(struct slitter_class, bool pageout);
+
+/**
+ * Updates the mean number of bytes each thread allocates between
+ * two heap profile samples.  Sampling is disabled by default, and
+ * when `bytes` is 0.
+ *
+ * Samples are only taken when a thread refills its cache, so the
+ * allocation fast path is unaffected.
+ */
+void slitter_set_heap_sample_interval(size_t bytes);
+
+/**
+ * Writes a heap profile of the sampled allocations for the object
+ * class to the file at `path`, in the legacy gperftools text format
+ * that `pprof` understands.
+ *
+ * Returns 0 on success, and a negated errno on failure.
+ */
+int slitter_class_write_heap_profile(struct slitter_class, const char *path);
+
 /**
  * Returns a new allocation for the object class.
  *
@@ -86,6 +401,21 @@ void slitter_set_file_backed_slab_directory(const char *directory);
  */
 void *slitter_allocate(struct slitter_class);
 
+/**
+ * Populates `dst[0 ... count - 1]` with new allocations for the
+ * object class.
+ *
+ * This is equivalent to calling `slitter_allocate` `count` times,
+ * but copies runs of cached allocations in bulk.
+ *
+ * On error, this function will abort.
+ *
+ * Behaviour is undefined if the `slitter_class` argument is
+ * zero-filled or was otherwise not returned by
+ * `slitter_class_register`.
+ */
+void slitter_allocate_many(struct slitter_class, void **dst, size_t count);
+
 /**
  * Passes ownership of `ptr` back to the object class.
  *
@@ -99,3 +429,125 @@ void *slitter_allocate(struct slitter_class);
  * `slitter_class_register`.
  */
 void slitter_release(struct slitter_class, void *ptr);
+
+/**
+ * Passes ownership of `ptrs[0 ... count - 1]` back to the object
+ * class.
+ *
+ * Each pointer must be NULL, or have been returned by a call to
+ * `slitter_allocate` or `slitter_allocate_many`.  NULL pointers
+ * are skipped.  The contents of the `ptrs` array are unspecified
+ * on return.
+ *
+ * On error, this function will abort.
+ *
+ * Behaviour is undefined if the `slitter_class` argument is
+ * zero-filled or was otherwise not returned by
+ * `slitter_class_register`.
+ */
+void slitter_release_many(struct slitter_class, void **ptrs, size_t count);
+
+/**
+ * Passes ownership of `ptr` back to its object class, which Slitter
+ * finds from the span metadata for `ptr`.
+ *
+ * `ptr` must be NULL, or have been returned by a call to
+ * `slitter_allocate` or `slitter_allocate_many`, for any class.
+ *
+ * Aborts if Slitter does not manage `ptr`.
+ */
+void slitter_release_any(void *ptr);
+
+/**
+ * Returns the object size of the class that `ptr` belongs to, or 0
+ * if `ptr` is NULL or Slitter does not manage `ptr`.
+ *
+ * Any `ptr` is safe.
+ */
+size_t slitter_usable_size(const void *ptr);
+
+/**
+ * An arena tracks allocations from any number of object classes,
+ * and releases them all at once.  Arenas are not thread-safe, but
+ * may be passed between threads.
+ */
+struct slitter_arena;
+
+/**
+ * Returns a new, empty, arena.
+ */
+struct slitter_arena *slitter_arena_create(void);
+
+/**
+ * Returns a new allocation for the object class, owned by `arena`.
+ *
+ * The allocation must not be passed to `slitter_release`: it stays
+ * valid until the next call to `slitter_arena_release` or
+ * `slitter_arena_destroy` for `arena`.
+ *
+ * On error, this function will abort.
+ */
+void *slitter_arena_allocate(struct slitter_arena *arena, struct slitter_class);
+
+/**
+ * Passes ownership of all the allocations in `arena` back to their
+ * object classes, in bulk.  The arena is empty, and may be reused,
+ * on return.
+ */
+void slitter_arena_release(struct slitter_arena *arena);
+
+/**
+ * Releases all the allocations in `arena`, like
+ * `slitter_arena_release`, and destroys the arena.
+ *
+ * `arena` may be NULL.
+ */
+void slitter_arena_destroy(struct slitter_arena *arena);
+
+/**
+ * Returns the smallest class in `family` for objects of `size` bytes.
+ *
+ * Aborts if `size` exceeds the family's `max_size`.
+ */
+static inline struct slitter_class
+slitter_class_family_lookup(const struct slitter_class_family *family,
+    size_t size)
+{
+
+	if (__builtin_expect(size > family->max_size, 0))
+		__builtin_trap();
+
+	return family->classes[(size + SLITTER_CLASS_FAMILY_GRANULE - 1) /
+	    SLITTER_CLASS_FAMILY_GRANULE];
+}
+
+/**
+ * Returns a new allocation of at least `size` bytes from `family`.
+ *
+ * The allocation must be released with `slitter_release_size` and
+ * the same `size`, or with `slitter_release` and the class returned
+ * by `slitter_class_family_lookup`.
+ *
+ * On error, this function will abort.
+ */
+static inline void *
+slitter_allocate_size(const struct slitter_class_family *family, size_t size)
+{
+
+	return slitter_allocate(slitter_class_family_lookup(family, size));
+}
+
+/**
+ * Passes ownership of `ptr`, which must be NULL or have been returned
+ * by `slitter_allocate_size(family, size)`, back to its class.
+ *
+ * On error, this function will abort.
+ */
+static inline void
+slitter_release_size(const struct slitter_class_family *family, void *ptr,
+    size_t size)
+{
+
+	slitter_release(slitter_class_family_lookup(family, size), ptr);
+	return;
+}
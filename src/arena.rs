@@ -0,0 +1,222 @@
+//! An `Arena` tracks allocations from any number of classes, and
+//! releases them all at once, e.g., at the end of a request.
+//!
+//! Arena allocations come from the regular allocation path, so they
+//! keep the classes' type stability guarantees.  The arena records
+//! each allocation in a magazine it owns, one class at a time, and
+//! releasing the arena hands these magazines directly to their
+//! class, like a thread cache would: one magazine push (with the
+//! usual double free and class checks) per magazine of objects,
+//! instead of one release call per object.
+use std::ffi::c_void;
+use std::ptr::NonNull;
+
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_allocation_map;
+
+use crate::class::Class;
+use crate::linear_ref::LinearRef;
+use crate::magazine::PushMagazine;
+
+/// The magazines that track an arena's allocations for one class.
+struct ArenaClass {
+    /// New allocations go in this magazine.
+    current: PushMagazine,
+    /// Magazines that are already full.
+    full: Vec<PushMagazine>,
+}
+
+/// A set of allocations that are released together.  Arenas are not
+/// thread-safe, but may move between threads.
+#[derive(Default)]
+pub struct Arena {
+    /// Indexed by class id.
+    classes: Vec<Option<ArenaClass>>,
+    /// The classes with an entry in `classes`.
+    used: Vec<Class>,
+}
+
+/// Magazines own their storage, so they may move between threads.
+unsafe impl Send for Arena {}
+
+impl ArenaClass {
+    fn new(class: Class) -> Self {
+        Self {
+            current: new_magazine(class),
+            full: Vec::new(),
+        }
+    }
+}
+
+/// Returns an empty magazine for `class` that does not stop short of
+/// its full capacity.
+fn new_magazine(class: Class) -> PushMagazine {
+    let mut mag: PushMagazine = class.info().rack.allocate_empty_magazine();
+
+    mag.set_limit(usize::MAX);
+    mag
+}
+
+/// Hands all the allocations in `mag` back to `class`.
+fn release_magazine(class: Class, mut mag: PushMagazine) {
+    let info = class.info();
+
+    // Partial magazines in the depot must stay below the class's
+    // limit, for `allocate_non_full_magazine`: anything at or
+    // past the limit goes back as a full magazine.
+    mag.set_limit(info.magazine_limit());
+
+    #[cfg(any(
+        all(test, feature = "check_contracts_in_tests"),
+        feature = "check_contracts"
+    ))]
+    for slot in mag.populated() {
+        let block = unsafe { (*slot.as_ptr()).get() };
+
+        debug_allocation_map::mark_released(class, block)
+            .expect("Arena allocations must not be released individually.");
+    }
+
+    info.counters.fold(0, mag.len() as u64);
+    info.release_magazine(mag, None);
+}
+
+impl Arena {
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// Returns a new allocation for `class`, owned by this arena.
+    ///
+    /// The allocation must not be released with `Class::release`:
+    /// it stays valid until the next call to `release_all`.
+    #[inline]
+    pub fn allocate(&mut self, class: Class) -> Option<NonNull<c_void>> {
+        let index = class.id().get() as usize;
+        let block = class.allocate()?;
+
+        if self.classes.len() <= index {
+            self.classes.resize_with(index + 1, || None);
+        }
+
+        let entry = match &mut self.classes[index] {
+            Some(entry) => entry,
+            slot => {
+                self.used.push(class);
+                slot.insert(ArenaClass::new(class))
+            }
+        };
+
+        // The caller only borrows the allocation; the arena owns it.
+        if let Some(block) = entry.current.put(LinearRef::new(block)) {
+            let full = std::mem::replace(&mut entry.current, new_magazine(class));
+
+            entry.full.push(full);
+            assert_eq!(entry.current.put(block), None);
+        }
+
+        Some(block)
+    }
+
+    /// Releases all the allocations in this arena to their classes.
+    /// The arena is empty (but still usable) on return.
+    pub fn release_all(&mut self) {
+        for class in self.used.drain(..) {
+            let entry = self.classes[class.id().get() as usize]
+                .take()
+                .expect("used classes must have an entry");
+
+            for mag in entry.full {
+                release_magazine(class, mag);
+            }
+
+            release_magazine(class, entry.current);
+        }
+    }
+}
+
+impl Drop for Arena {
+    fn drop(&mut self) {
+        self.release_all();
+    }
+}
+
+#[test]
+fn arena_smoke_test() {
+    use crate::ClassConfig;
+
+    let classes: Vec<Class> = [16, 48]
+        .iter()
+        .map(|size| {
+            Class::new(ClassConfig::for_test(format!("arena_{}", size), *size))
+                .expect("Should build")
+        })
+        .collect();
+
+    let mut arena = Arena::new();
+    for _ in 0..3 {
+        for i in 0..1000 {
+            let class = classes[i % classes.len()];
+            let alloc = arena.allocate(class).expect("Should allocate");
+
+            unsafe { std::ptr::write_bytes(alloc.as_ptr() as *mut u8, 42, 16) };
+        }
+
+        arena.release_all();
+        for class in classes.iter() {
+            let stats = class.stats();
+
+            assert!(stats.depot_magazines > 0);
+            // The thread cache may lag behind on allocations.
+            assert!(stats.releases >= 500);
+        }
+    }
+
+    // Dropping the arena releases its allocations too.
+    let alloc = arena.allocate(classes[0]).expect("Should allocate");
+    std::mem::drop(arena);
+    assert_ne!(alloc.as_ptr(), std::ptr::null_mut());
+}
+
+#[test]
+fn arena_magazines_respect_class_limit() {
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig::for_test("arena_limit", 16)).expect("Should build");
+
+    // Objects to release later, from a fresh thread.
+    let held: Vec<usize> = (0..10)
+        .map(|_| class.allocate().expect("Should allocate").as_ptr() as usize)
+        .collect();
+
+    let mut arena = Arena::new();
+    for _ in 0..45 {
+        arena.allocate(class).expect("Should allocate");
+    }
+
+    arena.release_all();
+
+    let info = class.info();
+    let limit = info.magazine_limit();
+    let mags = info.depot.pop_all();
+    assert!(!mags.is_empty());
+    for (_, mag) in mags.iter() {
+        assert!(mag.is_full() || mag.len() < limit);
+    }
+
+    for (shard, mag) in mags {
+        info.depot.push_to_shard(shard, mag);
+    }
+
+    // A fresh thread cache needs a non-full magazine for these.
+    std::thread::spawn(move || {
+        for alloc in held {
+            class.release(NonNull::new(alloc as *mut c_void).expect("Should be non-null"));
+        }
+    })
+    .join()
+    .expect("Releases should succeed");
+}
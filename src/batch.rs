@@ -0,0 +1,175 @@
+//! This module services batch allocation and deallocation calls,
+//! for callers that need many objects of the same class at once.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::ffi::c_void;
+use std::ptr::NonNull;
+
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_allocation_map;
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_type_map;
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::press;
+
+use crate::cache;
+use crate::class::Class;
+use crate::class::ClassInfo;
+use crate::linear_ref::LinearRef;
+use crate::map;
+
+/// `Option<NonNull<c_void>>` and `Option<LinearRef>` have the same
+/// representation (`LinearRef` is a transparent `NonNull`), so we can
+/// convert slices of one to the other in place.
+#[inline(always)]
+fn as_linear_refs(slots: &mut [Option<NonNull<c_void>>]) -> &mut [Option<LinearRef>] {
+    unsafe { &mut *(slots as *mut [Option<NonNull<c_void>>] as *mut [Option<LinearRef>]) }
+}
+
+impl Class {
+    /// Attempts to populate `dst` with newly allocated objects for
+    /// this `Class`.
+    ///
+    /// Returns the number of slots populated at the beginning of
+    /// `dst`; that number is only less than `dst.len()` on OOM.
+    #[requires(dst.iter().all(|x| x.is_none()),
+               "Destination slots must be empty on entry.")]
+    #[ensures(dst.iter().take(ret).all(|x| x.is_some()),
+              "Populated slots form a prefix of `dst`.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_allocation_map::mark_allocated(self, x).is_ok()),
+              "Successful allocations match the class and avoid double-allocation.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_type_map::ptr_is_class(self, x).is_ok()),
+              "Successful allocations come from an address of the correct class.")]
+    #[ensures(dst.iter().flatten().all(|x| press::check_allocation(self, x.as_ptr() as usize).is_ok()),
+              "Sucessful allocations must have the allocation metadata set correctly.")]
+    #[inline(always)]
+    pub fn allocate_many(self, dst: &mut [Option<NonNull<c_void>>]) -> usize {
+        cache::allocate_many(self, as_linear_refs(dst))
+    }
+
+    /// Marks all the objects in `blocks` ready for reuse; `None`
+    /// entries are ignored.  On return, all the slots are `None`.
+    #[requires(blocks.iter().flatten().all(|x| debug_allocation_map::mark_released(self, x).is_ok()),
+               "Released blocks must match the class and not double-free.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_type_map::ptr_is_class(self, x).is_ok()),
+               "Released blocks come from an address of the correct class.")]
+    #[ensures(blocks.iter().all(|x| x.is_none()),
+              "All the blocks have been released.")]
+    #[inline(always)]
+    pub fn release_many(self, blocks: &mut [Option<NonNull<c_void>>]) {
+        cache::release_many(self, as_linear_refs(blocks));
+    }
+
+    /// Prepares this `Class` for `count` live allocations: allocates
+    /// `count` objects, populates the pages that back them, and
+    /// releases them to the calling thread's cache and the class's
+    /// depot.
+    ///
+    /// This is meant to be called once, at startup, to avoid page
+    /// faults in the first allocations.
+    pub fn warmup(self, count: usize) {
+        let page_size = map::page_size();
+        let object_size = self.info().layout.size();
+
+        let mut objects: Vec<Option<NonNull<c_void>>> = vec![None; count];
+        let allocated = self.allocate_many(&mut objects);
+
+        // Objects are mostly contiguous: coalesce their pages into
+        // ranges, to populate each range with a single call.
+        let mut pages: Vec<(usize, usize)> = objects[0..allocated]
+            .iter()
+            .flatten()
+            .map(|object| {
+                let begin = object.as_ptr() as usize;
+
+                (begin / page_size, (begin + object_size - 1) / page_size + 1)
+            })
+            .collect();
+        pages.sort_unstable();
+
+        let populate = |(begin, end): (usize, usize)| {
+            let base = NonNull::new((begin * page_size) as *mut c_void).expect("never NULL");
+            // This is only an optimisation; ignore failures.
+            let _ = map::populate_region(base, (end - begin) * page_size);
+        };
+
+        let mut current: Option<(usize, usize)> = None;
+        for (begin, end) in pages {
+            match current.as_mut() {
+                Some(range) if begin <= range.1 => range.1 = range.1.max(end),
+                _ => {
+                    if let Some(range) = current.replace((begin, end)) {
+                        populate(range);
+                    }
+                }
+            }
+        }
+
+        if let Some(range) = current {
+            populate(range);
+        }
+
+        self.release_many(&mut objects);
+    }
+}
+
+impl ClassInfo {
+    /// The `cache` calls into this slow path when its thread-local
+    /// storage is being deinitialised.
+    #[requires(dst.iter().all(|x| x.is_none()),
+               "Destination slots must be empty on entry.")]
+    #[ensures(dst.iter().take(ret).all(|x| x.is_some()),
+              "Populated slots form a prefix of `dst`.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_allocation_map::can_be_allocated(self.id, x.get()).is_ok()),
+              "Successful allocations are fresh, or match the class and avoid double-allocation.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_type_map::is_class(self.id, x).is_ok()),
+              "Successful allocations come from an address of the correct class.")]
+    #[ensures(dst.iter().flatten().all(|x| press::check_allocation(self.id, x.get().as_ptr() as usize).is_ok()),
+              "Sucessful allocations must have the allocation metadata set correctly.")]
+    #[inline(never)]
+    pub(crate) fn allocate_many_slow(&self, dst: &mut [Option<LinearRef>]) -> usize {
+        for (i, slot) in dst.iter_mut().enumerate() {
+            match self.allocate_slow() {
+                Some(allocated) => *slot = Some(allocated),
+                None => return i,
+            }
+        }
+
+        dst.len()
+    }
+
+    /// The `cache` calls into this slow path when its thread-local
+    /// storage is being deinitialised.
+    #[requires(blocks.iter().flatten().all(|x| debug_allocation_map::has_been_released(self.id, x.get()).is_ok()),
+               "Slow-released blocks went through `Class::release_many`.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_type_map::is_class(self.id, x).is_ok()),
+               "Released blocks come from an address of the correct class.")]
+    #[requires(blocks.iter().flatten().all(|x| press::check_allocation(self.id, x.get().as_ptr() as usize).is_ok()),
+               "Deallocated block must have the allocation metadata set correctly.")]
+    #[ensures(blocks.iter().all(|x| x.is_none()),
+              "All the blocks have been released.")]
+    #[inline(never)]
+    pub(crate) fn release_many_slow(&self, blocks: &mut [Option<LinearRef>]) {
+        for block in blocks.iter_mut().filter_map(Option::take) {
+            self.release_slow(block);
+        }
+    }
+}
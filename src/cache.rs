@@ -1,5 +1,10 @@
 //! Slitter stashes allocations for each size class in a thread-local
 //! cache.
+//!
+//! Threads may flush their cache on demand, and the scavenger (see
+//! `scavenger.rs`) releases the slow path's spare magazines and
+//! inboxes for idle threads.  Only the owner thread ever touches the
+//! fast path's magazines.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -12,7 +17,11 @@ use contracts::*;
 use disabled_contracts::*;
 
 use std::cell::RefCell;
-use std::num::NonZeroU32;
+use std::sync::atomic::AtomicBool;
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::Ordering;
+use std::sync::Arc;
+use std::sync::Mutex;
 
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
@@ -28,15 +37,34 @@ use crate::debug_type_map;
 use crate::class::ClassInfo;
 use crate::linear_ref::LinearRef;
 use crate::magazine::LocalMagazineCache;
+use crate::magazine::MagazinePacer;
 use crate::magazine::PopMagazine;
 use crate::magazine::PushMagazine;
 use crate::press;
+use crate::scavenger;
 use crate::Class;
 
-/// Start with a fast path array of this many `Magazines`
-/// structs, including one for the dummy 0 class.
-#[cfg(not(feature = "c_fast_path"))]
-const INITIAL_CACHE_SIZE: usize = 4;
+/// Each page of a thread's cache holds the `Magazines` for this many
+/// consecutive class ids.  Must match `SLITTER__CACHE_PAGE_CLASSES`.
+#[cfg(not(feature = "test_only_small_constants"))]
+const CACHE_PAGE_CLASSES: usize = 16;
+#[cfg(feature = "test_only_small_constants")]
+const CACHE_PAGE_CLASSES: usize = 4;
+
+/// The fast path only indexes the first `CACHE_NUM_PAGES` pages.
+/// Must match `SLITTER__CACHE_NUM_PAGES`.
+#[cfg(all(
+    feature = "thread_local_fast_path",
+    not(feature = "test_only_small_constants")
+))]
+const CACHE_NUM_PAGES: usize = 64;
+#[cfg(all(
+    feature = "thread_local_fast_path",
+    feature = "test_only_small_constants"
+))]
+const CACHE_NUM_PAGES: usize = 256;
+
+type CachePage = [Magazines; CACHE_PAGE_CLASSES];
 
 #[derive(Default)]
 #[repr(C)]
@@ -45,12 +73,107 @@ struct Magazines {
     alloc: PopMagazine,
     /// The cache releases into this magazine.
     release: PushMagazine,
+    /// Number of allocations and releases on the fast path that we
+    /// have yet to fold into the class's `ClassCounters`.
+    allocated: u64,
+    released: u64,
+}
+
+impl Magazines {
+    /// Folds the per-thread counters into `info`'s totals.
+    #[inline]
+    fn fold_counters(&mut self, info: &ClassInfo) {
+        info.counters.fold(self.allocated, self.released);
+        self.allocated = 0;
+        self.released = 0;
+    }
 }
 
 struct Info {
     /// The class info for the corresponding class id.
     info: Option<&'static ClassInfo>,
+}
+
+/// The state only the slow path uses for each class.  The scavenger
+/// may steal it from idle threads, so it lives behind a lock.
+struct SlowPathState {
     cache: LocalMagazineCache,
+    /// Tracks how often this thread hits the class's slow path.
+    pacer: MagazinePacer,
+}
+
+/// Magazines own their storage, so they may move between threads.
+unsafe impl Send for SlowPathState {}
+
+impl SlowPathState {
+    fn new() -> Self {
+        Self {
+            cache: LocalMagazineCache::Nothing,
+            pacer: Default::default(),
+        }
+    }
+
+    /// Returns the spare magazine and inbox, if any, to `info`.
+    fn release(&mut self, info: &ClassInfo) {
+        use LocalMagazineCache::*;
+
+        match std::mem::replace(&mut self.cache, Nothing) {
+            Nothing => (),
+            Empty(mag) => info.release_magazine(mag, None),
+            Full(mag) => info.release_magazine(mag, None),
+        }
+
+        self.pacer.inbox.release();
+    }
+}
+
+/// The part of a thread's `Cache` that the scavenger may access.
+pub(crate) struct SharedCache {
+    /// Incremented (only) by the owner thread whenever it enters the
+    /// slow path.
+    epoch: AtomicU64,
+    /// The value of `epoch` at the scavenger's previous scan.
+    scanned_epoch: AtomicU64,
+    /// Set when the scavenger released the slow path state for
+    /// `scanned_epoch`.  Only the scavenger uses this flag.
+    scavenged: AtomicBool,
+    /// This vector is parallel to `Cache::per_class_info`.
+    slow: Mutex<Vec<SlowPathState>>,
+}
+
+impl SharedCache {
+    /// Releases the slow path state (spare magazines and inboxes)
+    /// for every class in `infos`, which must start with class id 1,
+    /// if the owner thread did not enter the slow path since the
+    /// previous call.  The fast path's magazines stay with the owner.
+    ///
+    /// Returns whether the cache was scavenged.
+    pub(crate) fn scavenge_if_idle(&self, infos: &[&'static ClassInfo]) -> bool {
+        let epoch = self.epoch.load(Ordering::Relaxed);
+
+        if self.scanned_epoch.swap(epoch, Ordering::Relaxed) != epoch {
+            self.scavenged.store(false, Ordering::Relaxed);
+            return false;
+        }
+
+        // Don't scavenge the same idle thread over and over again.
+        if self.scavenged.load(Ordering::Relaxed) {
+            return false;
+        }
+
+        // If the owner holds the lock, it's not idle.
+        let mut slow = match self.slow.try_lock() {
+            Ok(slow) => slow,
+            Err(_) => return false,
+        };
+
+        for (state, info) in slow.iter_mut().skip(1).zip(infos) {
+            state.release(info);
+        }
+
+        self.scavenged.store(true, Ordering::Relaxed);
+        true
+    }
 }
 
 /// For each allocation class, we cache up to one magazine's worth of
@@ -64,38 +187,175 @@ struct Info {
 /// deallocation (e.g., more easily check for double free or take
 /// advantage of pre-zeroed out allocations).
 ///
-/// The cache consists of parallel vectors that are directly indexed
+/// The cache consists of parallel tables that are directly indexed
 /// with the class id; the first element at index 0 is thus never
-/// used, so we must increment SMALL_CACHE_SIZE by 1.
+/// used.
+///
+/// The magazines live in fixed-size pages, so growing the cache only
+/// allocates new pages and never moves magazines around.
 ///
 /// The source of truth on the number of allocation classes in the
-/// Cache is the `per_class_info` vector; `per_class` may have extra
-/// element but is never shorter than the `per_class_info`.
+/// Cache is the `per_class_info` vector; `pages` may have extra
+/// elements but its capacity is never less than `per_class_info.len()`.
 struct Cache {
-    /// This array of magazines may be longer than necessary:
-    /// zero-initialised magazines will correctly trigger a
-    /// slow path.
-    per_class: &'static mut [Magazines],
+    /// `pages[i]` holds the magazines for class ids in
+    /// `[i * CACHE_PAGE_CLASSES, (i + 1) * CACHE_PAGE_CLASSES)`.
+    /// Entries past `per_class_info` are zero-initialised magazines,
+    /// which correctly trigger a slow path.
+    pages: Vec<&'static mut CachePage>,
     /// This parallel vector holds a reference to ClassInfo; it is
     /// only `None` for the dummy entry we keep around for the invalid
     /// "0" class id.
     per_class_info: Vec<Info>,
-    /// If true, the `Cache` owns allocation backing the `per_class`
-    /// slice.  Otherwise, we should let it leak.
-    ///
-    /// Once true, this never becomes false.
-    per_class_is_owned: bool,
+    /// The epoch and slow path state, shared with the scavenger.
+    shared: Arc<SharedCache>,
+    /// If true, the `Cache` owns the allocation backing `pages[0]`.
+    /// Otherwise, it's the C side's thread-local page, and we
+    /// should let it leak.  We always own the other pages.
+    first_page_is_owned: bool,
 }
 
 extern "C" {
-    fn slitter__cache_register(region: *mut Magazines, count: usize);
+    fn slitter__cache_register(pages: *const *mut Magazines, num_pages: usize);
 }
 
-// TODO: keyed thread-local is slow.  We should `#![feature(thread_local)]`
-// and `#[thread_local] static mut CACHE: ...` in nightly builds.  We'll
-// still want a `thread_local!` to trigger cleanup...
+/// The same view of the current thread's `pages` that the C fast
+/// path keeps in `c/cache.c`.  `n == 0` until the thread's `Cache` is
+/// registered, and again once its destructor has run, so that callers
+/// always fall back to the slow path.
+#[cfg(feature = "thread_local_fast_path")]
+#[repr(C)]
+struct FastPathCache {
+    n: usize,
+    pages: [*mut Magazines; CACHE_NUM_PAGES],
+}
+
+/// Rust callers index this array directly.  `#[thread_local]` statics
+/// compile to plain `%fs`-relative accesses (initial-exec, or
+/// local-exec when the linker can relax them; build with `-Z
+/// tls-model=initial-exec` to force that in shared objects), without
+/// the lazy initialisation checks of `thread_local!`.
+#[cfg(feature = "thread_local_fast_path")]
+#[thread_local]
+static mut FAST_PATH_CACHE: FastPathCache = FastPathCache {
+    n: 0,
+    pages: [std::ptr::null_mut(); CACHE_NUM_PAGES],
+};
+
+// The keyed thread-local owns the `Cache`, and its destructor flushes
+// the thread's magazines back to their classes on thread exit.  With
+// `thread_local_fast_path`, Rust callers only reach it on slow paths.
 thread_local!(static CACHE: RefCell<Cache> = RefCell::new(Cache::new()));
 
+/// Publishes `pages` as the current thread's fast path table.
+fn register_fast_path(pages: &[&'static mut CachePage]) {
+    // A `&mut CachePage` is a pointer to the page's first element.
+    let ptrs = pages.as_ptr() as *const *mut Magazines;
+
+    unsafe {
+        slitter__cache_register(ptrs, pages.len());
+    }
+
+    #[cfg(feature = "thread_local_fast_path")]
+    unsafe {
+        let cache = &mut *std::ptr::addr_of_mut!(FAST_PATH_CACHE);
+        let num_pages = pages.len().min(CACHE_NUM_PAGES);
+
+        for i in 0..num_pages {
+            cache.pages[i] = *ptrs.add(i);
+        }
+
+        cache.n = num_pages * CACHE_PAGE_CLASSES;
+    }
+}
+
+/// Returns the magazines for class id `index` in `pages`.
+#[inline(always)]
+fn page_entry<'a>(pages: &'a mut [&'static mut CachePage], index: usize) -> &'a mut Magazines {
+    &mut pages[index / CACHE_PAGE_CLASSES][index % CACHE_PAGE_CLASSES]
+}
+
+/// Allocates a fresh page of default (empty) magazines.
+fn allocate_page() -> &'static mut CachePage {
+    Box::leak(Box::new(std::array::from_fn(|_| Default::default())))
+}
+
+/// Attempts to allocate from the current thread's cached magazine for
+/// `class`.  Returns `None` when we must enter the slow path.
+#[cfg(feature = "thread_local_fast_path")]
+#[inline(always)]
+fn allocate_fast(class: Class) -> Option<LinearRef> {
+    let index = class.id().get() as usize;
+
+    unsafe {
+        let cache = &*std::ptr::addr_of!(FAST_PATH_CACHE);
+        if index >= cache.n {
+            return None;
+        }
+
+        // `n` only covers populated directory entries.
+        let page = *cache.pages.get_unchecked(index / CACHE_PAGE_CLASSES);
+
+        // Only this thread accesses its `Magazines`, and nothing else
+        // on the stack holds a reference to them.
+        let mags = &mut *page.add(index % CACHE_PAGE_CLASSES);
+        let ret = mags.alloc.get()?;
+
+        mags.allocated += 1;
+        Some(ret)
+    }
+}
+
+/// Attempts to release `block` to the current thread's cached
+/// magazine for `class`.  Returns `block` back when we must enter the
+/// slow path.
+#[cfg(feature = "thread_local_fast_path")]
+#[inline(always)]
+fn release_fast(class: Class, block: LinearRef) -> Option<LinearRef> {
+    let index = class.id().get() as usize;
+
+    // Same check as `slitter_release`.
+    assert!(
+        press::check_allocation(class, block.get().as_ptr() as usize).is_ok(),
+        "deallocated address should match allocation class"
+    );
+
+    unsafe {
+        let cache = &*std::ptr::addr_of!(FAST_PATH_CACHE);
+        if index >= cache.n {
+            return Some(block);
+        }
+
+        // `n` only covers populated directory entries.
+        let page = *cache.pages.get_unchecked(index / CACHE_PAGE_CLASSES);
+
+        let mags = &mut *page.add(index % CACHE_PAGE_CLASSES);
+        let ret = mags.release.put(block);
+
+        if ret.is_none() {
+            mags.released += 1;
+        }
+
+        ret
+    }
+}
+
+/// Sizes the current thread's cache for all the classes registered
+/// so far, so that the thread's first allocations in each class don't
+/// have to grow the cache.
+pub fn prepare_thread_cache() {
+    let _ = CACHE.try_with(|cache| cache.borrow_mut().grow());
+}
+
+/// Returns all the magazines cached by the calling thread to their
+/// classes, so other threads may reuse the objects they hold.  The
+/// thread's cache refills as usual on its next allocation.
+///
+/// Long-lived threads may call this function before going idle.
+pub fn flush_thread_cache() {
+    let _ = CACHE.try_with(|cache| cache.borrow_mut().flush());
+}
+
 /// Attempts to return an allocation for an object of this `class`.
 #[ensures(ret.is_some() ->
           debug_allocation_map::can_be_allocated(class, ret.as_ref().unwrap().get()).is_ok(),
@@ -108,6 +368,11 @@ thread_local!(static CACHE: RefCell<Cache> = RefCell::new(Cache::new()));
           "Sucessful allocations must have the allocation metadata set correctly.")]
 #[inline(always)]
 pub fn allocate(class: Class) -> Option<LinearRef> {
+    #[cfg(feature = "thread_local_fast_path")]
+    if let Some(ret) = allocate_fast(class) {
+        return Some(ret);
+    }
+
     let result = if cfg!(feature = "c_fast_path") {
         extern "C" {
             fn slitter_allocate(class: Class) -> Option<LinearRef>;
@@ -152,6 +417,12 @@ pub extern "C" fn slitter__allocate_slow(class: Class) -> Option<LinearRef> {
           "Deallocated block must have the allocation metadata set correctly.")]
 #[inline(always)]
 pub fn release(class: Class, block: LinearRef) {
+    #[cfg(feature = "thread_local_fast_path")]
+    let block = match release_fast(class, block) {
+        Some(block) => block,
+        None => return,
+    };
+
     let mut cell = Some(block);
 
     let result = if cfg!(feature = "c_fast_path") {
@@ -193,90 +464,191 @@ pub extern "C" fn slitter__release_slow(class: Class, block: LinearRef) {
         })
 }
 
+/// Populates a prefix of `dst` with allocations for `class`, and
+/// returns the number of slots populated.  That number is only less
+/// than `dst.len()` on OOM.
+#[requires(dst.iter().all(|x| x.is_none()),
+           "Destination slots must be empty on entry.")]
+#[ensures(dst.iter().take(ret).all(|x| x.is_some()),
+          "Populated slots form a prefix of `dst`.")]
+#[ensures(dst.iter().flatten().all(|x| debug_allocation_map::can_be_allocated(class, x.get()).is_ok()),
+          "Successful allocations must be in the correct class and not double allocate")]
+#[ensures(dst.iter().flatten().all(|x| debug_type_map::is_class(class, x).is_ok()),
+          "Successful allocations must match the class of the address range.")]
+#[ensures(dst.iter().flatten().all(|x| press::check_allocation(class, x.get().as_ptr() as usize).is_ok()),
+          "Sucessful allocations must have the allocation metadata set correctly.")]
+#[inline(always)]
+pub fn allocate_many(class: Class, dst: &mut [Option<LinearRef>]) -> usize {
+    let result = if cfg!(feature = "c_fast_path") {
+        extern "C" {
+            fn slitter_allocate_many(class: Class, dst: *mut Option<LinearRef>, count: usize);
+        }
+
+        // The C fast path aborts instead of returning a short batch.
+        unsafe { slitter_allocate_many(class, dst.as_mut_ptr(), dst.len()) };
+        Ok(dst.len())
+    } else {
+        CACHE.try_with(|cache| cache.borrow_mut().allocate_many(class, dst))
+    };
+
+    result.unwrap_or_else(|_| class.info().allocate_many_slow(dst))
+}
+
+/// C-accessible slow path for batch allocations: populates all
+/// `count` slots in `dst`, or dies trying.
+///
+/// # Safety
+///
+/// This function assumes `dst` points to `count` writable pointers.
+#[no_mangle]
+pub unsafe extern "C" fn slitter__allocate_many_slow(
+    class: Class,
+    dst: *mut Option<LinearRef>,
+    count: usize,
+) {
+    if count == 0 {
+        return;
+    }
+
+    // The C caller may pass garbage; start from empty slots.
+    for i in 0..count {
+        dst.add(i).write(None);
+    }
+
+    let slots = std::slice::from_raw_parts_mut(dst, count);
+    let populated = CACHE
+        .try_with(|cache| cache.borrow_mut().allocate_many(class, slots))
+        .unwrap_or_else(|_| class.info().allocate_many_slow(slots));
+    assert!(populated == count, "Allocation failed");
+}
+
+/// Returns all the allocations in `blocks` back to this `class`, and
+/// resets `blocks` to `None`.
+#[requires(blocks.iter().flatten().all(|x| debug_allocation_map::has_been_released(class, x.get()).is_ok()),
+           "Blocks passed to `release` must have already been marked as released.")]
+#[requires(blocks.iter().flatten().all(|x| debug_type_map::is_class(class, x).is_ok()),
+           "Deallocated blocks must match the class of the address range.")]
+#[requires(blocks.iter().flatten().all(|x| press::check_allocation(class, x.get().as_ptr() as usize).is_ok()),
+           "Deallocated block must have the allocation metadata set correctly.")]
+#[ensures(blocks.iter().all(|x| x.is_none()),
+          "We take ownership of all the blocks.")]
+#[inline(always)]
+pub fn release_many(class: Class, blocks: &mut [Option<LinearRef>]) {
+    let result = if cfg!(feature = "c_fast_path") {
+        extern "C" {
+            fn slitter_release_many(class: Class, blocks: *mut Option<LinearRef>, count: usize);
+        }
+
+        // The C side may overwrite `blocks`, so it gets a mutable pointer.
+        unsafe { slitter_release_many(class, blocks.as_mut_ptr(), blocks.len()) };
+        // Ownership of every block has moved to the C side.
+        for slot in blocks.iter_mut() {
+            std::mem::forget(slot.take());
+        }
+
+        Ok(())
+    } else {
+        CACHE.try_with(|cache| cache.borrow_mut().release_many(class, blocks))
+    };
+
+    result.unwrap_or_else(|_| class.info().release_many_slow(blocks));
+}
+
+/// C-accessible slow path for batch deallocations.
+///
+/// # Safety
+///
+/// This function assumes `blocks` points to `count` pointers, each
+/// NULL or an allocation for `class`.
+#[no_mangle]
+pub unsafe extern "C" fn slitter__release_many_slow(
+    class: Class,
+    blocks: *mut Option<LinearRef>,
+    count: usize,
+) {
+    if count == 0 {
+        return;
+    }
+
+    let slots = std::slice::from_raw_parts_mut(blocks, count);
+    for block in slots.iter().flatten() {
+        press::check_allocation(class, block.get().as_ptr() as usize)
+            .expect("deallocated address should match allocation class");
+    }
+
+    CACHE
+        .try_with(|cache| cache.borrow_mut().release_many(class, slots))
+        .unwrap_or_else(|_| class.info().release_many_slow(slots))
+}
+
 impl Drop for Cache {
     #[requires(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
     fn drop(&mut self) {
-        unsafe {
-            slitter__cache_register(std::ptr::null_mut(), 0);
-        }
-
-        while let Some(slot) = self.per_class_info.pop() {
-            use LocalMagazineCache::*;
-
-            let index = self.per_class_info.len();
-            let mut mags = Default::default();
-
-            std::mem::swap(
-                &mut mags,
-                self.per_class
-                    .get_mut(index)
-                    .expect("per_class should be at least as long as per_class_info"),
-            );
-
-            if let Some(info) = slot.info {
-                info.release_magazine(mags.alloc, None);
-                info.release_magazine(mags.release, None);
-                match slot.cache {
-                    Nothing => (),
-                    Empty(mag) => info.release_magazine(mag, None),
-                    Full(mag) => info.release_magazine(mag, None),
-                }
-            } else {
-                // This must be the padding slot at index 0.
-                assert!(self.per_class_info.is_empty());
-
-                let default_rack = crate::rack::get_default_rack();
-                default_rack.release_empty_magazine(mags.alloc);
-                default_rack.release_empty_magazine(mags.release);
-
-                match slot.cache {
-                    Nothing => (),
-                    Empty(_) => panic!("Found used cache in dummy slot"),
-                    Full(_) => panic!("Found used cache in dummy slot"),
-                }
+        scavenger::unregister(&self.shared);
+        register_fast_path(&[]);
+        self.flush();
+
+        if !self.per_class_info.is_empty() {
+            // Only the padding slot at index 0 is left.
+            let mut mags: Magazines = Default::default();
+
+            std::mem::swap(&mut mags, page_entry(&mut self.pages, 0));
+
+            let default_rack = crate::rack::get_default_rack();
+            default_rack.release_empty_magazine(mags.alloc);
+            default_rack.release_empty_magazine(mags.release);
+
+            match self.shared.slow.lock().unwrap()[0].cache {
+                LocalMagazineCache::Nothing => (),
+                _ => panic!("Found used cache in dummy slot"),
             }
         }
 
-        if self.per_class_is_owned {
-            // Replace the magazine slice with a dummy, and drop it.
-            // An empty slice is correct: `per_class_info.len() == 0`.
-            let mut dummy: &mut [Magazines] = &mut [];
+        self.per_class_info.clear();
 
-            std::mem::swap(&mut dummy, &mut self.per_class);
-            unsafe { Box::from_raw(dummy) };
+        // An empty table is correct: `per_class_info.len() == 0`.
+        let pages = std::mem::take(&mut self.pages);
+        for (i, page) in pages.into_iter().enumerate() {
+            // If we don't own the first page, it's safe to leave it
+            // be: it has been fully reset to default `Magazines` that
+            // do not own anything.
+            if i > 0 || self.first_page_is_owned {
+                drop(unsafe { Box::from_raw(page as *mut CachePage) });
+            }
         }
-
-        // If we don't own the `per_class` slice, it's safe to leave
-        // it here: it has been fully reset to default `Magazines`
-        // that do not own anything.
     }
 }
 
 impl Cache {
     fn new() -> Cache {
         #[cfg(feature = "c_fast_path")]
-        let (mags, is_owned) = {
+        let (first_page, is_owned) = {
             extern "C" {
                 fn slitter__cache_borrow(OUT_n: &mut usize) -> *mut Magazines;
             }
 
-            let mut slice_size = 0usize;
-            let mags = unsafe { slitter__cache_borrow(&mut slice_size) };
-            let slice = unsafe { std::slice::from_raw_parts_mut(mags, slice_size) };
-            (slice, false)
+            let mut page_size = 0usize;
+            let mags = unsafe { slitter__cache_borrow(&mut page_size) };
+            assert_eq!(page_size, CACHE_PAGE_CLASSES);
+            (unsafe { &mut *(mags as *mut CachePage) }, false)
         };
 
         #[cfg(not(feature = "c_fast_path"))]
-        let (mags, is_owned) = {
-            let mags: [Magazines; INITIAL_CACHE_SIZE] = Default::default();
+        let (first_page, is_owned) = (allocate_page(), true);
 
-            (Box::leak(Box::new(mags)), true)
-        };
+        let shared = Arc::new(SharedCache {
+            epoch: AtomicU64::new(0),
+            scanned_epoch: AtomicU64::new(0),
+            scavenged: AtomicBool::new(false),
+            slow: Mutex::new(Vec::new()),
+        });
 
+        scavenger::register(shared.clone());
         Cache {
-            per_class: mags,
+            pages: vec![first_page],
             per_class_info: Vec::new(),
-            per_class_is_owned: is_owned,
+            shared,
+            first_page_is_owned: is_owned,
         }
     }
 
@@ -286,11 +658,13 @@ impl Cache {
         feature = "check_contracts"
     ))]
     fn check_rep_or_err(&self) -> Result<(), &'static str> {
-        if self.per_class.len() < self.per_class_info.len() {
-            return Err("Vector of magazines is shorter than vector of info.");
+        let entries = || self.pages.iter().flat_map(|page| page.iter());
+
+        if self.capacity() < self.per_class_info.len() {
+            return Err("Table of magazines is shorter than vector of info.");
         }
 
-        for mags in self.per_class.iter().skip(self.per_class_info.len()) {
+        for mags in entries().skip(self.per_class_info.len()) {
             if !mags.alloc.is_empty() {
                 return Err("Padding cache entry has a non-empty allocation magazine.");
             }
@@ -310,18 +684,20 @@ impl Cache {
         }
 
         if let Some(_) = self.per_class_info.get(0) {
-            if !self.per_class[0].alloc.is_empty() {
+            let dummy = entries().next().ok_or("Missing dummy cache entry.")?;
+
+            if !dummy.alloc.is_empty() {
                 return Err("Dummy cache entry has a non-empty allocation magazine.");
             }
 
-            if !self.per_class[0].release.is_full() {
+            if !dummy.release.is_full() {
                 return Err("Dummy cache entry has a non-full release magazine.");
             }
         }
 
         // All magazines must be in a good state, and only contain
         // *available* allocations for the correct class.
-        for (mags, info) in self.per_class.iter().zip(&self.per_class_info) {
+        for (mags, info) in entries().zip(&self.per_class_info) {
             mags.alloc.check_rep(info.info.map(|info| info.id))?;
             mags.release.check_rep(info.info.map(|info| info.id))?;
         }
@@ -329,42 +705,54 @@ impl Cache {
         Ok(())
     }
 
-    /// Ensure the cache's `per_class` array has at least `min_length`
-    /// elements.
+    /// Returns the number of class ids in the cache's `pages`.
+    fn capacity(&self) -> usize {
+        self.pages.len() * CACHE_PAGE_CLASSES
+    }
+
+    /// Ensure the cache's `pages` have room for at least `min_length`
+    /// class ids.  That only allocates new pages, without copying.
     #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
-    #[requires(min_length < usize::MAX / 2)]
-    #[ensures(self.per_class.len() >= min_length)]
-    #[ensures(self.per_class.len() >= old(self.per_class.len()))]
-    #[ensures(old(self.per_class_is_owned) -> self.per_class_is_owned,
-              "per_class_is_owned flag is monotonic (false -> true)")]
-    fn ensure_per_class_length(&mut self, min_length: usize) {
-        if self.per_class.len() >= min_length {
-            return;
+    #[ensures(self.capacity() >= min_length)]
+    #[ensures(self.pages.len() >= old(self.pages.len()))]
+    fn ensure_capacity(&mut self, min_length: usize) {
+        while self.capacity() < min_length {
+            self.pages.push(allocate_page());
         }
+    }
 
-        let new_length = min_length
-            .checked_next_power_of_two()
-            .expect("&CacheInfo are too big for len > usize::MAX / 2");
-        let mut vec = Vec::with_capacity(new_length);
-        vec.resize_with(new_length, Default::default);
-
-        let mut new_slice = Box::leak(vec.into_boxed_slice());
-        self.per_class
-            .swap_with_slice(&mut new_slice[0..self.per_class.len()]);
-
-        let mut is_owned = true;
-        std::mem::swap(&mut new_slice, &mut self.per_class);
-        // Swap the `is_owned` flag after the slice: the flag only
-        // goes from false to true, never the other way, and it's
-        // safer to leak on unwind/panic than to free something
-        // we don't own.
-        std::mem::swap(&mut is_owned, &mut self.per_class_is_owned);
-
-        if is_owned {
-            unsafe { Box::from_raw(new_slice) };
+    /// Returns all the magazines in this cache to their classes, and
+    /// gives up our inboxes.  Each entry is left in the same state as
+    /// a new entry, which always triggers the slow path.
+    #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
+    fn flush(&mut self) {
+        let mut slow = self.shared.slow.lock().unwrap();
+        for (index, slot) in self.per_class_info.iter().enumerate().skip(1) {
+            let info = slot.info.expect("must have class info");
+            let mut mags: Magazines = Default::default();
+
+            std::mem::swap(&mut mags, page_entry(&mut self.pages, index));
+
+            mags.fold_counters(info);
+            info.release_magazine(mags.alloc, None);
+            info.release_magazine(mags.release, None);
+            slow[index].release(info);
         }
     }
 
+    /// Marks this thread as active for the scavenger, before we
+    /// enter a class's slow path.
+    #[inline(always)]
+    fn enter_slow_path(&mut self) {
+        let shared = &self.shared;
+
+        // We're the only writer, so we don't need an atomic increment.
+        shared.epoch.store(
+            shared.epoch.load(Ordering::Relaxed).wrapping_add(1),
+            Ordering::Relaxed,
+        );
+    }
+
     /// Ensures the cache's `per_class_info` array has one entry for every
     /// allocation class currently defined.
     #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
@@ -372,34 +760,37 @@ impl Cache {
               "There exists an entry for the max class id when the function was called.")]
     #[cold]
     fn grow(&mut self) {
-        let max_id = crate::class::max_id();
-        if self.per_class_info.len() > max_id {
+        if self.per_class_info.len() > crate::class::max_id() {
             return;
         }
 
-        assert!(max_id <= u32::MAX as usize);
-        self.ensure_per_class_length(max_id + 1);
+        // Grab the info for all the new classes at once.
+        let first_id = self.per_class_info.len().max(1);
+        let infos = crate::class::class_infos_from(first_id);
+        let length = first_id + infos.len();
 
-        while self.per_class_info.len() <= max_id {
-            let id = NonZeroU32::new(self.per_class_info.len() as u32);
-            let info = id.and_then(|id| Class::from_id(id).map(|class| class.info()));
+        assert!(length - 1 <= u32::MAX as usize);
+        self.ensure_capacity(length);
 
-            self.per_class_info.push(Info {
-                info,
-                cache: LocalMagazineCache::Nothing,
-            });
+        let mut slow = self.shared.slow.lock().unwrap();
+        if self.per_class_info.is_empty() {
+            self.per_class_info.push(Info { info: None });
+            slow.push(SlowPathState::new());
         }
 
-        unsafe {
-            // We want to pass `per_class.len()`, despite it being
-            // longer than `per_class_info`: the extra elements will
-            // correctly trigger a slow path, so this is safe, and we
-            // want to concentrate all slow path conditionals to the
-            // same branch, for predictability.  We can't get rid of
-            // the "magazine is exhausted" condition, so let's make
-            // the "array is too short" branch as unlikely as possible.
-            slitter__cache_register(self.per_class.as_mut_ptr(), self.per_class.len());
+        for info in infos {
+            self.per_class_info.push(Info { info: Some(info) });
+            slow.push(SlowPathState::new());
         }
+
+        // We want to register all our pages, despite them being
+        // longer than `per_class_info`: the extra elements will
+        // correctly trigger a slow path, so this is safe, and we
+        // want to concentrate all slow path conditionals to the
+        // same branch, for predictability.  We can't get rid of
+        // the "magazine is exhausted" condition, so let's make
+        // the "array is too short" branch as unlikely as possible.
+        register_fast_path(&self.pages);
     }
 
     #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
@@ -419,16 +810,29 @@ impl Cache {
             self.grow();
         }
 
-        // per_class.len() >= per_class_info.len()
-        let mag = &mut self.per_class[index].alloc;
-        if let Some(alloc) = mag.get() {
+        // capacity() >= per_class_info.len()
+        let mags = page_entry(&mut self.pages, index);
+        if let Some(alloc) = mags.alloc.get() {
+            mags.allocated += 1;
             return Some(alloc);
         }
 
-        let info = &mut self.per_class_info[index];
-        info.info
-            .expect("must have class info")
-            .refill_magazine(mag, &mut info.cache)
+        self.enter_slow_path();
+
+        let mags = page_entry(&mut self.pages, index);
+        let class_info = self.per_class_info[index]
+            .info
+            .expect("must have class info");
+        let mut slow = self.shared.slow.lock().unwrap();
+        let state = &mut slow[index];
+        let ret = class_info.refill_magazine(&mut mags.alloc, &mut state.cache, &mut state.pacer);
+
+        if ret.is_some() {
+            mags.allocated += 1;
+        }
+
+        mags.fold_counters(class_info);
+        ret
     }
 
     /// Attempts to return an allocation for `class`.  Consumes from
@@ -456,6 +860,75 @@ impl Cache {
         }
     }
 
+    /// Populates a prefix of `dst` with allocations for `class`,
+    /// from the cache if possible, and returns the number of slots
+    /// populated.
+    #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
+    #[requires(dst.iter().all(|x| x.is_none()),
+               "Destination slots must be empty on entry.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_allocation_map::can_be_allocated(class, x.get()).is_ok()),
+              "Successful allocations must be from the correct class, and not double allocate.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_type_map::is_class(class, x).is_ok()),
+              "Successful allocations must match the class of the address range.")]
+    #[ensures(dst.iter().flatten().all(|x| press::check_allocation(class, x.get().as_ptr() as usize).is_ok()),
+              "Sucessful allocations must have the allocation metadata set correctly.")]
+    fn allocate_many(&mut self, class: Class, dst: &mut [Option<LinearRef>]) -> usize {
+        let index = class.id().get() as usize;
+
+        if self.per_class_info.len() <= index {
+            self.grow();
+        }
+
+        self.enter_slow_path();
+
+        // capacity() >= per_class_info.len()
+        let mags = page_entry(&mut self.pages, index);
+        let class_info = self.per_class_info[index]
+            .info
+            .expect("must have class info");
+        let mut slow = self.shared.slow.lock().unwrap();
+        let state = &mut slow[index];
+        let ret =
+            class_info.allocate_many(&mut mags.alloc, &mut state.cache, &mut state.pacer, dst);
+
+        mags.allocated += ret as u64;
+        mags.fold_counters(class_info);
+        ret
+    }
+
+    /// Marks all the allocations in `blocks` ready for reuse.
+    #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_allocation_map::has_been_released(class, x.get()).is_ok()),
+               "A released block for `class` must have been marked as such.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_type_map::is_class(class, x).is_ok()),
+               "Deallocated blocks must match the class of the address range.")]
+    #[requires(blocks.iter().flatten().all(|x| press::check_allocation(class, x.get().as_ptr() as usize).is_ok()),
+               "Deallocated block must have the allocation metadata set correctly.")]
+    #[ensures(blocks.iter().all(|x| x.is_none()),
+              "We take ownership of all the blocks.")]
+    fn release_many(&mut self, class: Class, blocks: &mut [Option<LinearRef>]) {
+        let index = class.id().get() as usize;
+
+        if self.per_class_info.len() <= index {
+            assert!(index < u32::MAX as usize);
+            self.grow();
+        }
+
+        self.enter_slow_path();
+
+        // capacity() >= per_class_info.len()
+        let mags = page_entry(&mut self.pages, index);
+        let class_info = self.per_class_info[index]
+            .info
+            .expect("must have class info");
+        let mut slow = self.shared.slow.lock().unwrap();
+        let state = &mut slow[index];
+
+        mags.released += blocks.iter().flatten().count() as u64;
+        class_info.release_many(&mut mags.release, &mut state.cache, blocks);
+        mags.fold_counters(class_info);
+    }
+
     #[invariant(self.check_rep_or_err().is_ok(), "Internal invariants hold.")]
     #[requires(debug_allocation_map::has_been_released(class, block.get()).is_ok(),
                "A released block for `class` must have been marked as such.")]
@@ -475,15 +948,23 @@ impl Cache {
             self.grow();
         }
 
-        // per_class.len() >= per_class_info.len()
-        let mag = &mut self.per_class[index].release;
+        // capacity() >= per_class_info.len()
+        let mags = page_entry(&mut self.pages, index);
+        mags.released += 1;
         // We prefer to cache freshly deallocated objects, for
         // temporal locality.
-        if let Some(spill) = mag.put(block) {
-            let info = &mut self.per_class_info[index];
-            info.info
-                .expect("must have class info")
-                .clear_magazine(mag, &mut info.cache, spill);
+        if let Some(spill) = mags.release.put(block) {
+            self.enter_slow_path();
+
+            let mags = page_entry(&mut self.pages, index);
+            let class_info = self.per_class_info[index]
+                .info
+                .expect("must have class info");
+            let mut slow = self.shared.slow.lock().unwrap();
+            let state = &mut slow[index];
+
+            class_info.clear_magazine(&mut mags.release, &mut state.cache, &mut state.pacer, spill);
+            mags.fold_counters(class_info);
         }
     }
 
@@ -510,3 +991,101 @@ impl Cache {
         }
     }
 }
+
+#[test]
+fn prepare_thread_cache_smoke_test() {
+    use crate::ClassConfig;
+
+    // Enough classes to span multiple pages.  Classes are immortal,
+    // and make every other test's cache larger, so don't go overboard.
+    let classes: Vec<Class> = (0..2 * CACHE_PAGE_CLASSES + 1)
+        .map(|i| {
+            Class::new(ClassConfig::for_test(
+                format!("prepare_thread_cache_{}", i),
+                16,
+            ))
+            .expect("Should build")
+        })
+        .collect();
+
+    std::thread::spawn(move || {
+        prepare_thread_cache();
+        CACHE.with(|cache| {
+            let cache = cache.borrow();
+
+            assert!(cache.per_class_info.len() > crate::class::max_id());
+            assert!(cache.capacity() >= cache.per_class_info.len());
+        });
+
+        for class in classes {
+            let alloc = class.allocate().expect("Should allocate");
+            class.release(alloc);
+        }
+    })
+    .join()
+    .expect("Thread should succeed");
+}
+
+// Per-CPU caches bypass the thread cache.
+#[cfg(not(feature = "per_cpu_cache"))]
+#[test]
+fn flush_and_scavenge_smoke_test() {
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig::for_test("flush_and_scavenge", 16)).expect("Should build");
+    let index = class.id().get() as usize;
+    let is_flushed = move || {
+        CACHE.with(|cache| {
+            let mut cache = cache.borrow_mut();
+            let mags = page_entry(&mut cache.pages, index);
+
+            mags.alloc.is_empty() && mags.release.is_full()
+        })
+    };
+
+    // Fill the thread's magazines, then flush them.
+    let allocs: Vec<_> = (0..100)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    assert!(!is_flushed());
+    flush_thread_cache();
+    assert!(is_flushed());
+
+    let (sender, receiver) = std::sync::mpsc::channel();
+    let (resume, wait) = std::sync::mpsc::channel::<()>();
+    let worker = std::thread::spawn(move || {
+        let alloc = class.allocate().expect("Should allocate");
+        class.release(alloc);
+
+        sender
+            .send(CACHE.with(|cache| cache.borrow().shared.clone()))
+            .expect("Should send");
+        wait.recv().expect("Should resume");
+
+        // The scavenger never touches the fast path's magazines.
+        assert!(!is_flushed());
+        CACHE.with(|cache| cache.borrow_mut().enter_slow_path());
+        assert!(!is_flushed());
+    });
+
+    let shared = receiver.recv().expect("Should receive");
+    let infos = crate::class::class_infos_from(1);
+
+    // The first scan only observes the thread's epoch.
+    assert!(!shared.scavenge_if_idle(&infos));
+    assert!(shared.scavenge_if_idle(&infos));
+    assert!(!shared.scavenge_if_idle(&infos));
+    assert!(shared
+        .slow
+        .lock()
+        .unwrap()
+        .iter()
+        .all(|state| matches!(state.cache, LocalMagazineCache::Nothing)));
+
+    resume.send(()).expect("Should send");
+    worker.join().expect("Thread should succeed");
+}
@@ -17,12 +17,20 @@ use contracts::*;
 use disabled_contracts::*;
 
 use std::alloc::Layout;
+use std::ffi::c_void;
 use std::ffi::CStr;
 use std::num::NonZeroU32;
 use std::os::raw::c_char;
-
-use crate::magazine_stack::MagazineStack;
+use std::sync::atomic::AtomicPtr;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+
+use crate::heap_profile::HeapProfile;
+use crate::inbox::Inboxes;
+use crate::magazine_depot::DepotStats;
+use crate::magazine_depot::MagazineDepot;
 use crate::press::Press;
+use crate::stats::ClassCounters;
 
 /// External callers interact with slitter allocation classes via this
 /// opaque Class struct.
@@ -33,12 +41,36 @@ pub struct Class {
 }
 
 /// When created, a class is configured with an object size, and an
-/// optional name.
+/// optional name.  Object layouts are rounded up to 8 bytes, in size
+/// and alignment.
 pub struct ClassConfig {
     pub name: Option<String>,
     pub layout: Layout,
     pub zero_init: bool,
     pub mapper_name: Option<String>,
+    /// The initial number of allocations in each magazine, or `None`
+    /// for the default.  The effective size adapts to the load, up to
+    /// twice the initial size.
+    pub magazine_size: Option<usize>,
+    /// Whether to populate the pages of each new span before
+    /// allocating from it.
+    pub prefault: Prefault,
+    /// Whether to keep objects that go to different magazines on
+    /// different cache lines, to avoid false sharing between threads.
+    pub isolate_cache_lines: bool,
+}
+
+/// How a class populates the pages of the spans it allocates from,
+/// to avoid page faults when first writing to fresh objects.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Prefault {
+    /// Let the kernel demand-fault pages in.
+    Never,
+    /// Populate each span before allocating from it.
+    Inline,
+    /// Populate each span in a background thread, while allocations
+    /// proceed.
+    Background,
 }
 
 /// The extern "C" interface uses this version of `ClassConfig`.
@@ -48,6 +80,10 @@ pub struct ForeignClassConfig {
     size: usize,
     zero_init: bool,
     mapper_name: *const c_char,
+    magazine_size: usize,
+    prefault: u32,
+    alignment: usize,
+    isolate_cache_lines: bool,
 }
 
 /// Slitter stores internal information about configured classes with
@@ -60,12 +96,16 @@ pub(crate) struct ClassInfo {
     // The Class will allocate and release magazines via this Rack.
     pub rack: &'static crate::rack::Rack,
 
-    // Fully populated magazines go in in `full_mags`.
-    pub full_mags: MagazineStack,
+    // Magazines for this class are full when they hold this many
+    // allocations.  The limit adapts to the rate at which threads hit
+    // the slow path, between `min_magazine_limit` and the rack's
+    // magazine capacity.
+    pub magazine_limit: AtomicUsize,
+    pub min_magazine_limit: usize,
 
-    // Partially populated, but non-empty, magazines go in `partial_mags`.
-    // Empty magazines go back to the `Rack`.
-    pub partial_mags: MagazineStack,
+    // Fully and partially populated, but non-empty, magazines go in
+    // the `depot`.  Empty magazines go back to the `Rack`.
+    pub depot: MagazineDepot,
 
     // Use this `Press` to allocate new objects.
     pub press: Press,
@@ -75,6 +115,15 @@ pub(crate) struct ClassInfo {
 
     // Whether allocations should be zero-filled.
     pub zero_init: bool,
+
+    // Allocation statistics, updated on slow paths.
+    pub counters: ClassCounters,
+
+    // Sampled allocations for this class.
+    pub heap_profile: HeapProfile,
+
+    // Full magazines on their way to threads that mostly allocate.
+    pub inboxes: Inboxes,
 }
 
 impl ClassConfig {
@@ -99,45 +148,160 @@ impl ClassConfig {
         }
 
         let config: &ForeignClassConfig = &*config_ptr;
-        let layout = Layout::from_size_align(config.size.max(1), /*align=*/ 8).ok()?;
+        // We always guarantee at least 8-byte alignment.
+        let align = config.alignment.max(8);
+        if align > crate::press::MAX_OBJECT_ALIGNMENT {
+            return None;
+        }
+
+        let layout = Layout::from_size_align(config.size.max(1), align).ok()?;
+        let prefault = match config.prefault {
+            0 => Prefault::Never,
+            1 => Prefault::Inline,
+            2 => Prefault::Background,
+            _ => return None,
+        };
         Some(ClassConfig {
             name: to_nullable_str(config.name).ok()?,
             layout,
             zero_init: config.zero_init,
             mapper_name: to_nullable_str(config.mapper_name).ok()?,
+            magazine_size: Some(config.magazine_size).filter(|size| *size > 0),
+            prefault,
+            isolate_cache_lines: config.isolate_cache_lines,
         })
     }
 }
 
+#[cfg(test)]
+impl ClassConfig {
+    /// Returns the config for a test class called `name`, with
+    /// zero-initialised `size`-byte objects aligned to 8 bytes, and
+    /// default settings for everything else.
+    pub(crate) fn for_test(name: impl Into<String>, size: usize) -> ClassConfig {
+        ClassConfig {
+            name: Some(name.into()),
+            layout: Layout::from_size_align(size, 8).expect("layout should build"),
+            zero_init: true,
+            mapper_name: None,
+            magazine_size: None,
+            prefault: Prefault::Never,
+            isolate_cache_lines: false,
+        }
+    }
+}
+
+/// The first segment of the class registry has this many entries,
+/// and each subsequent segment doubles in size.
+const FIRST_SEGMENT_SIZE: usize = 64;
+
+/// Enough segments for all `u32` class ids.
+const NUM_SEGMENTS: usize = 32;
+
+static_assertions::const_assert!(
+    FIRST_SEGMENT_SIZE * ((1 << NUM_SEGMENTS) - 1) >= u32::MAX as usize
+);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_SEGMENT: AtomicPtr<AtomicPtr<ClassInfo>> = AtomicPtr::new(std::ptr::null_mut());
+
+/// The class registry maps class id `i` to the `ClassInfo` at index
+/// `i - 1`.  It's an append-only array split in lazily allocated
+/// segments that never move, so readers never lock: they load the
+/// segment, then the entry.  Each entry is published before
+/// `NUM_CLASSES` covers it.
+static SEGMENTS: [AtomicPtr<AtomicPtr<ClassInfo>>; NUM_SEGMENTS] = [NO_SEGMENT; NUM_SEGMENTS];
+
 lazy_static::lazy_static! {
-    // TODO(lock): this lock is never taken on a fast path.
-    static ref CLASSES: std::sync::Mutex<Vec<&'static ClassInfo>> = Default::default();
+    // Serialises class registration; readers never take this lock.
+    static ref REGISTER_LOCK: std::sync::Mutex<()> = Default::default();
+}
+
+/// The number of entries in the class registry.  Only updated with
+/// `REGISTER_LOCK` held, after publishing the new entry.
+static NUM_CLASSES: AtomicUsize = AtomicUsize::new(0);
+
+/// Returns the registry segment, and the offset in that segment, for
+/// the entry at `index`.  Segment `k` has `FIRST_SEGMENT_SIZE << k`
+/// entries, and starts at index `FIRST_SEGMENT_SIZE * (2^k - 1)`.
+#[inline(always)]
+fn registry_position(index: usize) -> (usize, usize) {
+    let scaled = index / FIRST_SEGMENT_SIZE + 1;
+    let segment = (usize::BITS - 1 - scaled.leading_zeros()) as usize;
+
+    (segment, index - FIRST_SEGMENT_SIZE * ((1 << segment) - 1))
+}
+
+/// Returns the `ClassInfo` for class `id`, if it is registered.
+/// This function is wait-free.
+#[inline]
+fn registered_info(id: NonZeroU32) -> Option<&'static ClassInfo> {
+    let (segment, offset) = registry_position(id.get() as usize - 1);
+    let base = SEGMENTS.get(segment)?.load(Ordering::Acquire);
+
+    if base.is_null() {
+        return None;
+    }
+
+    let info = unsafe { &*base.add(offset) }.load(Ordering::Acquire);
+    unsafe { info.as_ref() }
+}
+
+/// Publishes `info` in the class registry, at the index for its id.
+/// The caller must hold `REGISTER_LOCK`.
+fn publish_info(info: &'static ClassInfo) {
+    let (segment, offset) = registry_position(info.id.id.get() as usize - 1);
+    let mut base = SEGMENTS[segment].load(Ordering::Relaxed);
+
+    if base.is_null() {
+        let entries: Box<[AtomicPtr<ClassInfo>]> = (0..FIRST_SEGMENT_SIZE << segment)
+            .map(|_| AtomicPtr::new(std::ptr::null_mut()))
+            .collect();
+
+        base = Box::leak(entries).as_mut_ptr();
+        SEGMENTS[segment].store(base, Ordering::Release);
+    }
+
+    unsafe { &*base.add(offset) }.store(info as *const _ as *mut _, Ordering::Release);
 }
 
 pub fn max_id() -> usize {
-    let guard = CLASSES.lock().unwrap();
-    guard.len()
+    NUM_CLASSES.load(Ordering::Acquire)
+}
+
+/// Returns the `ClassInfo` for all classes with id at least
+/// `first_id`, in order of id, without locking.
+#[requires(first_id > 0)]
+#[ensures(ret.iter().enumerate().all(|(i, info)| info.id.id().get() as usize == first_id + i))]
+pub(crate) fn class_infos_from(first_id: usize) -> Vec<&'static ClassInfo> {
+    (first_id..=max_id())
+        .map(|id| {
+            NonZeroU32::new(id as u32)
+                .and_then(registered_info)
+                .expect("ids up to max_id are registered")
+        })
+        .collect()
 }
 
 impl Class {
     /// Attempts to create a new allocation class for `config`.
     ///
-    /// On success, there is a corresponding `ClassInfo` struct at
-    /// `ret - 1` in the global `CLASSES` array.
+    /// On success, there is a corresponding `ClassInfo` struct for
+    /// `ret` in the global class registry.
     #[ensures(ret.is_ok() ->
-              CLASSES.lock().unwrap().get(ret.unwrap().id.get() as usize - 1).map(|info| info.id) == Some(ret.unwrap()),
-              "On success, the class is at id - 1 in the global array of ClassInfo")]
+              registered_info(ret.unwrap().id).map(|info| info.id) == Some(ret.unwrap()),
+              "On success, the class is in the global registry of ClassInfo")]
     #[ensures(ret.is_ok() ->
               Class::from_id(ret.unwrap().id) == Some(ret.unwrap()),
               "On success, we can instantiate `Class` from the NonZeroU32 id.")]
-    #[ensures(ret.is_ok() ->
-              std::ptr::eq(ret.unwrap().info(), CLASSES.lock().unwrap()[ret.unwrap().id.get() as usize - 1]),
-              "On success, the class's info matches the entry in the array.")]
+    #[ensures(ret.is_ok() -> max_id() >= ret.unwrap().id.get() as usize,
+              "On success, `max_id` covers the new class.")]
     pub fn new(config: ClassConfig) -> Result<Class, &'static str> {
-        let mut classes = CLASSES.lock().unwrap();
+        let _guard = REGISTER_LOCK.lock().unwrap();
 
-        let next_id = classes.len() + 1;
-        if next_id > u32::MAX as usize {
+        let next_id = max_id() + 1;
+        // The top ids tag spans that wait for their persistent class.
+        if next_id >= crate::persistent_mapper::FIRST_PENDING_ID as usize {
             return Err("too many slitter allocation classes");
         }
 
@@ -145,40 +309,94 @@ impl Class {
             id: NonZeroU32::new(next_id as u32).expect("next_id is positive"),
         };
 
-        let layout = config.layout.pad_to_align();
+        // The free bitmap needs each object to start on its own
+        // granule.
+        let layout = config
+            .layout
+            .align_to(crate::mill::FREE_BITMAP_GRANULE)
+            .map_err(|_| "invalid class layout")?
+            .pad_to_align();
+        let magazine_size = config
+            .magazine_size
+            .unwrap_or(crate::magazine_impl::MAGAZINE_SIZE as usize)
+            .clamp(1, crate::magazine_impl::MAX_MAGAZINE_SIZE as usize);
+
+        let press = Press::new(
+            id,
+            layout,
+            config.mapper_name.as_deref(),
+            config.prefault,
+            config.isolate_cache_lines,
+        )?;
+        // Classes in a persistent heap take over their spans from
+        // the previous process.
+        let recovered = crate::persistent_mapper::claim_spans(
+            config.mapper_name.as_deref(),
+            config.name.as_deref(),
+            layout,
+            config.isolate_cache_lines,
+            next_id as u32,
+        )?;
 
         let info = Box::leak(Box::new(ClassInfo {
             name: config.name,
             layout,
-            rack: crate::rack::get_default_rack(),
-            full_mags: MagazineStack::new(),
-            partial_mags: MagazineStack::new(),
-            press: Press::new(id, layout, config.mapper_name.as_deref())?,
+            // Leave room for the magazine limit to double.
+            rack: crate::rack::get_rack(2 * magazine_size),
+            magazine_limit: AtomicUsize::new(magazine_size),
+            min_magazine_limit: (magazine_size / 4).max(1),
+            depot: Default::default(),
+            press,
             id,
             zero_init: config.zero_init,
+            counters: Default::default(),
+            heap_profile: Default::default(),
+            inboxes: Default::default(),
         }));
-        classes.push(info);
+        publish_info(info);
+        NUM_CLASSES.store(next_id, Ordering::Release);
+        info.adopt_persistent_spans(recovered);
         Ok(id)
     }
 
     /// Returns a `Class` struct for `id` if such a class exists.
     ///
     /// On success, this operation can be inverted by calling `id()`.
-    #[ensures(ret.is_none() -> CLASSES.lock().unwrap().iter().all(|info| info.id.id != id),
+    #[ensures(ret.is_none() -> registered_info(id).is_none(),
               "`from_id` only fails if there is no registered `ClassInfo` with that id.")]
-    #[ensures(ret.is_some() -> CLASSES.lock().unwrap()[id.get() as usize - 1].id == ret.unwrap(),
-              "On success, the class's info is at id - 1 in the global array of info.")]
+    #[ensures(ret.is_some() -> registered_info(id).map(|info| info.id) == ret,
+              "On success, the class's info is in the global registry.")]
     #[ensures(ret.is_some() -> ret.unwrap().id == id,
               "On success, the return value's id matches the argument.")]
     pub(crate) fn from_id(id: NonZeroU32) -> Option<Class> {
-        let guard = CLASSES.lock().unwrap();
-        if id.get() as usize <= guard.len() {
+        if id.get() as usize <= max_id() {
             Some(Class { id })
         } else {
             None
         }
     }
 
+    /// Returns the class of the allocation at `ptr`, according to its
+    /// span metadata, or `None` if Slitter does not manage `ptr`, or
+    /// if `ptr` is in a persistent span that no class claimed yet.
+    /// Any address is safe, including NULL.
+    #[ensures(ret.is_some() -> Class::from_id(ret.unwrap().id) == ret,
+              "Span metadata only refers to registered classes.")]
+    #[inline]
+    pub fn of(ptr: *const c_void) -> Option<Class> {
+        extern "C" {
+            fn slitter__class_id_of_address(ptr: *const c_void) -> u32;
+        }
+
+        let id = NonZeroU32::new(unsafe { slitter__class_id_of_address(ptr) })?;
+        // Unclaimed persistent spans have a pending id.
+        if id.get() >= crate::persistent_mapper::FIRST_PENDING_ID {
+            return None;
+        }
+
+        Class::from_id(id)
+    }
+
     /// Returns the `Class`'s underlying `NonZeroU32` id.
     ///
     /// This operation is the inverse of `Class::from_id`.
@@ -189,14 +407,17 @@ impl Class {
         self.id
     }
 
+    /// Returns the number of magazines this class's threads found in
+    /// their local depot shard, and stole from remote shards.
+    pub fn depot_stats(self) -> DepotStats {
+        self.info().depot.stats()
+    }
+
     /// Returns the global `ClassInfo` for this `Class`.
     #[ensures(ret.id == self)]
+    #[inline]
     pub(crate) fn info(self) -> &'static ClassInfo {
-        let guard = CLASSES.lock().unwrap();
-
-        (*guard)
-            .get(self.id.get() as usize - 1)
-            .expect("Class structs are only build for valid ids")
+        registered_info(self.id).expect("Class structs are only build for valid ids")
     }
 }
 
@@ -213,6 +434,7 @@ mod test {
 
     use crate::Class;
     use crate::ClassConfig;
+    use crate::Prefault;
 
     #[test]
     fn smoke_test() {
@@ -221,6 +443,9 @@ mod test {
             layout: Layout::from_size_align(8, 8).expect("layout should build"),
             zero_init: true,
             mapper_name: None,
+            magazine_size: None,
+            prefault: Prefault::Never,
+            isolate_cache_lines: false,
         })
         .expect("Class should build");
 
@@ -235,6 +460,84 @@ mod test {
         class.release(p1);
     }
 
+    // Registry segments are contiguous, and double in size.
+    #[test]
+    fn registry_positions() {
+        use super::registry_position;
+        use super::FIRST_SEGMENT_SIZE;
+
+        assert_eq!(registry_position(0), (0, 0));
+        assert_eq!(
+            registry_position(FIRST_SEGMENT_SIZE - 1),
+            (0, FIRST_SEGMENT_SIZE - 1)
+        );
+        assert_eq!(registry_position(FIRST_SEGMENT_SIZE), (1, 0));
+        assert_eq!(
+            registry_position(3 * FIRST_SEGMENT_SIZE - 1),
+            (1, 2 * FIRST_SEGMENT_SIZE - 1)
+        );
+        assert_eq!(registry_position(3 * FIRST_SEGMENT_SIZE), (2, 0));
+        assert!(registry_position(u32::MAX as usize - 1).0 < super::NUM_SEGMENTS);
+    }
+
+    // Readers see every class registered by concurrent threads.
+    #[test]
+    fn concurrent_registration() {
+        let threads: Vec<_> = (0..4)
+            .map(|i| {
+                std::thread::spawn(move || {
+                    let class = Class::new(ClassConfig::for_test(format!("registration_{}", i), 8))
+                        .expect("Class should build");
+
+                    assert_eq!(Class::from_id(class.id()), Some(class));
+                    assert_eq!(class.info().id, class);
+                    class
+                })
+            })
+            .collect();
+
+        for thread in threads {
+            let class = thread.join().expect("thread should succeed");
+            let infos = super::class_infos_from(class.id().get() as usize);
+
+            assert_eq!(infos[0].id, class);
+        }
+    }
+
+    // C callers can ask for alignments past 8 bytes.
+    #[test]
+    fn foreign_alignment() {
+        use super::ForeignClassConfig;
+
+        let foreign = |size, alignment| ForeignClassConfig {
+            name: std::ptr::null(),
+            size,
+            zero_init: false,
+            mapper_name: std::ptr::null(),
+            magazine_size: 0,
+            prefault: 0,
+            alignment,
+            isolate_cache_lines: false,
+        };
+
+        let default = unsafe { ClassConfig::from_c(&foreign(12, 0)) }.expect("should convert");
+        assert_eq!(default.layout.align(), 8);
+        assert!(unsafe { ClassConfig::from_c(&foreign(12, 24)) }.is_none());
+        assert!(unsafe { ClassConfig::from_c(&foreign(12, 8192)) }.is_none());
+
+        let config = unsafe { ClassConfig::from_c(&foreign(48, 64)) }.expect("should convert");
+        let class = Class::new(config).expect("Class should build");
+        assert_eq!(class.info().layout.size(), 64);
+
+        let allocs: Vec<_> = (0..1000)
+            .map(|_| class.allocate().expect("Should allocate"))
+            .collect();
+        for alloc in allocs {
+            assert_eq!(alloc.as_ptr() as usize % 64, 0);
+            class.release(alloc);
+        }
+    }
+
     // Keep allocating / deallocating from the same class.  This
     // should help us trigger magazine refilling logic.
     #[test]
@@ -244,6 +547,9 @@ mod test {
             layout: Layout::from_size_align(8, 8).expect("layout should build"),
             zero_init: true,
             mapper_name: None,
+            magazine_size: None,
+            prefault: Prefault::Never,
+            isolate_cache_lines: false,
         })
         .expect("Class should build");
 
@@ -265,6 +571,30 @@ mod test {
         }
     }
 
+    // Recycled large objects are zero-filled with non-temporal
+    // stores, including their unaligned tail.
+    #[test]
+    fn large_back_to_back() {
+        let size = (16 << 10) + 8;
+        let class = Class::new(ClassConfig::for_test("large_back_to_back", size))
+            .expect("Class should build");
+
+        for _ in 0..3 {
+            let allocations: Vec<_> = (0..40)
+                .map(|_| class.allocate().expect("Should allocate"))
+                .collect();
+
+            for allocated in allocations {
+                let bytes =
+                    unsafe { std::slice::from_raw_parts_mut(allocated.as_ptr() as *mut u8, size) };
+
+                assert!(bytes.iter().all(|x| *x == 0));
+                bytes.fill(42);
+                class.release(allocated);
+            }
+        }
+    }
+
     // Allocate and deallocate from the same class, in batches.
     #[test]
     fn n_back_to_back() {
@@ -273,6 +603,9 @@ mod test {
             layout: Layout::from_size_align(8, 8).expect("layout should build"),
             zero_init: true,
             mapper_name: None,
+            magazine_size: None,
+            prefault: Prefault::Never,
+            isolate_cache_lines: false,
         })
         .expect("Class should build");
 
@@ -302,6 +635,103 @@ mod test {
         }
     }
 
+    // Allocate and deallocate with the batch API, with batches that
+    // span multiple magazines.
+    #[test]
+    fn batch_back_to_back() {
+        let class =
+            Class::new(ClassConfig::for_test("alloc_batch", 8)).expect("Class should build");
+
+        for count in [1usize, 5, 31, 100, 500].iter().copied() {
+            let mut allocations = vec![None; count];
+
+            assert_eq!(class.allocate_many(&mut allocations), count);
+
+            let mut seen = Vec::new();
+            for allocated in allocations.iter().map(|x| x.expect("populated")) {
+                let ptr = allocated.as_ptr() as *mut u8;
+                // Fresh allocations should always be zero-filled.
+                assert_eq!(unsafe { std::ptr::read(ptr) }, 0);
+                unsafe { std::ptr::write(ptr, 42u8) };
+
+                assert!(check_new_allocation(&seen, allocated));
+                seen.push(allocated);
+            }
+
+            // `None` entries must be skipped.
+            allocations.insert(count / 2, None);
+            class.release_many(&mut allocations);
+            assert!(allocations.iter().all(|x| x.is_none()));
+        }
+    }
+
+    // Prefaulting must not disturb allocations, even when it happens
+    // concurrently.
+    #[test]
+    fn prefault_and_warmup() {
+        for (name, prefault) in [
+            ("alloc_prefault_inline", Prefault::Inline),
+            ("alloc_prefault_background", Prefault::Background),
+        ]
+        .iter()
+        {
+            let class = Class::new(ClassConfig {
+                prefault: *prefault,
+                ..ClassConfig::for_test(*name, 1000)
+            })
+            .expect("Class should build");
+
+            class.warmup(2000);
+
+            let mut allocations = Vec::new();
+            for i in 0..5000u64 {
+                let allocation = class.allocate().expect("Should allocate");
+
+                unsafe { *(allocation.as_ptr() as *mut u64) = i };
+                allocations.push(allocation);
+            }
+
+            for (i, allocation) in allocations.into_iter().enumerate() {
+                assert_eq!(unsafe { *(allocation.as_ptr() as *mut u64) }, i as u64);
+                class.release(allocation);
+            }
+        }
+    }
+
+    // Classes with a custom magazine size get their own rack.
+    #[test]
+    fn custom_magazine_size() {
+        let class = Class::new(ClassConfig {
+            magazine_size: Some(100),
+            ..ClassConfig::for_test("alloc_big_mags", 8)
+        })
+        .expect("Class should build");
+
+        let info = class.info();
+        assert_eq!(info.rack.magazine_size(), 254);
+        assert_eq!(info.magazine_limit(), 100);
+
+        // The limit adapts within bounds.
+        for _ in 0..20 {
+            info.grow_magazine_limit();
+        }
+        assert_eq!(info.magazine_limit(), 254);
+
+        for _ in 0..50 {
+            info.shrink_magazine_limit();
+        }
+        assert_eq!(info.magazine_limit(), 25);
+
+        let mut allocations = Vec::new();
+        for _ in 0..300 {
+            allocations.push(class.allocate().expect("Should allocate"));
+        }
+
+        for allocation in allocations {
+            class.release(allocation);
+        }
+    }
+
     // Returns true iff that `new` isn't in `current`.
     fn check_new_allocation(current: &[NonNull<c_void>], new: NonNull<c_void>) -> bool {
         current.iter().all(|x| x.as_ptr() != new.as_ptr())
@@ -318,6 +748,9 @@ mod test {
                 layout: Layout::from_size_align(8, 8).expect("layout should build"),
                 zero_init: false,
                 mapper_name: None,
+                magazine_size: None,
+                prefault: Prefault::Never,
+                isolate_cache_lines: false,
             })
             .expect("Class should build");
 
@@ -377,12 +810,18 @@ mod test {
                     layout: Layout::from_size_align(8, 8).expect("layout should build"),
                     zero_init: true,
                     mapper_name: None,
+                    magazine_size: None,
+                    prefault: Prefault::Never,
+                    isolate_cache_lines: false,
                 }).expect("Class should build"),
                 Class::new(ClassConfig {
                     name: Some("random_class_2".into()),
                     layout: Layout::from_size_align(16, 8).expect("layout should build"),
                     zero_init: false,
                     mapper_name: None,
+                    magazine_size: None,
+                    prefault: Prefault::Never,
+                    isolate_cache_lines: false,
                 }).expect("Class should build"),
             ];
 
@@ -434,6 +873,9 @@ mod test {
                 layout: Layout::from_size_align(8, 8).expect("layout should build"),
                 zero_init: true,
                 mapper_name: None,
+                magazine_size: None,
+                prefault: Prefault::Never,
+                isolate_cache_lines: false,
             })
             .expect("Class should build");
 
@@ -471,6 +913,9 @@ mod test {
                 layout: Layout::from_size_align(8, 8).expect("layout should build"),
                 zero_init: false,
                 mapper_name: None,
+                magazine_size: None,
+                prefault: Prefault::Never,
+                isolate_cache_lines: false,
             })
             .expect("Class should build");
 
@@ -507,6 +952,9 @@ mod test {
                 layout: Layout::from_size_align(8, 8).expect("layout should build"),
                 zero_init: true,
                 mapper_name: None,
+                magazine_size: None,
+                prefault: Prefault::Never,
+                isolate_cache_lines: false,
             })
             .expect("Class should build");
 
@@ -76,6 +76,23 @@ pub fn mark_allocated(class: Class, alloc: &NonNull<c_void>) -> Result<(), &'sta
     Ok(())
 }
 
+/// Marks this allocation, which a previous process left live in a
+/// persistent heap, as owned by the mutator.  Unlike
+/// `mark_allocated`, the allocation may hold data.
+pub fn mark_recovered(class: Class, alloc: &NonNull<c_void>) -> Result<(), &'static str> {
+    let mut map = ALLOCATION_STATE_MAP.lock().unwrap();
+
+    if map.contains_key(&(alloc.as_ptr() as usize)) {
+        return Err("recovered a known allocation");
+    }
+
+    map.insert(
+        alloc.as_ptr() as usize,
+        AllocationInfo { class, live: true },
+    );
+    Ok(())
+}
+
 /// Marks this allocation as released by the mutator.
 pub fn mark_released(class: Class, alloc: &NonNull<c_void>) -> Result<(), &'static str> {
     let mut map = ALLOCATION_STATE_MAP.lock().unwrap();
@@ -0,0 +1,255 @@
+//! A `ClassFamily` is a geometric series of allocation classes that
+//! share a name prefix, mapper and zero-initialisation policy, for
+//! variable-size buffers (e.g., strings and vectors).
+//!
+//! Each power of two between the family's minimum and maximum size is
+//! split in `classes_per_doubling` classes, so internal fragmentation
+//! is at most `1 / classes_per_doubling`.  Families map sizes to
+//! classes with a flat table, with one entry per `FAMILY_GRANULE`
+//! bytes, so C callers can inline the lookup before entering the
+//! regular `slitter_allocate` fast path.
+//!
+//! Families are immortal, like their classes.  A family's classes
+//! are regular `Class`es: an object allocated from a family must be
+//! released to the class for its size.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::alloc::Layout;
+use std::ffi::CStr;
+use std::os::raw::c_char;
+
+use crate::class::Class;
+use crate::class::ClassConfig;
+use crate::class::Prefault;
+
+/// Families map sizes to classes in steps of this many bytes, and
+/// all the classes in a family have sizes that are multiples of
+/// `FAMILY_GRANULE`.
+///
+/// Must match the constant in `include/slitter.h`.
+pub const FAMILY_GRANULE: usize = 16;
+
+/// The largest object size a family may service.  That's 64 K
+/// entries, i.e., 256 KB, for the lookup table.
+pub const MAX_FAMILY_SIZE: usize = 1 << 20;
+
+/// By default, each power of two is split in this many classes.
+const DEFAULT_CLASSES_PER_DOUBLING: usize = 4;
+
+/// The configuration for a new family of classes.
+pub struct ClassFamilyConfig {
+    /// Each class is named `"{name_prefix}_{size}"`.  The classes are
+    /// anonymous if `None`.
+    pub name_prefix: Option<String>,
+    /// The size of the smallest class, rounded up to `FAMILY_GRANULE`.
+    pub min_size: usize,
+    /// The largest size the family services, at most `MAX_FAMILY_SIZE`.
+    pub max_size: usize,
+    /// The number of classes between consecutive powers of two.
+    pub classes_per_doubling: usize,
+    pub zero_init: bool,
+    pub mapper_name: Option<String>,
+}
+
+/// The extern "C" interface uses this version of `ClassFamilyConfig`.
+#[repr(C)]
+pub struct ForeignClassFamilyConfig {
+    name_prefix: *const c_char,
+    min_size: usize,
+    max_size: usize,
+    classes_per_doubling: u32,
+    zero_init: bool,
+    mapper_name: *const c_char,
+}
+
+/// A family of classes, laid out like `struct slitter_class_family`.
+#[repr(C)]
+#[derive(Debug)]
+pub struct ClassFamily {
+    /// The family services allocations of up to `max_size` bytes.
+    max_size: usize,
+    /// `classes[(size + FAMILY_GRANULE - 1) / FAMILY_GRANULE]` is the
+    /// smallest class in the family with objects of at least `size`
+    /// bytes, for `size <= max_size`.
+    classes: *const Class,
+}
+
+/// The `classes` table is immutable and immortal.
+unsafe impl Send for ClassFamily {}
+unsafe impl Sync for ClassFamily {}
+
+impl ClassFamilyConfig {
+    /// Attempts to convert a `ForeignClassFamilyConfig` pointer to a
+    /// native `ClassFamilyConfig`.
+    ///
+    /// # Safety
+    ///
+    /// This function assumes `config_ptr` is NULL or valid.
+    pub unsafe fn from_c(config_ptr: *const ForeignClassFamilyConfig) -> Option<ClassFamilyConfig> {
+        fn to_nullable_str(ptr: *const c_char) -> Result<Option<String>, std::str::Utf8Error> {
+            if ptr.is_null() {
+                Ok(None)
+            } else {
+                Ok(Some(unsafe { CStr::from_ptr(ptr) }.to_str()?.to_owned()))
+            }
+        }
+
+        if config_ptr.is_null() {
+            return None;
+        }
+
+        let config: &ForeignClassFamilyConfig = &*config_ptr;
+        Some(ClassFamilyConfig {
+            name_prefix: to_nullable_str(config.name_prefix).ok()?,
+            min_size: config.min_size,
+            max_size: config.max_size,
+            classes_per_doubling: match config.classes_per_doubling {
+                0 => DEFAULT_CLASSES_PER_DOUBLING,
+                n => n as usize,
+            },
+            zero_init: config.zero_init,
+            mapper_name: to_nullable_str(config.mapper_name).ok()?,
+        })
+    }
+}
+
+/// Returns the object sizes, in increasing order, for a family of
+/// classes from `min_size` to `max_size`.
+#[requires(classes_per_doubling > 0)]
+#[ensures(ret.iter().all(|size| size % FAMILY_GRANULE == 0))]
+#[ensures(ret.windows(2).all(|pair| pair[0] < pair[1]))]
+#[ensures(ret.last().copied().unwrap_or(0) >= max_size)]
+fn family_sizes(min_size: usize, max_size: usize, classes_per_doubling: usize) -> Vec<usize> {
+    let round_up = |size: usize, step: usize| ((size + step - 1) / step) * step;
+    let mut size = round_up(min_size.max(1), FAMILY_GRANULE);
+    let mut ret = vec![size];
+
+    while size < max_size {
+        // Step by `1 / classes_per_doubling` of the power of two
+        // at or below `size`.
+        let power = 1usize << (usize::BITS - 1 - size.leading_zeros());
+        let step = round_up((power / classes_per_doubling).max(1), FAMILY_GRANULE);
+
+        size = round_up(size + 1, step);
+        ret.push(size);
+    }
+
+    ret
+}
+
+impl ClassFamily {
+    /// Attempts to register a new family of classes for `config`.
+    #[ensures(ret.is_ok() ->
+              ret.as_ref().unwrap().class_for_size(config.max_size).is_some(),
+              "On success, the family services `max_size`.")]
+    pub fn new(config: ClassFamilyConfig) -> Result<&'static ClassFamily, &'static str> {
+        if config.max_size == 0 || config.max_size > MAX_FAMILY_SIZE {
+            return Err("class family max_size must be in [1, MAX_FAMILY_SIZE]");
+        }
+
+        if config.classes_per_doubling == 0 {
+            return Err("class family must have at least one class per doubling");
+        }
+
+        let min_size = config.min_size.min(config.max_size);
+        let mut table = Vec::with_capacity(config.max_size / FAMILY_GRANULE + 1);
+
+        for size in family_sizes(min_size, config.max_size, config.classes_per_doubling) {
+            let class = Class::new(ClassConfig {
+                name: config
+                    .name_prefix
+                    .as_ref()
+                    .map(|prefix| format!("{}_{}", prefix, size)),
+                layout: Layout::from_size_align(size, /*align=*/ 8)
+                    .map_err(|_| "invalid class family size")?,
+                zero_init: config.zero_init,
+                mapper_name: config.mapper_name.clone(),
+                magazine_size: None,
+                prefault: Prefault::Never,
+                isolate_cache_lines: false,
+            })?;
+
+            // Every granule up to `size` that's not yet covered maps
+            // to this class.
+            while table.len() * FAMILY_GRANULE <= size.min(config.max_size) {
+                table.push(class);
+            }
+        }
+
+        let classes: &'static [Class] = Box::leak(table.into_boxed_slice());
+        Ok(Box::leak(Box::new(ClassFamily {
+            max_size: config.max_size,
+            classes: classes.as_ptr(),
+        })))
+    }
+
+    /// Returns the largest size this family services.
+    pub fn max_size(&self) -> usize {
+        self.max_size
+    }
+
+    /// Returns the smallest class in the family for objects of `size`
+    /// bytes, or `None` if `size` exceeds `max_size`.
+    #[ensures(ret.is_some() -> ret.unwrap().info().layout.size() >= size,
+              "The class must be large enough for `size`.")]
+    #[inline]
+    pub fn class_for_size(&self, size: usize) -> Option<Class> {
+        if size > self.max_size {
+            return None;
+        }
+
+        let index = (size + FAMILY_GRANULE - 1) / FAMILY_GRANULE;
+        Some(unsafe { *self.classes.add(index) })
+    }
+}
+
+#[test]
+fn family_sizes_are_geometric() {
+    assert_eq!(
+        family_sizes(16, 256, 4),
+        vec![16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256]
+    );
+    assert_eq!(family_sizes(1, 100, 1), vec![16, 32, 64, 128]);
+    assert_eq!(family_sizes(24, 24, 4), vec![32]);
+}
+
+#[test]
+fn class_family_smoke_test() {
+    let family = ClassFamily::new(ClassFamilyConfig {
+        name_prefix: Some("family".into()),
+        min_size: 8,
+        max_size: 4000,
+        classes_per_doubling: 4,
+        zero_init: true,
+        mapper_name: None,
+    })
+    .expect("Should build");
+
+    assert_eq!(family.max_size(), 4000);
+    assert!(family.class_for_size(4001).is_none());
+
+    let mut last_size = 0;
+    for size in 0..=4000 {
+        let class = family.class_for_size(size).expect("Should have a class");
+        let class_size = class.info().layout.size();
+
+        assert!(class_size >= size);
+        assert!(class_size >= last_size);
+        // At most 25% internal fragmentation, past the first granule.
+        assert!(size <= FAMILY_GRANULE || 4 * class_size <= 5 * size + 4 * FAMILY_GRANULE);
+        last_size = class_size;
+    }
+
+    let class = family.class_for_size(100).expect("Should have a class");
+    let alloc = class.allocate().expect("Should allocate");
+    class.release(alloc);
+}
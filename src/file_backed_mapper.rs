@@ -1,6 +1,12 @@
 //! The file-backed mapper ensures object are allocated in shared file
 //! mappings of private temporary files.  This lets the operating
 //! system eagerly swap out cold data when under memory pressure.
+//!
+//! All chunks share one sparse backing file (per slab directory): each
+//! chunk's data maps the next range of the file, which grows as
+//! needed.  That's one file descriptor for the whole process, rather
+//! than one per chunk.  Purging free objects punches holes in that
+//! file.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -16,12 +22,42 @@ use std::ffi::c_void;
 use std::fs::File;
 use std::path::PathBuf;
 use std::ptr::NonNull;
+use std::sync::Arc;
 use std::sync::Mutex;
 
 use crate::Mapper;
 
+#[derive(Debug, Default)]
+pub struct FileBackedMapper {
+    state: Mutex<PoolState>,
+}
+
+/// The sparse file that backs new chunks of data.
+#[derive(Debug)]
+struct BackingFile {
+    /// The slab directory we created the file in.
+    dir: Option<PathBuf>,
+    file: Arc<File>,
+    /// The next chunk goes at this offset, the current file size.
+    len: usize,
+}
+
+/// A range of data, and the file range it maps.
 #[derive(Debug)]
-pub struct FileBackedMapper {}
+struct FileRegion {
+    base: usize,
+    size: usize,
+    file: Arc<File>,
+    offset: usize,
+}
+
+#[derive(Debug, Default)]
+struct PoolState {
+    current: Option<BackingFile>,
+    /// Every file-backed data region, so we can find the file
+    /// offset for a given address.  Regions are immortal.
+    regions: Vec<FileRegion>,
+}
 
 lazy_static::lazy_static! {
     static ref FILE_BACKED_PATH: Mutex<Option<PathBuf>> = Default::default();
@@ -38,15 +74,13 @@ pub fn set_file_backed_slab_directory(path: Option<PathBuf>) {
     *global_path = path;
 }
 
-/// Returns a temporary File in `FILE_BACKED_PATH`, or in the
-/// global `TMPDIR`.  If the file is None, the mapper should
-/// instead use a regular anonymous memory mapping.
+/// Returns a temporary File in `dir`, or in the global `TMPDIR`.
+/// If the file is None, the mapper should instead use a regular
+/// anonymous memory mapping.
 ///
 /// TODO: return a `std::io::Result<Option<File>>`.
-fn get_temp_file() -> Result<Option<File>, i32> {
-    let path = FILE_BACKED_PATH.lock().unwrap();
-
-    match &*path {
+fn get_temp_file(dir: &Option<PathBuf>) -> Result<Option<File>, i32> {
+    match dir {
         Some(dir) if dir.to_str() == Some(":memory:") => Ok(None),
         Some(dir) => tempfile::tempfile_in(dir).map(Some),
         None => tempfile::tempfile().map(Some),
@@ -54,6 +88,46 @@ fn get_temp_file() -> Result<Option<File>, i32> {
     .map_err(|e| e.raw_os_error().unwrap_or(0))
 }
 
+impl PoolState {
+    /// Returns the backing file for the current slab directory, and
+    /// `size` fresh bytes at the returned offset in that file, or
+    /// `None` if we should use anonymous memory.
+    fn grow(&mut self, size: usize) -> Result<Option<(Arc<File>, usize)>, i32> {
+        let dir = FILE_BACKED_PATH.lock().unwrap().clone();
+
+        // The slab directory changed: switch to a new file (the old
+        // one stays open as long as mappings refer to it).
+        if self.current.as_ref().map(|current| &current.dir) != Some(&dir) {
+            self.current = match get_temp_file(&dir)? {
+                Some(file) => Some(BackingFile {
+                    dir,
+                    file: Arc::new(file),
+                    len: 0,
+                }),
+                None => return Ok(None),
+            };
+        }
+
+        let current = self.current.as_mut().expect("must have a backing file");
+        let offset = current.len;
+        // Extending the file doesn't allocate any block.
+        current
+            .file
+            .set_len((offset + size) as u64)
+            .map_err(|e| e.raw_os_error().unwrap_or(0))?;
+        current.len += size;
+        Ok(Some((current.file.clone(), offset)))
+    }
+
+    /// Returns the file and file offset that back the data at `base`.
+    fn find(&self, base: usize) -> Option<(&File, usize)> {
+        self.regions
+            .iter()
+            .find(|region| region.base <= base && base - region.base < region.size)
+            .map(|region| (&*region.file, region.offset + (base - region.base)))
+    }
+}
+
 #[contract_trait]
 impl Mapper for FileBackedMapper {
     fn page_size(&self) -> usize {
@@ -76,15 +150,74 @@ impl Mapper for FileBackedMapper {
     }
 
     fn allocate_meta(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
-        crate::map::allocate_region(base, size)
+        crate::map::allocate_region(base, size, None)
+    }
+
+    fn allocate_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        node: Option<u32>,
+    ) -> Result<(), i32> {
+        let mut state = self.state.lock().unwrap();
+
+        match state.grow(size)? {
+            Some((file, offset)) => {
+                crate::map::allocate_file_region(&file, offset, base, size, node)?;
+                state.regions.push(FileRegion {
+                    base: base.as_ptr() as usize,
+                    size,
+                    file,
+                    offset,
+                });
+                Ok(())
+            }
+            None => crate::map::allocate_region(base, size, node),
+        }
     }
 
-    fn allocate_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
-        let tempfile = get_temp_file()?;
+    fn purge_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        let state = self.state.lock().unwrap();
 
-        match tempfile {
-            Some(file) => crate::map::allocate_file_region(file, base, size),
-            None => crate::map::allocate_region(base, size),
+        match state.find(base.as_ptr() as usize) {
+            Some((file, offset)) => crate::map::punch_file_region(file, offset, size),
+            // Regular anonymous memory (":memory:").
+            None => crate::map::purge_region(base, size),
         }
     }
 }
+
+#[test]
+fn file_backed_class_smoke_test() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig {
+        zero_init: false,
+        mapper_name: Some("file".into()),
+        ..ClassConfig::for_test("file_backed", 4096)
+    })
+    .expect("Should build");
+
+    let allocs: Vec<_> = (0..256)
+        .map(|i| {
+            let alloc = class.allocate().expect("Should allocate");
+
+            unsafe { *(alloc.as_ptr() as *mut usize) = i };
+            alloc
+        })
+        .collect();
+
+    // Cold pages keep their contents.
+    assert!(class.advise_cold(true).expect("Should advise") >= 256 * 4096);
+    for (i, alloc) in allocs.iter().enumerate() {
+        assert_eq!(unsafe { *(alloc.as_ptr() as *const usize) }, i);
+    }
+
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    // Purging punches holes in the backing file.
+    assert!(class.purge(0) > 0);
+}
@@ -0,0 +1,138 @@
+//! Each chunk's metadata region ends with a free bitmap, with one bit
+//! per 8-byte granule of data.  The bit for an object's first granule
+//! is set exactly when the object is cached in its class's global
+//! storage (depot or inboxes).  `Class::new` rounds layouts up to
+//! the granule, in size and alignment, so no two objects share a bit.
+//!
+//! We only flip bits when a magazine enters or leaves that storage,
+//! never on the allocation and release fast paths, so objects in
+//! thread (or CPU) caches look allocated.  That's enough to catch the
+//! most common double frees (back-to-back, or when the first free
+//! already made it to the depot) at a cost of a few atomic operations
+//! per magazine, so the check is always on.  We also validate each
+//! object's class, and that it's not an interior pointer, on the way
+//! in.
+use std::sync::atomic::Ordering;
+
+use crate::class::ClassInfo;
+use crate::magazine::Magazine;
+use crate::mill;
+use crate::mill::SpanMetadata;
+
+/// Marks the object of `info`'s class at `address` as cached in the
+/// class's global storage.
+///
+/// # Errors
+///
+/// Returns `Err` if the object is already cached (a double free), or
+/// is not the start of an object of `info`'s class.
+fn mark_cached(info: &ClassInfo, address: usize) -> Result<(), &'static str> {
+    let meta: &SpanMetadata =
+        unsafe { SpanMetadata::from_allocation_address(address).as_ref() }.ok_or("bad address")?;
+
+    if meta.class_id != Some(info.id.id()) {
+        return Err("class mismatch");
+    }
+
+    if address < meta.span_begin || (address - meta.span_begin) % info.layout.size() != 0 {
+        return Err("interior pointer");
+    }
+
+    let (word, bit) = mill::free_bit_for_address(address);
+    if word.fetch_or(bit, Ordering::Relaxed) & bit != 0 {
+        return Err("double free");
+    }
+
+    Ok(())
+}
+
+/// Marks the object at `address` as no longer cached in the global
+/// storage (about to be allocated).
+#[inline]
+fn mark_uncached(address: usize) {
+    let (word, bit) = mill::free_bit_for_address(address);
+
+    word.fetch_and(!bit, Ordering::Relaxed);
+}
+
+impl ClassInfo {
+    /// Marks all the objects in `mag` as entering the class's global
+    /// storage.
+    ///
+    /// # Panics
+    ///
+    /// Panics on double free or pointers that don't look like
+    /// allocations from this class.
+    pub(crate) fn mark_magazine_cached<const PUSH_MAG: bool>(&self, mag: &Magazine<PUSH_MAG>) {
+        for slot in mag.populated() {
+            let address = unsafe { (*slot.as_ptr()).get().as_ptr() as usize };
+
+            if let Err(e) = mark_cached(self, address) {
+                panic!("slitter: {} at {:#x} (class {:?})", e, address, self.name);
+            }
+        }
+    }
+
+    /// Marks all the objects in `mag` as leaving the class's global
+    /// storage.
+    pub(crate) fn mark_magazine_uncached<const PUSH_MAG: bool>(&self, mag: &Magazine<PUSH_MAG>) {
+        for slot in mag.populated() {
+            mark_uncached(unsafe { (*slot.as_ptr()).get().as_ptr() as usize });
+        }
+    }
+}
+
+#[test]
+fn free_bitmap_smoke_test() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    let config = |name| ClassConfig {
+        zero_init: false,
+        ..ClassConfig::for_test(name, 32)
+    };
+    let class = Class::new(config("free_bitmap")).expect("Should build");
+    let other = Class::new(config("free_bitmap_other")).expect("Should build");
+    let info = class.info();
+
+    let alloc = class.allocate().expect("Should allocate");
+    let address = alloc.as_ptr() as usize;
+
+    assert_eq!(mark_cached(info, address), Ok(()));
+    assert_eq!(mark_cached(info, address), Err("double free"));
+    assert_eq!(mark_cached(info, address + 8), Err("interior pointer"));
+    assert_eq!(mark_cached(other.info(), address), Err("class mismatch"));
+
+    mark_uncached(address);
+    assert_eq!(mark_cached(info, address), Ok(()));
+    mark_uncached(address);
+
+    class.release(alloc);
+}
+
+#[test]
+fn free_bitmap_small_objects() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig {
+        layout: std::alloc::Layout::new::<u32>(),
+        zero_init: false,
+        ..ClassConfig::for_test("free_bitmap_small", 4)
+    })
+    .expect("Should build");
+
+    assert_eq!(class.info().layout.size(), mill::FREE_BITMAP_GRANULE);
+    assert_eq!(class.info().layout.align(), mill::FREE_BITMAP_GRANULE);
+
+    // Enough round trips for magazines to go through the depot.
+    for _ in 0..4 {
+        let allocs: Vec<_> = (0..1000)
+            .map(|_| class.allocate().expect("Should allocate"))
+            .collect();
+
+        for alloc in allocs {
+            class.release(alloc);
+        }
+    }
+}
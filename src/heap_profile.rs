@@ -0,0 +1,367 @@
+//! A sampling heap profiler, in the style of tcmalloc's.
+//!
+//! Each thread samples the bytes it allocates at exponentially
+//! distributed intervals (i.e., a Poisson process over bytes).  We
+//! only check the sampling countdown when a thread refills one of its
+//! magazines in `ClassInfo::refill_magazine`, and then charge the
+//! whole magazine at once: a sample fires on the allocation that the
+//! slow path returns, and stands for the sampling interval's worth
+//! of bytes, so the fast paths remain untouched.
+//!
+//! Sampled objects stay in the profile's live set until they are
+//! released.  We detect that when their (push) magazine comes back
+//! to the `ClassInfo`, after checking each object against a small
+//! filter of sampled addresses, without taking any lock.
+//!
+//! Profiles use the legacy text format of gperftools' heap profiler,
+//! which `pprof` understands.
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::io::Write;
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+use std::sync::Mutex;
+
+use crate::class::Class;
+use crate::class::ClassInfo;
+use crate::linear_ref::LinearRef;
+use crate::magazine::Magazine;
+
+/// Mean number of bytes between samples for each thread, or 0 to
+/// disable sampling.
+static SAMPLE_INTERVAL: AtomicUsize = AtomicUsize::new(0);
+
+/// We record at most this many frames for each sample.
+const MAX_FRAMES: usize = 64;
+
+/// Number of 64-bit words in the filter of live sampled addresses.
+const FILTER_WORDS: usize = 32;
+
+extern "C" {
+    fn slitter__backtrace(frames: *mut usize, max_frames: usize) -> usize;
+}
+
+/// Updates the mean number of bytes each thread allocates between
+/// two samples.  0 disables sampling.
+pub fn set_heap_sample_interval(bytes: usize) {
+    SAMPLE_INTERVAL.store(bytes, Ordering::Relaxed);
+}
+
+#[derive(Clone, Copy, Default)]
+struct Sampler {
+    /// xorshift64* state; 0 until the sampler is seeded.
+    rng: u64,
+    /// Number of bytes the thread may allocate before the next sample.
+    bytes_until_sample: u64,
+}
+
+thread_local!(static SAMPLER: Cell<Sampler> = Cell::new(Default::default()));
+
+/// Approximates `log2(x)` for `x > 0`, within ~0.01, without
+/// pulling in libm.
+#[inline]
+fn fast_log2(x: u64) -> f64 {
+    let exponent = 63 - x.leading_zeros();
+    // Mantissa in [0, 1).
+    let m = ((x as f64) / (1u64 << exponent) as f64) - 1.0;
+
+    exponent as f64 + m * (1.3466 - 0.3466 * m)
+}
+
+impl Sampler {
+    /// Returns an exponentially distributed number of bytes, with
+    /// mean `interval`.
+    fn next_interval(&mut self, interval: usize) -> u64 {
+        self.rng ^= self.rng >> 12;
+        self.rng ^= self.rng << 25;
+        self.rng ^= self.rng >> 27;
+
+        // Uniform in [1, 2^53].
+        let bits = (self.rng.wrapping_mul(0x2545_f491_4f6c_dd1d) >> 11) + 1;
+
+        // -ln(bits / 2^53) = ln(2) * (53 - log2(bits)).
+        let log2 = 53.0 - fast_log2(bits);
+        (log2 * std::f64::consts::LN_2 * interval as f64) as u64 + 1
+    }
+
+    /// Charges `bytes` to the sampler, and returns the number of
+    /// bytes the charge's sample represents (0 if no sample fired).
+    fn charge(&mut self, bytes: usize, interval: usize) -> u64 {
+        if self.rng == 0 {
+            let nanos = std::time::SystemTime::now()
+                .duration_since(std::time::UNIX_EPOCH)
+                .map(|duration| duration.as_nanos() as u64)
+                .unwrap_or(0);
+
+            self.rng = (nanos ^ (self as *const Self as u64)) | 1;
+            self.bytes_until_sample = self.next_interval(interval);
+        }
+
+        let mut bytes = bytes as u64;
+        let mut weight = 0;
+        while bytes >= self.bytes_until_sample {
+            bytes -= self.bytes_until_sample;
+            weight += interval as u64;
+            self.bytes_until_sample = self.next_interval(interval);
+        }
+
+        self.bytes_until_sample -= bytes;
+        weight
+    }
+}
+
+/// Returns whether `allocated` should be sampled, after refilling a
+/// magazine with `count` objects of `object_size` bytes (including
+/// `allocated`), and if so, the number of bytes that sample
+/// represents.
+#[inline]
+fn charge_refill(object_size: usize, count: usize) -> u64 {
+    let interval = SAMPLE_INTERVAL.load(Ordering::Relaxed);
+    if interval == 0 {
+        return 0;
+    }
+
+    SAMPLER
+        .try_with(|cell| {
+            let mut sampler = cell.get();
+            let ret = sampler.charge(object_size * count, interval);
+
+            cell.set(sampler);
+            ret
+        })
+        .unwrap_or(0)
+}
+
+#[derive(Default)]
+struct ProfileState {
+    /// Sampled objects that have yet to be released: the stack for
+    /// their allocation, and the number of bytes they stand for.
+    live: HashMap<usize, (Box<[usize]>, u64)>,
+    /// Cumulative sample count and bytes for each stack.
+    total: HashMap<Box<[usize]>, (u64, u64)>,
+}
+
+/// Each class has its own `HeapProfile`.
+#[derive(Default)]
+pub(crate) struct HeapProfile {
+    /// One bit for each bucket of sampled addresses in `state.live`.
+    filter: [AtomicU64; FILTER_WORDS],
+    /// `state.live.len()`, for lock-free reads.
+    live_count: AtomicUsize,
+    state: Mutex<ProfileState>,
+}
+
+/// Returns the word index and bit mask for `address` in the filter.
+#[inline(always)]
+fn filter_bit(address: usize) -> (usize, u64) {
+    let hash = ((address as u64) >> 3).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+    let bit = (hash >> 52) as usize % (64 * FILTER_WORDS);
+
+    (bit / 64, 1u64 << (bit % 64))
+}
+
+impl HeapProfile {
+    /// Records a sample for the object at `address`, which stands for
+    /// `weight` bytes.
+    #[inline(never)]
+    fn record(&self, address: usize, weight: u64) {
+        let mut frames = [0usize; MAX_FRAMES];
+        let count = unsafe { slitter__backtrace(frames.as_mut_ptr(), MAX_FRAMES) };
+        // Skip `slitter__backtrace` itself.
+        let stack: Box<[usize]> = frames[count.min(1)..count].into();
+
+        let state = &mut *self.state.lock().unwrap();
+        let total = state.total.entry(stack.clone()).or_default();
+
+        total.0 += 1;
+        total.1 += weight;
+        state.live.insert(address, (stack, weight));
+
+        let (word, mask) = filter_bit(address);
+        self.filter[word].fetch_or(mask, Ordering::Relaxed);
+        self.live_count.store(state.live.len(), Ordering::Relaxed);
+    }
+
+    /// Drops the live samples for any object in `mag`, a magazine of
+    /// released objects.
+    #[inline]
+    fn observe_release<const PUSH_MAG: bool>(&self, mag: &Magazine<PUSH_MAG>) {
+        if self.live_count.load(Ordering::Relaxed) == 0 {
+            return;
+        }
+
+        let address = |slot: &std::mem::MaybeUninit<LinearRef>| unsafe {
+            (*slot.as_ptr()).get().as_ptr() as usize
+        };
+
+        let may_be_sampled = |address: usize| {
+            let (word, mask) = filter_bit(address);
+
+            (self.filter[word].load(Ordering::Relaxed) & mask) != 0
+        };
+
+        if !mag
+            .populated()
+            .iter()
+            .any(|slot| may_be_sampled(address(slot)))
+        {
+            return;
+        }
+
+        let mut state = self.state.lock().unwrap();
+        let mut removed = false;
+        for slot in mag.populated() {
+            removed |= state.live.remove(&address(slot)).is_some();
+        }
+
+        if !removed {
+            return;
+        }
+
+        // Rebuild the filter with the lock held, so we can't lose a
+        // concurrent `record`.  Live samples stay in the filter
+        // throughout.
+        let mut filter = [0u64; FILTER_WORDS];
+        for address in state.live.keys() {
+            let (word, mask) = filter_bit(*address);
+            filter[word] |= mask;
+        }
+
+        for (dst, src) in self.filter.iter().zip(filter.iter()) {
+            dst.store(*src, Ordering::Relaxed);
+        }
+
+        self.live_count.store(state.live.len(), Ordering::Relaxed);
+    }
+
+    /// Writes the profile for objects of `object_size` bytes to `out`.
+    fn write(&self, object_size: usize, out: &mut dyn Write) -> std::io::Result<()> {
+        // (in-use count, in-use bytes, total count, total bytes) for each stack.
+        let mut stacks: HashMap<&[usize], [u64; 4]> = HashMap::new();
+        let state = self.state.lock().unwrap();
+
+        let to_count = |weight: u64| (weight / object_size as u64).max(1);
+        for (stack, weight) in state.live.values() {
+            let entry = stacks.entry(&stack[..]).or_default();
+
+            entry[0] += to_count(*weight);
+            entry[1] += weight;
+        }
+
+        for (stack, (_, weight)) in state.total.iter() {
+            let entry = stacks.entry(&stack[..]).or_default();
+
+            entry[2] += to_count(*weight);
+            entry[3] += weight;
+        }
+
+        let mut sum = [0u64; 4];
+        for entry in stacks.values() {
+            for (acc, x) in sum.iter_mut().zip(entry.iter()) {
+                *acc += x;
+            }
+        }
+
+        // Samples are already scaled to the bytes they stand for.
+        writeln!(
+            out,
+            "heap profile: {}: {} [{}: {}] @ heapprofile",
+            sum[0], sum[1], sum[2], sum[3]
+        )?;
+
+        for (stack, entry) in stacks.iter() {
+            write!(
+                out,
+                "{}: {} [{}: {}] @",
+                entry[0], entry[1], entry[2], entry[3]
+            )?;
+
+            for frame in stack.iter() {
+                write!(out, " {:#x}", frame)?;
+            }
+
+            writeln!(out)?;
+        }
+
+        writeln!(out, "\nMAPPED_LIBRARIES:")?;
+        out.write_all(&std::fs::read("/proc/self/maps").unwrap_or_default())
+    }
+}
+
+impl ClassInfo {
+    /// Samples `allocated`, the allocation returned after refilling
+    /// a magazine that now holds `cached` more objects, if the
+    /// calling thread's sampler fires.
+    #[inline]
+    pub(crate) fn maybe_sample_refill(&self, allocated: &LinearRef, cached: usize) {
+        let weight = charge_refill(self.layout.size(), cached + 1);
+
+        if weight > 0 {
+            self.heap_profile
+                .record(allocated.get().as_ptr() as usize, weight);
+        }
+    }
+
+    /// Notes that the objects in `mag` have been released.
+    #[inline]
+    pub(crate) fn observe_release<const PUSH_MAG: bool>(&self, mag: &Magazine<PUSH_MAG>) {
+        self.heap_profile.observe_release(mag);
+    }
+}
+
+impl Class {
+    /// Writes a heap profile of the class's sampled allocations to
+    /// `out`, in a format `pprof` understands.
+    pub fn write_heap_profile(self, out: &mut dyn Write) -> std::io::Result<()> {
+        let info = self.info();
+
+        info.heap_profile.write(info.layout.size(), out)
+    }
+}
+
+#[test]
+fn fast_log2_is_close() {
+    for x in [1u64, 2, 3, 5, 1000, 12345, 1 << 40, u64::MAX >> 11].iter() {
+        assert!((fast_log2(*x) - (*x as f64).log2()).abs() < 0.01);
+    }
+}
+
+#[test]
+fn heap_profile_smoke_test() {
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig::for_test("heap_profile", 128)).expect("Should build");
+
+    // Sample every 16 KB, on average.  This is global, but other
+    // tests don't care.
+    set_heap_sample_interval(16 << 10);
+
+    let allocs: Vec<_> = (0..10000)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+
+    set_heap_sample_interval(0);
+
+    let mut profile = Vec::new();
+    class
+        .write_heap_profile(&mut profile)
+        .expect("should write");
+    let profile = String::from_utf8(profile).expect("should be utf-8");
+
+    assert!(profile.starts_with("heap profile: "));
+    assert!(profile.contains("MAPPED_LIBRARIES:"));
+    // 1.28 MB allocated, sampled every 16 KB.
+    let live_before = class.info().heap_profile.live_count.load(Ordering::Relaxed);
+    assert!(live_before > 1);
+
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    // Released objects leave the live set once their magazines
+    // make it back to the class; only the last one could still be
+    // cached in this thread.
+    let live = class.info().heap_profile.state.lock().unwrap().live.len();
+    assert!(live < live_before);
+}
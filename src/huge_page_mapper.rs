@@ -0,0 +1,104 @@
+//! The huge page mappers back object data with 2 MB pages, to cut
+//! dTLB misses when many small objects are spread over large spans.
+//!
+//! The mappers still report the base page size: guard and metadata
+//! regions remain base page granular, and only the data region of
+//! each chunk (which is always aligned to `DATA_ALIGNMENT`, a
+//! multiple of 2 MB) asks for huge pages.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::ffi::c_void;
+use std::ptr::NonNull;
+
+use crate::Mapper;
+
+/// How a `HugePageMapper` asks for huge pages.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum HugePagePolicy {
+    /// Hint at transparent huge pages with `madvise(MADV_HUGEPAGE)`.
+    Transparent,
+    /// Use explicit huge pages from the hugetlbfs pool, and fall
+    /// back to transparent huge pages when the pool is exhausted.
+    HugeTlb,
+}
+
+/// Registered as "thp" (`HugePagePolicy::Transparent`) and
+/// "hugetlb" (`HugePagePolicy::HugeTlb`).
+#[derive(Debug)]
+pub struct HugePageMapper {
+    policy: HugePagePolicy,
+}
+
+impl HugePageMapper {
+    pub const fn new(policy: HugePagePolicy) -> Self {
+        Self { policy }
+    }
+}
+
+#[contract_trait]
+impl Mapper for HugePageMapper {
+    fn page_size(&self) -> usize {
+        crate::map::page_size()
+    }
+
+    fn reserve(
+        &self,
+        desired_size: usize,
+        _data_size: usize,
+        _prefix: usize,
+        _suffix: usize,
+    ) -> Result<(NonNull<c_void>, usize), i32> {
+        let region: NonNull<c_void> = crate::map::reserve_region(desired_size)?;
+        Ok((region, desired_size))
+    }
+
+    fn release(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        crate::map::release_region(base, size)
+    }
+
+    fn allocate_meta(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        crate::map::allocate_region(base, size, None)
+    }
+
+    fn allocate_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        node: Option<u32>,
+    ) -> Result<(), i32> {
+        crate::map::allocate_huge_region(base, size, node, self.policy == HugePagePolicy::HugeTlb)
+    }
+}
+
+#[test]
+fn smoke_test_huge_page_mappers() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    for mapper_name in ["thp", "hugetlb"].iter() {
+        let class = Class::new(ClassConfig {
+            mapper_name: Some(mapper_name.to_string()),
+            ..ClassConfig::for_test(format!("huge_{}", mapper_name), 64)
+        })
+        .expect("Should build");
+
+        // Hugetlb falls back to regular pages when the pool is empty,
+        // so this should always work.
+        let allocs: Vec<_> = (0..100)
+            .map(|_| class.allocate().expect("Should allocate"))
+            .collect();
+
+        for alloc in allocs {
+            class.release(alloc);
+        }
+    }
+}
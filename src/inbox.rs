@@ -0,0 +1,259 @@
+//! Producer/consumer workloads allocate on some threads and release
+//! on others.  Without help, every magazine the consumers fill goes
+//! through the class's depot twice: pushed by a consumer, and popped
+//! by a producer.
+//!
+//! Each class instead offers a few `Inbox`es: threads that mostly
+//! refill magazines (as observed by their `MagazinePacer`) claim an
+//! inbox, and threads that release full magazines hand them directly
+//! to claimed inboxes, before falling back to the depot.  The owner
+//! checks its inbox first when it refills a magazine.
+//!
+//! Inboxes live in their `ClassInfo`, so they are immortal, and
+//! releasers never have to worry about an inbox's owner going away:
+//! when a thread gives up its inbox, it drains the inbox into the
+//! depot, and any releaser that races with that drain, and finds the
+//! inbox unowned after pushing to it, drains the inbox as well.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::sync::atomic::fence;
+use std::sync::atomic::AtomicBool;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+
+use crate::class::ClassInfo;
+use crate::magazine::Magazine;
+use crate::magazine::PopMagazine;
+use crate::magazine_stack::MagazineStack;
+
+/// Each class has this many inboxes.  Past that, producers share
+/// the depot.
+const NUM_INBOXES: usize = 8;
+
+/// Releasers stop pushing to an inbox once it holds this many
+/// magazines: the owner is falling behind, and other threads may
+/// want these objects.
+const MAX_INBOX_MAGAZINES: usize = 4;
+
+/// Each inbox lives on its own pair of cache lines, like depot shards.
+#[repr(C)]
+#[repr(align(128))]
+struct Inbox {
+    mags: MagazineStack,
+    // Number of magazines in `mags`.  We count before pushing and
+    // after popping, so this never underflows.
+    count: AtomicUsize,
+    owned: AtomicBool,
+}
+
+pub struct Inboxes {
+    slots: [Inbox; NUM_INBOXES],
+    // Number of owned inboxes.
+    num_owned: AtomicUsize,
+    // Releasers scan inboxes round-robin from this (wrapping) index.
+    next: AtomicUsize,
+}
+
+/// A thread's claim on one of its class's inboxes.  Dropping the
+/// claim gives up the inbox.
+#[derive(Default)]
+pub struct InboxClaim {
+    claimed: Option<(&'static ClassInfo, usize)>,
+}
+
+impl Default for Inbox {
+    fn default() -> Self {
+        Self {
+            mags: MagazineStack::new(),
+            count: AtomicUsize::new(0),
+            owned: AtomicBool::new(false),
+        }
+    }
+}
+
+impl Default for Inboxes {
+    fn default() -> Self {
+        Self {
+            slots: Default::default(),
+            num_owned: AtomicUsize::new(0),
+            next: AtomicUsize::new(0),
+        }
+    }
+}
+
+impl Inbox {
+    #[inline]
+    fn pop(&self) -> Option<PopMagazine> {
+        let ret: Option<PopMagazine> = self.mags.pop();
+
+        if ret.is_some() {
+            self.count.fetch_sub(1, Ordering::Relaxed);
+        }
+
+        ret
+    }
+
+    /// Moves everything in this inbox to `info`'s depot.
+    fn drain(&self, info: &ClassInfo) {
+        while let Some(mag) = self.pop() {
+            info.depot.push_full(mag);
+        }
+    }
+}
+
+impl InboxClaim {
+    /// Attempts to claim one of `info`'s inboxes, if we don't
+    /// already have one.
+    pub fn claim(&mut self, info: &'static ClassInfo) {
+        if self.claimed.is_some() {
+            return;
+        }
+
+        let inboxes = &info.inboxes;
+        for (index, inbox) in inboxes.slots.iter().enumerate() {
+            if inbox
+                .owned
+                .compare_exchange(false, true, Ordering::AcqRel, Ordering::Relaxed)
+                .is_ok()
+            {
+                inboxes.num_owned.fetch_add(1, Ordering::Relaxed);
+                self.claimed = Some((info, index));
+                return;
+            }
+        }
+    }
+
+    /// Gives up our inbox, if any, and moves its contents to the depot.
+    pub fn release(&mut self) {
+        if let Some((info, index)) = self.claimed.take() {
+            let inbox = &info.inboxes.slots[index];
+
+            info.inboxes.num_owned.fetch_sub(1, Ordering::Relaxed);
+            inbox.owned.store(false, Ordering::Release);
+            // Pairs with the fence in `deliver_to_inbox`: either the
+            // releaser sees the inbox is unowned, or we see its push.
+            fence(Ordering::SeqCst);
+            inbox.drain(info);
+        }
+    }
+}
+
+impl Drop for InboxClaim {
+    fn drop(&mut self) {
+        self.release();
+    }
+}
+
+impl ClassInfo {
+    /// Returns a magazine from the inbox for `claim`, if any.
+    ///
+    /// The magazine has not been zero-filled yet, but its objects are
+    /// already marked as leaving the class's global storage.
+    #[ensures(ret.is_some() -> ret.as_ref().unwrap().is_full())]
+    #[inline]
+    pub(crate) fn take_from_inbox(&self, claim: &InboxClaim) -> Option<PopMagazine> {
+        let (info, index) = claim.claimed?;
+
+        debug_assert!(std::ptr::eq(info, self));
+        let mag = self.inboxes.slots[index].pop()?;
+
+        self.mark_magazine_uncached(&mag);
+        Some(mag)
+    }
+
+    /// Attempts to hand `mag`, a full magazine of released objects,
+    /// to a thread that owns one of this class's inboxes.  Returns
+    /// `mag` back if there is no such inbox with room for it.
+    #[requires(mag.is_full())]
+    #[inline]
+    pub(crate) fn deliver_to_inbox<const PUSH_MAG: bool>(
+        &self,
+        mag: Magazine<PUSH_MAG>,
+    ) -> Option<Magazine<PUSH_MAG>> {
+        let inboxes = &self.inboxes;
+
+        if inboxes.num_owned.load(Ordering::Relaxed) == 0 {
+            return Some(mag);
+        }
+
+        let start = inboxes.next.fetch_add(1, Ordering::Relaxed);
+        for i in 0..NUM_INBOXES {
+            let inbox = &inboxes.slots[start.wrapping_add(i) % NUM_INBOXES];
+
+            if !inbox.owned.load(Ordering::Relaxed)
+                || inbox.count.load(Ordering::Relaxed) >= MAX_INBOX_MAGAZINES
+            {
+                continue;
+            }
+
+            inbox.count.fetch_add(1, Ordering::Relaxed);
+            inbox.mags.push(mag);
+
+            // If the owner gave up the inbox in the meantime, make
+            // sure our magazine doesn't get stuck there.
+            fence(Ordering::SeqCst);
+            if !inbox.owned.load(Ordering::Relaxed) {
+                inbox.drain(self);
+            }
+
+            return None;
+        }
+
+        Some(mag)
+    }
+}
+
+#[test]
+fn inbox_smoke_test() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig {
+        zero_init: false,
+        ..ClassConfig::for_test("inbox", 32)
+    })
+    .expect("Should build");
+    let info = class.info();
+
+    let mut claim: InboxClaim = Default::default();
+    claim.claim(info);
+    assert!(claim.claimed.is_some());
+
+    let allocs: Vec<_> = (0..1000)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    // The first few full magazines go to our inbox, the rest to
+    // the depot.
+    let (depot_before, _) = info.depot.occupancy();
+    assert_eq!(
+        info.inboxes.slots[claim.claimed.unwrap().1]
+            .count
+            .load(Ordering::Relaxed),
+        MAX_INBOX_MAGAZINES
+    );
+
+    let mag = info
+        .take_from_inbox(&claim)
+        .expect("should have a magazine");
+    assert!(mag.is_full());
+    info.release_magazine(mag, None);
+
+    // Giving up the inbox moves its contents to the depot.
+    drop(claim);
+    let (depot_after, _) = info.depot.occupancy();
+    assert_eq!(depot_after, depot_before + MAX_INBOX_MAGAZINES);
+}
@@ -61,6 +61,40 @@ impl Class {
     }
 }
 
+/// Marks an object returned by `Class::allocate` as ready for reuse,
+/// like `Class::release`, but finds the object's class from its
+/// address.
+///
+/// Panics if Slitter does not manage `block`.
+#[inline]
+pub fn release_any(block: NonNull<c_void>) {
+    match Class::of(block.as_ptr()) {
+        Some(class) => class.release(block),
+        None => release_unmanaged(block.as_ptr()),
+    }
+}
+
+/// Returns the number of usable bytes in the allocation at `ptr`, or
+/// 0 if `ptr` is NULL or Slitter does not manage `ptr`.
+pub fn usable_size(ptr: *const c_void) -> usize {
+    Class::of(ptr)
+        .map(|class| class.info().layout.size())
+        .unwrap_or(0)
+}
+
+#[inline(never)]
+#[cold]
+fn release_unmanaged(ptr: *mut c_void) -> ! {
+    panic!("slitter: release of unmanaged address {:?}", ptr);
+}
+
+/// `slitter_release_any` calls into this function when Slitter does
+/// not manage `ptr`.  The panic can't unwind into C, so this aborts.
+#[no_mangle]
+pub extern "C" fn slitter__release_unmanaged(ptr: *mut c_void) -> ! {
+    release_unmanaged(ptr)
+}
+
 impl ClassInfo {
     /// The `cache` calls into this slow path when its thread-local
     /// storage is being deinitialised.
@@ -76,7 +110,11 @@ impl ClassInfo {
     #[inline(never)]
     pub(crate) fn allocate_slow(&self) -> Option<LinearRef> {
         let mut empty_cache = LocalMagazineCache::Nothing;
-        if let Some(mut mag) = self.get_cached_magazine(&mut empty_cache) {
+
+        self.counters.observe_slow_allocation();
+        let ret = if let Some(mut mag) =
+            self.get_cached_magazine(&mut empty_cache, &Default::default())
+        {
             let allocated = mag.get();
             assert!(allocated.is_some());
 
@@ -87,7 +125,13 @@ impl ClassInfo {
             // objects: we require that the underlying mapper only
             // give us zero-filled memory.
             self.press.allocate_one_object()
+        };
+
+        if ret.is_some() {
+            self.counters.fold(1, 0);
         }
+
+        ret
     }
 
     /// The `cache` calls into this slow path when its thread-local
@@ -103,8 +147,59 @@ impl ClassInfo {
         let mut empty_cache = LocalMagazineCache::Nothing;
         let mut mag = self.allocate_non_full_magazine(&mut empty_cache);
 
+        self.counters.observe_slow_release();
+        self.counters.fold(0, 1);
         // Deallocation must succeed.
         assert_eq!(mag.put(block), None);
         self.release_magazine(mag, None);
     }
 }
+
+#[test]
+fn release_any_smoke_test() {
+    use crate::ClassConfig;
+
+    let classes: Vec<Class> = [8, 24]
+        .iter()
+        .map(|size| {
+            Class::new(ClassConfig::for_test(
+                format!("release_any_{}", size),
+                *size,
+            ))
+            .expect("Should build")
+        })
+        .collect();
+
+    let allocs: Vec<_> = (0..100)
+        .map(|i| {
+            let class = classes[i % classes.len()];
+
+            (class, class.allocate().expect("Should allocate"))
+        })
+        .collect();
+
+    for (class, alloc) in allocs.iter() {
+        assert_eq!(Class::of(alloc.as_ptr()), Some(*class));
+        assert_eq!(usable_size(alloc.as_ptr()), class.info().layout.size());
+    }
+
+    // Addresses outside Slitter's chunks are not managed.
+    let local = 0u64;
+    let boxed = Box::new(0u64);
+    assert_eq!(Class::of(std::ptr::null()), None);
+    assert_eq!(Class::of(&local as *const u64 as *const c_void), None);
+    assert_eq!(usable_size(&*boxed as *const u64 as *const c_void), 0);
+    assert_eq!(usable_size(usize::MAX as *const c_void), 0);
+
+    for (_, alloc) in allocs {
+        release_any(alloc);
+    }
+}
+
+#[test]
+#[should_panic(expected = "unmanaged address")]
+fn release_any_unmanaged() {
+    let boxed = Box::new(0u64);
+
+    release_any(NonNull::from(&*boxed).cast());
+}
@@ -1,16 +1,34 @@
+#![cfg_attr(feature = "thread_local_fast_path", feature(thread_local))]
+#[cfg(all(feature = "thread_local_fast_path", feature = "c_fast_path"))]
+compile_error!("`thread_local_fast_path` replaces `c_fast_path`; build with `--no-default-features`.");
+
+mod arena;
+mod batch;
 mod cache;
 mod class;
+mod family;
 mod file_backed_mapper;
+mod free_bitmap;
+mod heap_profile;
+mod huge_page_mapper;
+mod inbox;
 mod individual;
 mod linear_ref;
 mod magazine;
+mod magazine_depot;
 mod magazine_impl;
 mod magazine_stack;
 mod map;
 mod mapper;
 mod mill;
+#[cfg(feature = "per_cpu_cache")]
+mod per_cpu;
+mod persistent_mapper;
 mod press;
+mod purge;
 mod rack;
+mod scavenger;
+mod stats;
 
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
@@ -30,12 +48,30 @@ mod debug_type_map;
 
 use std::os::raw::c_char;
 
+pub use arena::Arena;
+pub use cache::flush_thread_cache;
+pub use cache::prepare_thread_cache;
 pub use class::Class;
 pub use class::ClassConfig;
 pub use class::ForeignClassConfig;
+pub use class::Prefault;
+pub use family::ClassFamily;
+pub use family::ClassFamilyConfig;
+pub use family::ForeignClassFamilyConfig;
 pub use file_backed_mapper::set_file_backed_slab_directory;
+pub use heap_profile::set_heap_sample_interval;
+pub use huge_page_mapper::HugePageMapper;
+pub use huge_page_mapper::HugePagePolicy;
+pub use individual::release_any;
+pub use individual::usable_size;
+pub use magazine_depot::DepotStats;
 pub use mapper::register_mapper;
 pub use mapper::Mapper;
+pub use mill::set_chunk_premap_threshold;
+pub use persistent_mapper::persistent_root;
+pub use persistent_mapper::register_persistent_mapper;
+pub use scavenger::set_cache_scavenge_period;
+pub use stats::ClassStats;
 
 /// Registers a new allocation class globally
 ///
@@ -49,6 +85,21 @@ pub unsafe extern "C" fn slitter_class_register(config_ptr: *const ForeignClassC
     Class::new(config).expect("slitter class allocation should succeed")
 }
 
+/// Registers a new family of allocation classes globally.
+///
+/// # Safety
+///
+/// This function assumes `config_ptr` is NULL or valid.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_class_family_register(
+    config_ptr: *const ForeignClassFamilyConfig,
+) -> &'static ClassFamily {
+    let config =
+        ClassFamilyConfig::from_c(config_ptr).expect("slitter_class_family_config must be valid");
+
+    ClassFamily::new(config).expect("slitter class family allocation should succeed")
+}
+
 /// Updates the directory for the file-backed slab's temporary files.
 ///
 /// NULL reverts to the default, and ":memory:" forces regular
@@ -73,6 +124,208 @@ pub unsafe extern "C" fn slitter_set_file_backed_slab_directory(path: *const c_c
     set_file_backed_slab_directory(Some(path_str.into()));
 }
 
+/// Registers a persistent mapper `name` for the heap in `dir`.
+/// Returns 0 on success, and `-errno` on failure.  See
+/// `register_persistent_mapper`.
+///
+/// # Safety
+///
+/// This function assumes `name` and `dir` are valid.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_register_persistent_mapper(
+    name: *const c_char,
+    dir: *const c_char,
+    base: usize,
+    max_size: usize,
+) -> i32 {
+    use std::ffi::CStr;
+
+    let name = CStr::from_ptr(name).to_str().expect("name must be valid");
+    let dir = CStr::from_ptr(dir).to_str().expect("dir must be valid");
+    match register_persistent_mapper(name, std::path::Path::new(dir), base, max_size) {
+        Ok(()) => 0,
+        Err(errno) => -errno,
+    }
+}
+
+/// Returns the address of the root pointer for the persistent mapper
+/// `name`, or NULL if there is no such mapper.  See `persistent_root`.
+///
+/// # Safety
+///
+/// This function assumes `name` is valid.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_persistent_root(
+    name: *const c_char,
+) -> *mut *mut std::ffi::c_void {
+    use std::ffi::CStr;
+
+    let name = CStr::from_ptr(name).to_str().expect("name must be valid");
+    match persistent_root(name) {
+        // `AtomicPtr<T>` has the same in-memory representation as `*mut T`.
+        Some(root) => root as *const _ as *mut *mut std::ffi::c_void,
+        None => std::ptr::null_mut(),
+    }
+}
+
+/// Updates the fill level, in percent, at which we start mapping the
+/// next chunk in a background thread.  100 or more disables
+/// background pre-mapping.
+#[no_mangle]
+pub extern "C" fn slitter_set_chunk_premap_threshold(percent: u32) {
+    set_chunk_premap_threshold(percent as usize);
+}
+
+/// Sizes the calling thread's cache for all the classes registered so
+/// far.  See `prepare_thread_cache`.
+#[no_mangle]
+pub extern "C" fn slitter_prepare_thread_cache() {
+    prepare_thread_cache();
+}
+
+/// Returns the calling thread's cached magazines to their classes.
+/// See `flush_thread_cache`.
+#[no_mangle]
+pub extern "C" fn slitter_thread_cache_flush() {
+    flush_thread_cache();
+}
+
+/// Updates the period, in milliseconds, between two scans of the
+/// thread cache scavenger; 0 pauses the scavenger.  See
+/// `set_cache_scavenge_period`.
+#[no_mangle]
+pub extern "C" fn slitter_set_cache_scavenge_period(period_ms: u64) {
+    set_cache_scavenge_period(std::time::Duration::from_millis(period_ms));
+}
+
+/// Prepares `class` for `count` live allocations.  See `Class::warmup`.
+#[no_mangle]
+pub extern "C" fn slitter_class_warmup(class: Class, count: usize) {
+    class.warmup(count);
+}
+
+/// Updates the mean number of bytes each thread allocates between
+/// heap profile samples; 0 disables sampling.
+#[no_mangle]
+pub extern "C" fn slitter_set_heap_sample_interval(bytes: usize) {
+    set_heap_sample_interval(bytes);
+}
+
+/// Writes a pprof-compatible heap profile for `class` to `path`.
+/// Returns 0 on success, and `-errno` on failure.
+///
+/// # Safety
+///
+/// This function assumes `path` is valid.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_class_write_heap_profile(
+    class: Class,
+    path: *const c_char,
+) -> i32 {
+    use std::ffi::CStr;
+
+    const EINVAL: i32 = 22;
+
+    let path = match CStr::from_ptr(path).to_str() {
+        Ok(path) => path,
+        Err(_) => return -EINVAL,
+    };
+
+    let result = std::fs::File::create(path).and_then(|file| {
+        let mut out = std::io::BufWriter::new(file);
+
+        class.write_heap_profile(&mut out)?;
+        std::io::Write::flush(&mut out)
+    });
+
+    match result {
+        Ok(()) => 0,
+        Err(e) => -e.raw_os_error().unwrap_or(EINVAL),
+    }
+}
+
+/// Returns a snapshot of `class`'s statistics.  See `Class::stats`.
+#[no_mangle]
+pub extern "C" fn slitter_class_stats(class: Class) -> ClassStats {
+    class.stats()
+}
+
+/// Lets the OS reclaim pages that only back free objects in
+/// `class`'s depot, except for at least `keep` cached objects.  See
+/// `Class::purge`.
+#[no_mangle]
+pub extern "C" fn slitter_class_purge(class: Class, keep: usize) -> usize {
+    class.purge(keep)
+}
+
+/// Tells the OS that `class`'s pages are cold, or, if `pageout` is
+/// true, that it should reclaim them now.  Returns 0 on success, and
+/// `-errno` on failure.  See `Class::advise_cold`.
+#[no_mangle]
+pub extern "C" fn slitter_class_advise_cold(class: Class, pageout: bool) -> i32 {
+    match class.advise_cold(pageout) {
+        Ok(_) => 0,
+        Err(errno) => -errno,
+    }
+}
+
+/// Returns the number of usable bytes in the allocation at `ptr`, or
+/// 0 if Slitter does not manage `ptr`.  See `usable_size`.
+#[no_mangle]
+pub extern "C" fn slitter_usable_size(ptr: *const std::ffi::c_void) -> usize {
+    usable_size(ptr)
+}
+
+/// Returns a new, empty, arena.  See `Arena`.
+#[no_mangle]
+pub extern "C" fn slitter_arena_create() -> *mut Arena {
+    Box::into_raw(Box::new(Arena::new()))
+}
+
+/// Returns a new allocation for `class`, owned by `arena`.  See
+/// `Arena::allocate`.
+///
+/// # Safety
+///
+/// This function assumes `arena` was returned by
+/// `slitter_arena_create` and not destroyed yet, and that no other
+/// thread is using it.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_arena_allocate(
+    arena: *mut Arena,
+    class: Class,
+) -> *mut std::ffi::c_void {
+    (*arena)
+        .allocate(class)
+        .expect("slitter arena allocation should succeed")
+        .as_ptr()
+}
+
+/// Releases all the allocations in `arena`.  See `Arena::release_all`.
+///
+/// # Safety
+///
+/// This function assumes `arena` was returned by
+/// `slitter_arena_create` and not destroyed yet, and that no other
+/// thread is using it.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_arena_release(arena: *mut Arena) {
+    (*arena).release_all();
+}
+
+/// Releases all the allocations in `arena`, and destroys it.
+///
+/// # Safety
+///
+/// This function assumes `arena` is NULL, or was returned by
+/// `slitter_arena_create` and not destroyed yet.
+#[no_mangle]
+pub unsafe extern "C" fn slitter_arena_destroy(arena: *mut Arena) {
+    if !arena.is_null() {
+        drop(Box::from_raw(arena));
+    }
+}
+
 // TODO: we would like to re-export `slitter_allocate` and
 // `slitter_release`, but cargo won't let us do that.  We
 // can however generate a static archive, which will let
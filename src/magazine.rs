@@ -14,6 +14,10 @@ use contracts::*;
 use disabled_contracts::*;
 
 use std::mem::MaybeUninit;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+use std::time::Duration;
+use std::time::Instant;
 
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
@@ -36,6 +40,7 @@ use crate::press;
 ))]
 use crate::Class;
 
+use crate::inbox::InboxClaim;
 use crate::linear_ref::LinearRef;
 use crate::magazine_impl::MagazineImpl;
 
@@ -120,10 +125,7 @@ impl LocalMagazineCache {
                     panic!("std::mem::swap changed enum");
                 };
 
-                assert_eq!(
-                    storage.num_allocated_slow,
-                    crate::magazine_impl::MAGAZINE_SIZE
-                );
+                assert_eq!(storage.num_allocated_slow as usize, storage.limit());
                 Some(Magazine(MagazineImpl::new(Some(storage))))
             }
         }
@@ -153,6 +155,85 @@ impl LocalMagazineCache {
     }
 }
 
+/// We re-evaluate the magazine limit for a class every time a thread
+/// hits that class's slow path this many times.
+const PACER_PERIOD: u32 = 64;
+
+/// If a thread hits the slow path `PACER_PERIOD` times in less than
+/// this duration, the class's magazines are too small.
+const PACER_GROW_THRESHOLD: Duration = Duration::from_millis(10);
+
+/// If a thread hits the slow path `PACER_PERIOD` times in more than
+/// this duration, the class's magazines are larger than necessary.
+const PACER_SHRINK_THRESHOLD: Duration = Duration::from_secs(1);
+
+/// Each thread-local cache tracks how often it hits the slow path
+/// for each class, and uses that rate to adapt the class's magazine
+/// limit, like the magazine layer in Bonwick and Adams's "Magazines
+/// and Vmem" (2001).  A high slow-path rate means we're transferring
+/// magazines to and from the class's global stacks too often, so we
+/// make magazines fuller.  A low rate means we're caching more
+/// allocations per thread than we need.
+///
+/// The pacer also notices when a thread mostly refills magazines,
+/// like producers in producer/consumer workloads, and claims one of
+/// the class's inboxes for that thread (see `inbox.rs`).
+#[derive(Default)]
+pub struct MagazinePacer {
+    /// Number of slow path calls since the start of the period.
+    slow_path_calls: u32,
+    /// Number of these calls that refilled a magazine.
+    refills: u32,
+    /// When the current period started, if it has started.
+    period_start: Option<Instant>,
+    /// Our claim on one of the class's inboxes, if any.
+    pub inbox: InboxClaim,
+}
+
+impl MagazinePacer {
+    /// Counts one slow path call for `info`, and periodically updates
+    /// the magazine limit for `info`.
+    #[inline(always)]
+    pub fn observe_slow_path(&mut self, info: &crate::class::ClassInfo) {
+        self.slow_path_calls += 1;
+        if self.slow_path_calls >= PACER_PERIOD {
+            self.update(info);
+        }
+    }
+
+    /// Counts one slow path call for `info` that refills a magazine.
+    #[inline(always)]
+    pub fn observe_refill(&mut self, info: &crate::class::ClassInfo) {
+        self.refills += 1;
+        self.observe_slow_path(info);
+    }
+
+    #[cold]
+    fn update(&mut self, info: &crate::class::ClassInfo) {
+        let now = Instant::now();
+        let refills = std::mem::take(&mut self.refills);
+
+        self.slow_path_calls = 0;
+        if let Some(start) = self.period_start.replace(now) {
+            let elapsed = now.saturating_duration_since(start);
+
+            if elapsed < PACER_GROW_THRESHOLD {
+                info.grow_magazine_limit();
+            } else if elapsed > PACER_SHRINK_THRESHOLD {
+                info.shrink_magazine_limit();
+            }
+
+            // Claim an inbox when we hit the slow path regularly,
+            // almost always to refill; give it up when that stops.
+            if elapsed <= PACER_SHRINK_THRESHOLD && refills >= PACER_PERIOD - PACER_PERIOD / 8 {
+                self.inbox.claim(info.id.info());
+            } else if elapsed > PACER_SHRINK_THRESHOLD || refills < PACER_PERIOD / 2 {
+                self.inbox.release();
+            }
+        }
+    }
+}
+
 impl<const PUSH_MAG: bool> Magazine<PUSH_MAG> {
     /// Checks that current object's state is valid.
     ///
@@ -211,6 +292,26 @@ impl<const PUSH_MAG: bool> Magazine<PUSH_MAG> {
     pub fn is_empty(&self) -> bool {
         self.0.is_empty()
     }
+
+    /// Returns the number of allocations in the magazine.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.0.len()
+    }
+
+    /// Returns a slice for the allocations in the magazine.
+    #[inline(always)]
+    pub(crate) fn populated(&self) -> &[MaybeUninit<LinearRef>] {
+        self.0.populated()
+    }
+
+    /// Updates the number of allocations in a full magazine, without
+    /// going under its current contents or over its capacity.
+    #[invariant(self.check_rep(None).is_ok())]
+    #[inline(always)]
+    pub fn set_limit(&mut self, limit: usize) {
+        self.0.set_limit(limit)
+    }
 }
 
 impl Magazine</*PUSH_MAG=*/ true> {
@@ -222,6 +323,14 @@ impl Magazine</*PUSH_MAG=*/ true> {
     pub fn put(&mut self, freed: LinearRef) -> Option<LinearRef> {
         self.0.put(freed)
     }
+
+    /// Moves allocations from the front of `src` into the magazine,
+    /// and returns the number of entries consumed.
+    #[invariant(self.check_rep(None).is_ok())]
+    #[inline(always)]
+    pub fn put_many(&mut self, src: &mut [Option<LinearRef>]) -> usize {
+        self.0.put_many(src)
+    }
 }
 
 impl Magazine</*PUSH_MAG=*/ false> {
@@ -232,9 +341,17 @@ impl Magazine</*PUSH_MAG=*/ false> {
         self.0.get()
     }
 
+    /// Moves allocations from the magazine to the first slots in
+    /// `dst`, and returns the number of slots populated.
+    #[invariant(self.check_rep(None).is_ok())]
+    #[inline(always)]
+    pub fn get_many(&mut self, dst: &mut [Option<LinearRef>]) -> usize {
+        self.0.get_many(dst)
+    }
+
     /// Returns a slice for the used slots in the magazine
     #[inline(always)]
-    fn get_populated(&self) -> &[MaybeUninit<LinearRef>] {
+    pub(crate) fn get_populated(&self) -> &[MaybeUninit<LinearRef>] {
         self.0.get_populated()
     }
 
@@ -250,10 +367,63 @@ impl Magazine</*PUSH_MAG=*/ false> {
     fn commit_populated(&mut self, count: usize) {
         self.0.commit_populated(count)
     }
+
+    /// Returns a slice for the used slots that may not be zero-filled.
+    #[inline(always)]
+    fn get_unzeroed(&self) -> &[MaybeUninit<LinearRef>] {
+        self.0.get_unzeroed()
+    }
+
+    /// Marks all the allocations in the magazine as zero-filled.
+    #[inline(always)]
+    fn mark_zeroed(&mut self) {
+        self.0.mark_zeroed()
+    }
 }
 
+/// The magazine limit for a class changes with this granularity.
+const LIMIT_STEP_DIVISOR: usize = 4;
+
+/// We zero-fill magazines with non-temporal stores when they hold at
+/// least this many bytes of objects to clear, i.e., as much as a
+/// small L2 cache.
+const NON_TEMPORAL_ZERO_BYTES: usize = 256 << 10;
+
 impl crate::class::ClassInfo {
-    /// Returns a cached magazine; it is never empty.
+    /// Returns the current number of allocations in each full
+    /// magazine for this class.
+    #[inline(always)]
+    pub(crate) fn magazine_limit(&self) -> usize {
+        self.magazine_limit.load(Ordering::Relaxed)
+    }
+
+    /// Returns the bounds for `magazine_limit`.
+    fn magazine_limit_range(&self) -> (usize, usize) {
+        (self.min_magazine_limit, self.rack.magazine_size())
+    }
+
+    /// Increases the magazine limit by ~25%, up to the storage capacity.
+    #[ensures(self.magazine_limit() <= self.rack.magazine_size())]
+    pub(crate) fn grow_magazine_limit(&self) {
+        let (_, max) = self.magazine_limit_range();
+
+        update_limit(&self.magazine_limit, |limit| {
+            (limit + (limit / LIMIT_STEP_DIVISOR).max(1)).min(max)
+        });
+    }
+
+    /// Decreases the magazine limit by ~25%, down to the class's minimum.
+    #[ensures(self.magazine_limit() >= self.min_magazine_limit)]
+    pub(crate) fn shrink_magazine_limit(&self) {
+        let (min, _) = self.magazine_limit_range();
+
+        update_limit(&self.magazine_limit, |limit| {
+            limit.saturating_sub((limit / LIMIT_STEP_DIVISOR).max(1)).max(min)
+        });
+    }
+
+    /// Returns a cached magazine, from `cache`, the `inbox` we may
+    /// have claimed, or the depot; it is never empty.
     #[ensures(ret.is_some() -> !ret.as_ref().unwrap().is_empty(),
               "On success, the magazine is non-empty.")]
     #[ensures(ret.is_some() ->
@@ -263,24 +433,60 @@ impl crate::class::ClassInfo {
     pub(crate) fn get_cached_magazine(
         &self,
         cache: &mut LocalMagazineCache,
+        inbox: &InboxClaim,
     ) -> Option<PopMagazine> {
-        // Pop from partial magazines first, because we'd prefer to
-        // have 0 partial mag.
-        let ret = cache
+        // The depot pops from partial magazines first, because we'd
+        // prefer to have 0 partial mag.
+        let mut ret = cache
             .steal_full()
-            .or_else(|| self.partial_mags.try_pop())
-            .or_else(|| self.full_mags.pop())?;
+            .or_else(|| self.take_from_inbox(inbox))
+            .or_else(|| {
+                let mag = self.depot.pop_non_empty()?;
+
+                self.mark_magazine_uncached(&mag);
+                Some(mag)
+            })?;
 
         if self.zero_init {
-            for allocation in ret.get_populated() {
+            self.zero_fill(&mut ret);
+        }
+
+        Some(ret)
+    }
+
+    /// Zero-fills the allocations in `mag` that aren't known to be
+    /// zero already.
+    ///
+    /// We zero whole magazines at once, when they enter a thread
+    /// cache, so large classes can use non-temporal stores: once a
+    /// magazine's worth of zeroing exceeds `NON_TEMPORAL_ZERO_BYTES`,
+    /// regular stores would only evict the rest of the working set,
+    /// and the first objects would be evicted before their use anyway.
+    #[inline(never)]
+    fn zero_fill(&self, mag: &mut PopMagazine) {
+        extern "C" {
+            fn slitter__zero_non_temporal(
+                allocations: *const MaybeUninit<LinearRef>,
+                count: usize,
+                size: usize,
+            );
+        }
+
+        let unzeroed = mag.get_unzeroed();
+        let size = self.layout.size();
+
+        if unzeroed.len() * size >= NON_TEMPORAL_ZERO_BYTES {
+            unsafe { slitter__zero_non_temporal(unzeroed.as_ptr(), unzeroed.len(), size) };
+        } else {
+            for allocation in unzeroed {
                 unsafe {
                     let alloc = &*allocation.as_ptr();
-                    std::ptr::write_bytes(alloc.get().as_ptr() as *mut u8, 0, self.layout.size());
+                    std::ptr::write_bytes(alloc.get().as_ptr() as *mut u8, 0, size);
                 }
             }
         }
 
-        Some(ret)
+        mag.mark_zeroed();
     }
 
     /// Returns a magazine; it may be partially populated or empty.
@@ -292,10 +498,30 @@ impl crate::class::ClassInfo {
         &self,
         cache: &mut LocalMagazineCache,
     ) -> PushMagazine {
-        cache
-            .steal_empty()
-            .or_else(|| self.partial_mags.try_pop())
-            .unwrap_or_else(|| self.rack.allocate_empty_magazine())
+        let mut mag = match cache.steal_empty() {
+            Some(mag) => mag,
+            None => loop {
+                match self.depot.try_pop_partial::<true>() {
+                    Some(mut mag) => {
+                        // The limit may have shrunk below the magazine's
+                        // size since it entered the depot: it's full now.
+                        mag.set_limit(self.magazine_limit());
+                        if mag.is_full() {
+                            self.depot.push_full(mag);
+                            continue;
+                        }
+
+                        self.mark_magazine_uncached(&mag);
+                        break mag;
+                    }
+                    None => break self.rack.allocate_empty_magazine(),
+                }
+            },
+        };
+
+        // Push magazines fill up to the class's current limit.
+        mag.set_limit(self.magazine_limit());
+        mag
     }
 
     /// Attempts to return one allocation and to refill `mag`.
@@ -323,31 +549,45 @@ impl crate::class::ClassInfo {
         &self,
         mag: &mut PopMagazine,
         cache: &mut LocalMagazineCache,
+        pacer: &mut MagazinePacer,
     ) -> Option<LinearRef> {
-        if let Some(mut new_mag) = self.get_cached_magazine(cache) {
+        pacer.observe_refill(self);
+        self.counters.observe_slow_allocation();
+
+        let allocated = if let Some(mut new_mag) = self.get_cached_magazine(cache, &pacer.inbox) {
             assert!(!new_mag.is_empty());
 
             let allocated = new_mag.get();
             std::mem::swap(&mut new_mag, mag);
             self.release_magazine(new_mag, Some(cache));
 
-            return allocated;
-        }
-
-        // Make sure we have capacity for `allocate_many_objects()` to
-        // do something useful.
-        if !mag.has_storage() {
-            // We only enter this branch at most once per thread per
-            // allocation class: the thread cache starts with a dummy
-            // magazine, and we upgrade to a real one here.
-            let mut new_mag = self.rack.allocate_empty_magazine();
-            std::mem::swap(&mut new_mag, mag);
+            allocated
+        } else {
+            // Make sure we have capacity for `allocate_many_objects()` to
+            // do something useful.
+            if !mag.has_storage() {
+                // We only enter this branch at most once per thread per
+                // allocation class: the thread cache starts with a dummy
+                // magazine, and we upgrade to a real one here.
+                let mut new_mag = self.rack.allocate_empty_magazine();
+                std::mem::swap(&mut new_mag, mag);
+
+                self.release_magazine(new_mag, Some(cache));
+            }
 
-            self.release_magazine(new_mag, Some(cache));
+            // Only populate the magazine up to the class's current limit.
+            mag.set_limit(self.magazine_limit());
+            let (count, allocated) = self.press.allocate_many_objects(mag.get_unpopulated());
+            mag.commit_populated(count);
+            // The press only returns zero-filled fresh objects.
+            mag.mark_zeroed();
+            allocated
+        };
+
+        if let Some(allocated) = &allocated {
+            self.maybe_sample_refill(allocated, mag.len());
         }
 
-        let (count, allocated) = self.press.allocate_many_objects(mag.get_unpopulated());
-        mag.commit_populated(count);
         allocated
     }
 
@@ -369,8 +609,12 @@ impl crate::class::ClassInfo {
         &self,
         mag: &mut PushMagazine,
         cache: &mut LocalMagazineCache,
+        pacer: &mut MagazinePacer,
         spilled: LinearRef,
     ) {
+        pacer.observe_slow_path(self);
+        self.counters.observe_slow_release();
+
         let mut new_mag = self.allocate_non_full_magazine(cache);
 
         assert!(!new_mag.is_full());
@@ -380,6 +624,145 @@ impl crate::class::ClassInfo {
         self.release_magazine(new_mag, Some(cache));
     }
 
+    /// Populates a prefix of `dst` with allocations for this class,
+    /// starting with the contents of `mag`, and returns the number
+    /// of slots populated; that number is only less than `dst.len()`
+    /// on OOM.
+    ///
+    /// Small batches refill `mag` as usual.  Large ones instead
+    /// drain entire cached magazines, or bypass magazines and
+    /// allocate directly from the press.
+    #[invariant(mag.check_rep(Some(self.id)).is_ok(),
+               "Magazine must match `self`.")]
+    #[requires(dst.iter().all(|x| x.is_none()),
+               "Destination slots must be empty on entry.")]
+    #[ensures(ret <= dst.len())]
+    #[ensures(dst.iter().take(ret).all(|x| x.is_some()),
+              "Populated slots form a prefix of `dst`.")]
+    #[ensures(dst.iter().skip(ret).all(|x| x.is_none()),
+              "Slots after the prefix are left empty.")]
+    #[ensures(ret < dst.len() -> mag.is_empty(),
+              "We only fail when the magazine is empty.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_allocation_map::can_be_allocated(self.id, x.get()).is_ok()),
+              "Successful allocations are not in use.")]
+    #[ensures(dst.iter().flatten().all(|x| debug_type_map::is_class(self.id, x).is_ok()),
+              "Successful allocations come from an address of the correct class.")]
+    #[ensures(dst.iter().flatten().all(|x| press::check_allocation(self.id, x.get().as_ptr() as usize).is_ok()),
+              "Sucessful allocations must have the allocation metadata set correctly.")]
+    #[inline(never)]
+    pub(crate) fn allocate_many(
+        &self,
+        mag: &mut PopMagazine,
+        cache: &mut LocalMagazineCache,
+        pacer: &mut MagazinePacer,
+        dst: &mut [Option<LinearRef>],
+    ) -> usize {
+        let mut count = mag.get_many(dst);
+
+        while count < dst.len() {
+            let remaining = &mut dst[count..];
+
+            assert!(mag.is_empty());
+            if remaining.len() < self.magazine_limit() {
+                // Small batch: refill `mag`, and consume from there.
+                match self.refill_magazine(mag, cache, pacer) {
+                    Some(allocated) => remaining[0] = Some(allocated),
+                    None => break,
+                }
+
+                count += 1 + mag.get_many(&mut remaining[1..]);
+            } else if let Some(mut full) = self.get_cached_magazine(cache, &pacer.inbox) {
+                // Large batch: drain a whole magazine at once.
+                count += full.get_many(remaining);
+                self.release_magazine(full, Some(cache));
+            } else {
+                // Large batch and nothing cached: go straight to
+                // the press, without going through any magazine.
+                let (first, rest) = remaining.split_first_mut().expect("remaining is non-empty");
+
+                // `Option<LinearRef>` has the same representation as
+                // `LinearRef`, and all the slots in `rest` are `None`,
+                // so the press can overwrite them without leaking
+                // anything.  Any prefix it populates becomes `Some`.
+                let rest = unsafe {
+                    &mut *(rest as *mut [Option<LinearRef>] as *mut [MaybeUninit<LinearRef>])
+                };
+                let (populated, allocated) = self.press.allocate_many_objects(rest);
+
+                match allocated {
+                    Some(allocated) => *first = Some(allocated),
+                    None => break,
+                }
+
+                count += 1 + populated;
+            }
+        }
+
+        count
+    }
+
+    /// Acquires ownership of all the allocations in `blocks`
+    /// (`None` slots are skipped), starting by pushing them in `mag`.
+    ///
+    /// Full magazines are handed to the class's stacks whenever
+    /// `mag` fills up.  On exit, all the slots in `blocks` are `None`.
+    #[invariant(mag.check_rep(Some(self.id)).is_ok(),
+               "Magazine must match `self`.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_allocation_map::has_been_released(self.id, x.get()).is_ok()),
+               "A released block for `class` must have been marked as such.")]
+    #[requires(blocks.iter().flatten().all(|x| debug_type_map::is_class(self.id, x).is_ok()),
+               "Deallocated blocks must match the class of the address range.")]
+    #[requires(blocks.iter().flatten().all(|x| press::check_allocation(self.id, x.get().as_ptr() as usize).is_ok()),
+               "Deallocated block must have the allocation metadata set correctly.")]
+    #[ensures(blocks.iter().all(|x| x.is_none()),
+              "We take ownership of all the blocks.")]
+    #[inline(never)]
+    pub(crate) fn release_many(
+        &self,
+        mag: &mut PushMagazine,
+        cache: &mut LocalMagazineCache,
+        blocks: &mut [Option<LinearRef>],
+    ) {
+        let mut consumed = mag.put_many(blocks);
+
+        while consumed < blocks.len() {
+            let mut new_mag = self.allocate_non_full_magazine(cache);
+
+            assert!(!new_mag.is_full());
+            std::mem::swap(&mut new_mag, mag);
+            self.release_magazine(new_mag, Some(cache));
+
+            consumed += mag.put_many(&mut blocks[consumed..]);
+        }
+    }
+
+    /// Moves `objects`, free objects that never went through a
+    /// thread cache (e.g., fresh from the press), to the class's
+    /// global storage, in magazines of at most `magazine_limit`
+    /// objects.
+    pub(crate) fn release_free_objects(&self, objects: impl IntoIterator<Item = LinearRef>) {
+        let new_magazine = || {
+            let mut mag: PushMagazine = self.rack.allocate_empty_magazine();
+
+            // Partial magazines must stay below the limit, for
+            // `allocate_non_full_magazine`.
+            mag.set_limit(self.magazine_limit());
+            mag
+        };
+
+        let mut mag = new_magazine();
+        for block in objects {
+            if let Some(block) = mag.put(block) {
+                let full = std::mem::replace(&mut mag, new_magazine());
+
+                self.release_magazine(full, None);
+                assert!(mag.put(block).is_none());
+            }
+        }
+
+        self.release_magazine(mag, None);
+    }
+
     /// Acquires ownership of `mag` and its cached allocations.
     #[requires(mag.check_rep(Some(self.id)).is_ok(),
                "Magazine must match `self`.")]
@@ -389,6 +772,17 @@ impl crate::class::ClassInfo {
         mut mag: Magazine<PUSH_MAG>,
         maybe_cache: Option<&mut LocalMagazineCache>,
     ) {
+        // Dummy magazines own nothing.  Bail before the default push
+        // magazine (always "full") looks like it holds objects.
+        if !mag.has_storage() {
+            return;
+        }
+
+        // Push magazines hold newly released objects.
+        if PUSH_MAG {
+            self.observe_release(&mag);
+        }
+
         if let Some(cache) = maybe_cache {
             match cache.populate(mag) {
                 Some(new_mag) => mag = new_mag,
@@ -398,10 +792,63 @@ impl crate::class::ClassInfo {
 
         if mag.is_empty() {
             self.rack.release_empty_magazine(mag);
-        } else if mag.is_full() {
-            self.full_mags.push(mag);
+            return;
+        }
+
+        // Past this point, the objects in `mag` are cached in the
+        // class's inboxes or depot.  This is where we catch double
+        // frees.
+        self.mark_magazine_cached(&mag);
+        if mag.is_full() {
+            // Full magazines of released objects go to threads that
+            // need them most, when we know of any.
+            if PUSH_MAG {
+                match self.deliver_to_inbox(mag) {
+                    Some(undelivered) => mag = undelivered,
+                    None => return,
+                }
+            }
+
+            self.depot.push_full(mag);
         } else {
-            self.partial_mags.push(mag);
+            self.depot.push_partial(mag);
         }
     }
 }
+
+/// Atomically replaces `limit` with `update(limit)`.
+fn update_limit(limit: &AtomicUsize, update: impl Fn(usize) -> usize) {
+    // The closure always returns `Some`, so this can't fail.
+    let _ = limit.fetch_update(Ordering::Relaxed, Ordering::Relaxed, |current| {
+        Some(update(current))
+    });
+}
+
+#[test]
+fn partial_magazine_past_shrunk_limit() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig {
+        magazine_size: Some(8),
+        ..ClassConfig::for_test("partial_past_limit", 16)
+    })
+    .expect("Should build");
+    let info = class.info();
+
+    // One partial magazine of 6 objects...
+    let objects: Vec<_> = (0..6)
+        .map(|_| info.press.allocate_one_object().expect("Should allocate"))
+        .collect();
+    info.release_free_objects(objects);
+    assert_eq!(info.depot.occupancy(), (1, 6));
+
+    // ... is full once the limit shrinks to 4.
+    info.magazine_limit.store(4, Ordering::Relaxed);
+    let mag = info.allocate_non_full_magazine(&mut LocalMagazineCache::Nothing);
+
+    assert!(!mag.is_full());
+    assert!(mag.is_empty());
+    assert_eq!(info.depot.occupancy(), (1, 6));
+    info.release_magazine(mag, None);
+}
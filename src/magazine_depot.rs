@@ -0,0 +1,357 @@
+//! A `MagazineDepot` holds a class's non-empty magazines, sharded by
+//! NUMA node (or, on single-node machines, by CPU) so that threads
+//! on different nodes don't all bounce the same stack head.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
+
+use crate::magazine::Magazine;
+use crate::magazine::PopMagazine;
+use crate::magazine_stack::MagazineStack;
+use crate::map;
+
+/// On single-node machines, we shard by CPU id, in at most this many
+/// shards: past that point, stealing from other shards gets more
+/// expensive than the contention we avoid.
+const MAX_CPU_SHARDS: usize = 4;
+
+/// Each shard lives on its own pair of cache lines, to avoid false
+/// sharing with its neighbours (and with adjacent-line prefetching).
+#[repr(C)]
+#[repr(align(128))]
+struct DepotShard {
+    // Fully populated magazines go in in `full_mags`.
+    full_mags: MagazineStack,
+
+    // Partially populated, but non-empty, magazines go in `partial_mags`.
+    partial_mags: MagazineStack,
+
+    // Number of magazines popped by threads local to this shard,
+    // from this shard and from other shards.
+    local_pops: AtomicU64,
+    remote_pops: AtomicU64,
+
+    // Number of magazines in the shard, and of allocations in these
+    // magazines.  We count before pushing and after popping, so these
+    // never underflow.
+    magazines: AtomicUsize,
+    objects: AtomicUsize,
+}
+
+/// Snapshot of the number of magazines (full or partial) that
+/// threads obtained from their own shard, or stole from another, and
+/// of contention on the shards' stacks.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct DepotStats {
+    pub local_pops: u64,
+    pub remote_pops: u64,
+    /// Number of times a push or pop failed to update a stack.
+    pub cas_failures: u64,
+    /// Number of pushes directly handed over to a concurrent pop.
+    pub eliminations: u64,
+}
+
+pub struct MagazineDepot {
+    shards: Box<[DepotShard]>,
+}
+
+impl DepotShard {
+    fn new() -> Self {
+        Self {
+            full_mags: MagazineStack::new(),
+            partial_mags: MagazineStack::new(),
+            local_pops: AtomicU64::new(0),
+            remote_pops: AtomicU64::new(0),
+            magazines: AtomicUsize::new(0),
+            objects: AtomicUsize::new(0),
+        }
+    }
+
+    #[inline]
+    fn push<const PUSH_MAG: bool>(&self, full: bool, mag: Magazine<PUSH_MAG>) {
+        self.magazines.fetch_add(1, Ordering::Relaxed);
+        self.objects.fetch_add(mag.len(), Ordering::Relaxed);
+
+        if full {
+            self.full_mags.push(mag);
+        } else {
+            self.partial_mags.push(mag);
+        }
+    }
+
+    /// Pops from `full_mags` if `full` is true, and from
+    /// `partial_mags` otherwise.  When `retry` is false, gives up on
+    /// contention.
+    #[inline]
+    fn pop<const PUSH_MAG: bool>(&self, full: bool, retry: bool) -> Option<Magazine<PUSH_MAG>> {
+        let stack = if full {
+            &self.full_mags
+        } else {
+            &self.partial_mags
+        };
+        let ret: Option<Magazine<PUSH_MAG>> = if retry { stack.pop() } else { stack.try_pop() };
+
+        if let Some(mag) = &ret {
+            self.magazines.fetch_sub(1, Ordering::Relaxed);
+            self.objects.fetch_sub(mag.len(), Ordering::Relaxed);
+        }
+
+        ret
+    }
+}
+
+/// Returns the default number of shards for this machine.
+fn default_shard_count() -> usize {
+    let nodes = map::numa_node_count();
+
+    if nodes > 1 {
+        return nodes;
+    }
+
+    std::thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1)
+        .min(MAX_CPU_SHARDS)
+}
+
+impl Default for MagazineDepot {
+    fn default() -> Self {
+        lazy_static::lazy_static! {
+            static ref SHARD_COUNT: usize = default_shard_count();
+        }
+
+        Self::new(*SHARD_COUNT)
+    }
+}
+
+impl MagazineDepot {
+    #[requires(num_shards > 0)]
+    pub fn new(num_shards: usize) -> Self {
+        Self {
+            shards: (0..num_shards).map(|_| DepotShard::new()).collect(),
+        }
+    }
+
+    /// Returns the index of the calling thread's local shard.
+    #[ensures(ret < self.shards.len())]
+    #[inline]
+    fn local_shard_index(&self) -> usize {
+        let n = self.shards.len();
+
+        if n == 1 {
+            return 0;
+        }
+
+        let (cpu, node) = map::current_cpu_and_node().unwrap_or((0, 0));
+        if map::numa_node_count() > 1 {
+            node as usize % n
+        } else {
+            cpu as usize % n
+        }
+    }
+
+    /// Pops a magazine from the calling thread's local shard, via
+    /// `pop_from`, or steals from the other shards in round-robin
+    /// order if the local shard has nothing to offer.
+    #[inline]
+    fn pop_with<const PUSH_MAG: bool>(
+        &self,
+        pop_from: impl Fn(&DepotShard) -> Option<Magazine<PUSH_MAG>>,
+    ) -> Option<Magazine<PUSH_MAG>> {
+        let local_index = self.local_shard_index();
+        let local = &self.shards[local_index];
+
+        if let Some(mag) = pop_from(local) {
+            local.local_pops.fetch_add(1, Ordering::Relaxed);
+            return Some(mag);
+        }
+
+        let n = self.shards.len();
+        for i in 1..n {
+            if let Some(mag) = pop_from(&self.shards[(local_index + i) % n]) {
+                local.remote_pops.fetch_add(1, Ordering::Relaxed);
+                return Some(mag);
+            }
+        }
+
+        None
+    }
+
+    /// Pushes a full magazine to the local shard.
+    #[requires(mag.is_full())]
+    #[inline]
+    pub fn push_full<const PUSH_MAG: bool>(&self, mag: Magazine<PUSH_MAG>) {
+        self.shards[self.local_shard_index()].push(true, mag);
+    }
+
+    /// Pushes a partially populated, but non-empty, magazine to the
+    /// local shard.
+    #[requires(!mag.is_full() && !mag.is_empty())]
+    #[inline]
+    pub fn push_partial<const PUSH_MAG: bool>(&self, mag: Magazine<PUSH_MAG>) {
+        self.shards[self.local_shard_index()].push(false, mag);
+    }
+
+    /// Attempts to pop a partially populated magazine, without
+    /// retrying on contention.
+    #[inline]
+    pub fn try_pop_partial<const PUSH_MAG: bool>(&self) -> Option<Magazine<PUSH_MAG>> {
+        self.pop_with(|shard| shard.pop(false, false))
+    }
+
+    /// Attempts to pop a non-empty magazine, preferring partial
+    /// magazines (we'd rather have 0 partial mag), and then the
+    /// local shard.
+    #[inline]
+    pub fn pop_non_empty(&self) -> Option<PopMagazine> {
+        self.pop_with(|shard| shard.pop(false, false).or_else(|| shard.pop(true, true)))
+    }
+
+    /// Pops every magazine in the depot, partial ones first, without
+    /// updating the shards' stats.  Each magazine comes with the
+    /// index of its shard, for `push_to_shard`.
+    pub fn pop_all(&self) -> Vec<(usize, PopMagazine)> {
+        let mut ret = Vec::new();
+
+        for (index, shard) in self.shards.iter().enumerate() {
+            while let Some(mag) = shard.pop(false, true) {
+                ret.push((index, mag));
+            }
+
+            while let Some(mag) = shard.pop(true, true) {
+                ret.push((index, mag));
+            }
+        }
+
+        ret
+    }
+
+    /// Pushes a non-empty magazine back to the shard `pop_all` found
+    /// it in, rather than the local one: draining the depot mustn't
+    /// migrate magazines between nodes.
+    #[requires(shard < self.shards.len())]
+    #[requires(!mag.is_empty())]
+    pub fn push_to_shard<const PUSH_MAG: bool>(&self, shard: usize, mag: Magazine<PUSH_MAG>) {
+        self.shards[shard].push(mag.is_full(), mag);
+    }
+
+    /// Returns the number of magazines in the depot, and the number
+    /// of allocations in these magazines.
+    pub fn occupancy(&self) -> (usize, usize) {
+        let mut magazines = 0;
+        let mut objects = 0;
+
+        for shard in self.shards.iter() {
+            magazines += shard.magazines.load(Ordering::Relaxed);
+            objects += shard.objects.load(Ordering::Relaxed);
+        }
+
+        (magazines, objects)
+    }
+
+    /// Returns the sum of all the shards' stats.
+    pub fn stats(&self) -> DepotStats {
+        let mut ret: DepotStats = Default::default();
+
+        for shard in self.shards.iter() {
+            ret.local_pops += shard.local_pops.load(Ordering::Relaxed);
+            ret.remote_pops += shard.remote_pops.load(Ordering::Relaxed);
+
+            for stack in [&shard.full_mags, &shard.partial_mags].iter() {
+                ret.cas_failures += stack.cas_failures();
+                ret.eliminations += stack.eliminations();
+            }
+        }
+
+        ret
+    }
+}
+
+#[test]
+fn magazine_depot_steal() {
+    use crate::linear_ref::LinearRef;
+
+    let rack = crate::rack::get_default_rack();
+    let depot = MagazineDepot::new(3);
+
+    assert!(depot.pop_non_empty().is_none());
+
+    // Plant a non-empty magazine in every shard, behind the depot's
+    // back: we can then only get all three by stealing.
+    for shard in depot.shards.iter() {
+        let mut mag = rack.allocate_empty_magazine::<true>();
+
+        assert_eq!(mag.put(LinearRef::from_address(1 << 20)), None);
+        shard.push(false, mag);
+    }
+
+    assert_eq!(depot.occupancy(), (3, 3));
+
+    let mut mags = Vec::new();
+    while let Some(mag) = depot.pop_non_empty() {
+        mags.push(mag);
+    }
+
+    // Unless we migrate between pops, the first pop is local, and
+    // the other two remote.
+    let stats = depot.stats();
+    assert_eq!(mags.len(), 3);
+    assert_eq!(stats.local_pops + stats.remote_pops, 3);
+    assert!(stats.local_pops >= 1);
+    assert_eq!(depot.occupancy(), (0, 0));
+
+    for mut mag in mags {
+        std::mem::forget(mag.get());
+        rack.release_empty_magazine(mag);
+    }
+}
+
+#[test]
+fn magazine_depot_pop_all_keeps_shards() {
+    use crate::linear_ref::LinearRef;
+
+    let rack = crate::rack::get_default_rack();
+    let depot = MagazineDepot::new(3);
+
+    // One magazine in the first shard, two in the last one.
+    for (i, index) in [0, 2, 2].iter().enumerate() {
+        let mut mag = rack.allocate_empty_magazine::<true>();
+
+        assert_eq!(mag.put(LinearRef::from_address((i + 1) << 20)), None);
+        depot.shards[*index].push(false, mag);
+    }
+
+    let mags = depot.pop_all();
+    assert_eq!(depot.occupancy(), (0, 0));
+    assert_eq!(
+        mags.iter().map(|(index, _)| *index).collect::<Vec<_>>(),
+        vec![0, 2, 2]
+    );
+
+    for (index, mag) in mags {
+        depot.push_to_shard(index, mag);
+    }
+
+    let counts: Vec<usize> = depot
+        .shards
+        .iter()
+        .map(|shard| shard.magazines.load(Ordering::Relaxed))
+        .collect();
+    assert_eq!(counts, vec![1, 0, 2]);
+
+    for (_, mut mag) in depot.pop_all() {
+        std::mem::forget(mag.get());
+        rack.release_empty_magazine(mag);
+    }
+}
@@ -19,26 +19,35 @@ use disabled_contracts::*;
 ))]
 use std::ffi::c_void;
 
+use std::alloc::Layout;
 use std::mem::MaybeUninit;
 use std::ptr::NonNull;
 
 use crate::linear_ref::LinearRef;
 
+/// Default magazine capacity, for classes that do not specify one.
 #[cfg(not(feature = "test_only_small_constants"))]
 pub const MAGAZINE_SIZE: u32 = 30;
 
 #[cfg(feature = "test_only_small_constants")]
 pub const MAGAZINE_SIZE: u32 = 6;
 
+/// Magazine capacities are bucketed such that each `MagazineStorage`
+/// (header and allocation array) spans a power-of-two number of
+/// bytes, from 64 bytes (6 allocations) to 4 KB (510 allocations).
+pub const MAGAZINE_SIZE_BUCKETS: [u32; 7] = [6, 14, 30, 62, 126, 254, 510];
+
+/// The largest magazine capacity we support.
+pub const MAX_MAGAZINE_SIZE: u32 = MAGAZINE_SIZE_BUCKETS[MAGAZINE_SIZE_BUCKETS.len() - 1];
+
 /// The `MagazineStorage` is the heap-allocated storage for a
-/// magazine.
+/// magazine.  Storage is variable-length: `allocations` is a
+/// flexible array of `capacity` elements.
 ///
 /// The same struct is available in C as `struct magazine_storage`, in
 /// `mag.h`.
 #[repr(C)]
 pub struct MagazineStorage {
-    allocations: [MaybeUninit<LinearRef>; MAGAZINE_SIZE as usize],
-
     /// Single linked list linkage.
     pub(crate) link: Option<NonNull<MagazineStorage>>,
 
@@ -47,7 +56,23 @@ pub struct MagazineStorage {
     /// remainder are uninitialised.
     ///
     /// This field may not be accurate when wrapped in a `MagazineImpl`.
-    pub(crate) num_allocated_slow: u32,
+    pub(crate) num_allocated_slow: u16,
+
+    /// The number of elements in `allocations`.  This field is
+    /// constant once the storage has been allocated.
+    capacity: u16,
+
+    /// The effective capacity of the magazine, at most `capacity`.
+    /// Push magazines are full once they hold `limit` allocations,
+    /// so this is the base the C fast path uses for push indices.
+    limit: u16,
+
+    /// For zero-initialised classes, the first `num_zeroed`
+    /// allocations are known to be zero-filled.  Only accurate up to
+    /// `num_allocated_slow`: pops may leave it stale.
+    num_zeroed: u16,
+
+    allocations: [MaybeUninit<LinearRef>; 0],
 }
 
 /// The `MagazineImpl` is the actual implementation for the storage.
@@ -61,10 +86,10 @@ pub struct MagazineStorage {
 #[repr(C)]
 pub struct MagazineImpl<const PUSH_MAG: bool> {
     /// "Pop" (PUSH_MAG = false) magazines decrement the `top_of_stack`
-    /// from MAGAZINE_SIZE down to 0.
+    /// from the storage's limit down to 0.
     ///
     /// "Push" (PUSH_MAG = true) magazines increment the `top_of_stack`
-    /// from `-MAGAZINE_SIZE` up to 0.
+    /// from `-limit` up to 0.
     ///
     /// The backing storate expects the opposite direction than the
     /// Push strategy, so we must convert when going in and out of the
@@ -89,9 +114,12 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
             ))]
             assert!(inner.link.is_none());
 
+            // The per-CPU cache pops directly from the storage, and
+            // leaves `num_zeroed` stale.
+            inner.num_zeroed = inner.num_zeroed.min(inner.num_allocated_slow);
             if PUSH_MAG {
                 Self {
-                    top_of_stack: inner.num_allocated_slow as isize - MAGAZINE_SIZE as isize,
+                    top_of_stack: inner.num_allocated_slow as isize - inner.limit as isize,
                     inner: Some(inner),
                 }
             } else {
@@ -115,6 +143,52 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
         self.inner.is_some()
     }
 
+    /// Returns the number of allocations this magazine's storage can
+    /// hold, or 0 if it has no storage.
+    #[cfg(any(test, feature = "check_contracts"))]
+    #[inline(always)]
+    pub fn capacity(&self) -> usize {
+        self.inner
+            .as_ref()
+            .map(|inner| inner.capacity())
+            .unwrap_or(0)
+    }
+
+    /// Returns the number of allocations this magazine holds when
+    /// full, or 0 if it has no storage.
+    #[inline(always)]
+    pub fn limit(&self) -> usize {
+        self.inner
+            .as_ref()
+            .map(|inner| inner.limit as usize)
+            .unwrap_or(0)
+    }
+
+    /// Updates the number of allocations this magazine holds when
+    /// full to `limit`, clamped between the current number of
+    /// allocations and the storage's capacity.
+    #[invariant(self.check_rep())]
+    #[ensures(self.len() == old(self.len()), "The contents are unchanged.")]
+    #[ensures(self.has_storage() -> self.limit() == limit.clamp(self.len(), self.capacity()))]
+    pub fn set_limit(&mut self, limit: usize) {
+        let inner = match self.inner.as_mut() {
+            Some(inner) => inner,
+            None => return,
+        };
+
+        let len = if PUSH_MAG {
+            (inner.limit as isize + self.top_of_stack) as usize
+        } else {
+            self.top_of_stack as usize
+        };
+
+        let new_limit = limit.clamp(len, inner.capacity());
+        inner.limit = new_limit as u16;
+        if PUSH_MAG {
+            self.top_of_stack = len as isize - new_limit as isize;
+        }
+    }
+
     // Disabled postcondition: lifetimes are too hard for contracts.
     // #[requires(self.check_rep())]
     // #[ensures(ret.link.is_none())]
@@ -128,11 +202,13 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
 
         let inner = self.inner?;
         if PUSH_MAG {
-            inner.num_allocated_slow = (MAGAZINE_SIZE as isize + self.top_of_stack) as u32;
+            inner.num_allocated_slow = (inner.limit as isize + self.top_of_stack) as u16;
         } else {
-            inner.num_allocated_slow = self.top_of_stack as u32;
+            inner.num_allocated_slow = self.top_of_stack as u16;
         }
 
+        inner.num_zeroed = inner.num_zeroed.min(inner.num_allocated_slow);
+
         #[cfg(any(
             all(test, feature = "check_contracts_in_tests"),
             feature = "check_contracts"
@@ -147,7 +223,7 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
         if PUSH_MAG {
             self.top_of_stack == 0
         } else {
-            self.top_of_stack == MAGAZINE_SIZE as isize
+            self.has_storage() && self.top_of_stack == self.limit() as isize
         }
     }
 
@@ -155,22 +231,32 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
     #[inline]
     pub fn is_empty(&self) -> bool {
         if PUSH_MAG {
-            self.top_of_stack == -(MAGAZINE_SIZE as isize)
+            self.has_storage() && self.top_of_stack == -(self.limit() as isize)
         } else {
             self.top_of_stack == 0
         }
     }
 
     /// Returns the number of elements in the magazine.
-    #[cfg(any(test, feature = "check_contracts"))]
     pub fn len(&self) -> usize {
         if PUSH_MAG {
-            (self.top_of_stack + MAGAZINE_SIZE as isize) as usize
+            (self.top_of_stack + self.limit() as isize) as usize
         } else {
             self.top_of_stack as usize
         }
     }
 
+    /// Returns a slice for the allocations in the magazine.  Push and
+    /// pop magazines both keep their allocations at low indices.
+    #[inline(always)]
+    pub fn populated(&self) -> &[MaybeUninit<LinearRef>] {
+        if let Some(inner) = &self.inner {
+            &inner.slots()[0..self.len()]
+        } else {
+            &[]
+        }
+    }
+
     /// Returns a reference to the element at `index`.
     ///
     /// Calling this with an index that has no valid value
@@ -180,7 +266,7 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
         feature = "check_contracts"
     ))]
     pub fn nth(&self, index: usize) -> Option<&LinearRef> {
-        Some(unsafe { &*self.inner.as_ref()?.allocations[index].as_ptr() })
+        Some(unsafe { &*self.inner.as_ref()?.slots()[index].as_ptr() })
     }
 
     /// Checks that the current object's state is valid.
@@ -204,16 +290,22 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
             return false;
         }
 
+        // The effective limit can't exceed the physical capacity.
+        if inner.limit as usize > inner.capacity() {
+            return false;
+        }
+
+        let limit = inner.limit as isize;
         if PUSH_MAG {
-            // The top of stack index should be in [-MAGAZINE_SIZE, 0]
+            // The top of stack index should be in [-limit, 0]
             // for Push magazine.
-            if self.top_of_stack < -(MAGAZINE_SIZE as isize) || self.top_of_stack > 0 {
+            if self.top_of_stack < -limit || self.top_of_stack > 0 {
                 return false;
             }
         } else {
-            // The top of stack index should be in [0, MAGAZINE_SIZE]
+            // The top of stack index should be in [0, limit]
             // for Pop magazines.
-            if self.top_of_stack < 0 || self.top_of_stack > MAGAZINE_SIZE as isize {
+            if self.top_of_stack < 0 || self.top_of_stack > limit {
                 return false;
             }
         }
@@ -222,7 +314,7 @@ impl<const PUSH_MAG: bool> MagazineImpl<PUSH_MAG> {
         // non-NULL.  Everything at or after `allocated` is garbage
         // and must not be read.
         inner
-            .allocations
+            .slots()
             .iter()
             .take(self.len())
             .all(|entry| !entry.as_ptr().is_null())
@@ -278,30 +370,95 @@ impl MagazineImpl<true> {
 
         self.top_of_stack += 1;
         unsafe {
-            self.inner
+            let inner = self
+                .inner
                 .as_mut()
-                .expect("non-zero top_of_stack must have a storage")
-                .allocations[(MAGAZINE_SIZE as isize + index) as usize]
+                .expect("non-zero top_of_stack must have a storage");
+            let limit = inner.limit as isize;
+
+            inner.slots_mut()[(limit + index) as usize]
                 .as_mut_ptr()
                 .write(freed);
         }
         None
     }
 
+    /// Moves allocations from the front of `src` into the magazine,
+    /// until the magazine is full or `src` is exhausted.  `None`
+    /// entries are skipped.
+    ///
+    /// Returns the number of entries consumed at the beginning of
+    /// `src`; these entries are all `None` on return.
+    #[invariant(self.check_rep())]
+    #[ensures(ret <= src.len(), "We never consume more than `src`.")]
+    #[ensures(src.iter().take(ret).all(|x| x.is_none()),
+              "Consumed entries are always reset to `None`.")]
+    #[ensures(ret < src.len() -> self.is_full(),
+              "We only stop early when the magazine is full.")]
+    #[inline(always)]
+    pub fn put_many(&mut self, src: &mut [Option<LinearRef>]) -> usize {
+        if cfg!(feature = "c_fast_path") {
+            extern "C" {
+                fn slitter__magazine_put_many(
+                    mag: &mut MagazineImpl<true>,
+                    src: *const Option<LinearRef>,
+                    n: usize,
+                ) -> usize;
+            }
+
+            let consumed = unsafe { slitter__magazine_put_many(self, src.as_ptr(), src.len()) };
+            // The C side copies the pointers, but leaves `src` as is:
+            // ownership has moved to the magazine.
+            for slot in src.iter_mut().take(consumed) {
+                std::mem::forget(slot.take());
+            }
+
+            return consumed;
+        }
+
+        let mut consumed = 0;
+
+        for slot in src.iter_mut() {
+            if self.top_of_stack == 0 {
+                break;
+            }
+
+            if let Some(freed) = slot.take() {
+                let index = self.top_of_stack;
+                let inner = self
+                    .inner
+                    .as_mut()
+                    .expect("non-zero top_of_stack must have a storage");
+                let limit = inner.limit as isize;
+
+                self.top_of_stack += 1;
+                unsafe {
+                    inner.slots_mut()[(limit + index) as usize]
+                        .as_mut_ptr()
+                        .write(freed);
+                }
+            }
+
+            consumed += 1;
+        }
+
+        consumed
+    }
+
     /// Contract-only: returns the pointer at the top of the stack, of NULL if none.
     #[cfg(any(
         all(test, feature = "check_contracts_in_tests"),
         feature = "check_contracts"
     ))]
     fn peek(&self) -> *mut c_void {
-        if self.top_of_stack == -(MAGAZINE_SIZE as isize) {
+        if self.top_of_stack == -(self.limit() as isize) {
             std::ptr::null::<c_void>() as *mut _
         } else {
             unsafe {
                 self.inner
                     .as_ref()
                     .expect("non-zero top_of_stack must have a storage")
-                    .allocations[(MAGAZINE_SIZE as isize + self.top_of_stack) as usize - 1]
+                    .slots()[(self.limit() as isize + self.top_of_stack) as usize - 1]
                     .as_ptr()
                     .as_ref()
             }
@@ -352,17 +509,66 @@ impl MagazineImpl<false> {
                 .inner
                 .as_mut()
                 .expect("non-zero top_of_stack must have a storage")
-                .allocations[self.top_of_stack as usize],
+                .slots_mut()[self.top_of_stack as usize],
         );
         Some(unsafe { old.assume_init() })
     }
 
+    /// Moves up to `dst.len()` allocations from the magazine to the
+    /// first slots in `dst`.
+    ///
+    /// Returns the number of slots populated at the beginning of `dst`.
+    #[invariant(self.check_rep(), "Representation makes sense.")]
+    #[requires(dst.iter().all(|x| x.is_none()),
+               "Destination slots must be empty.")]
+    #[ensures(ret == dst.len().min(old(self.len())),
+              "We populate as many slots as possible.")]
+    #[ensures(self.top_of_stack == old(self.top_of_stack) - ret as isize,
+              "Must remove one element per populated slot.")]
+    #[inline(always)]
+    pub fn get_many(&mut self, dst: &mut [Option<LinearRef>]) -> usize {
+        if cfg!(feature = "c_fast_path") {
+            extern "C" {
+                fn slitter__magazine_get_many(
+                    mag: &mut MagazineImpl<false>,
+                    dst: *mut Option<LinearRef>,
+                    n: usize,
+                ) -> usize;
+            }
+
+            return unsafe { slitter__magazine_get_many(self, dst.as_mut_ptr(), dst.len()) };
+        }
+
+        let count = dst.len().min(self.top_of_stack as usize);
+
+        if count == 0 {
+            return 0;
+        }
+
+        let storage = self
+            .inner
+            .as_mut()
+            .expect("non-zero top_of_stack must have a storage");
+        for slot in dst.iter_mut().take(count) {
+            let mut old = MaybeUninit::uninit();
+
+            self.top_of_stack -= 1;
+            std::mem::swap(
+                &mut old,
+                &mut storage.slots_mut()[self.top_of_stack as usize],
+            );
+            *slot = Some(unsafe { old.assume_init() });
+        }
+
+        count
+    }
+
     /// Returns a slice for the used slots in the magazine
     // No invariant: they confuse the borrow checker.
     #[inline(always)]
     pub fn get_populated(&self) -> &[MaybeUninit<LinearRef>] {
         if let Some(inner) = &self.inner {
-            &inner.allocations[0..self.top_of_stack as usize]
+            &inner.slots()[0..self.top_of_stack as usize]
         } else {
             &[]
         }
@@ -373,7 +579,9 @@ impl MagazineImpl<false> {
     #[inline(always)]
     pub fn get_unpopulated(&mut self) -> &mut [MaybeUninit<LinearRef>] {
         if let Some(inner) = &mut self.inner {
-            &mut inner.allocations[self.top_of_stack as usize..]
+            let limit = inner.limit as usize;
+
+            &mut inner.slots_mut()[self.top_of_stack as usize..limit]
         } else {
             &mut []
         }
@@ -381,12 +589,33 @@ impl MagazineImpl<false> {
 
     /// Marks the first `count` unused slots in the magazine as now populated.
     #[invariant(self.check_rep())]
-    #[requires(count <= MAGAZINE_SIZE as usize - self.top_of_stack as usize)]
+    #[requires(count <= self.limit() - self.top_of_stack as usize)]
     #[inline(always)]
     pub fn commit_populated(&mut self, count: usize) {
         self.top_of_stack += count as isize;
     }
 
+    /// Returns a slice for the used slots in the magazine that may
+    /// not be zero-filled, i.e., those after the known-zero prefix.
+    #[inline(always)]
+    pub fn get_unzeroed(&self) -> &[MaybeUninit<LinearRef>] {
+        if let Some(inner) = &self.inner {
+            let len = self.top_of_stack as usize;
+
+            &inner.slots()[(inner.num_zeroed as usize).min(len)..len]
+        } else {
+            &[]
+        }
+    }
+
+    /// Marks all the allocations in the magazine as zero-filled.
+    #[inline(always)]
+    pub fn mark_zeroed(&mut self) {
+        if let Some(inner) = &mut self.inner {
+            inner.num_zeroed = self.top_of_stack as u16;
+        }
+    }
+
     /// Contract-only: returns the pointer at the top of the stack, of NULL if none.
     #[cfg(any(
         all(test, feature = "check_contracts_in_tests"),
@@ -400,7 +629,7 @@ impl MagazineImpl<false> {
                 self.inner
                     .as_ref()
                     .expect("non-zero top_of_stack must have a storage")
-                    .allocations[self.top_of_stack as usize - 1]
+                    .slots()[self.top_of_stack as usize - 1]
                     .as_ptr()
                     .as_ref()
             }
@@ -411,8 +640,27 @@ impl MagazineImpl<false> {
     }
 }
 
-impl Default for MagazineStorage {
-    fn default() -> Self {
+impl MagazineStorage {
+    /// Returns the layout for a `MagazineStorage` with room for
+    /// `capacity` allocations.
+    fn layout(capacity: u16) -> Layout {
+        let array = Layout::array::<MaybeUninit<LinearRef>>(capacity as usize)
+            .expect("magazine capacity must be reasonable");
+
+        Layout::new::<MagazineStorage>()
+            .extend(array)
+            .expect("magazine capacity must be reasonable")
+            .0
+            .pad_to_align()
+    }
+
+    /// Allocates a new empty `MagazineStorage` for `capacity`
+    /// allocations, with a limit equal to its capacity.  The storage
+    /// is never freed: it is instead recycled by a `Rack`.
+    #[requires(capacity > 0)]
+    #[ensures(ret.capacity() == capacity as usize)]
+    #[ensures(ret.num_allocated_slow == 0)]
+    pub(crate) fn allocate(capacity: u16) -> &'static mut MagazineStorage {
         // Proof that MagazineImpl its constituents are FFI-safe.
         #[allow(dead_code)]
         extern "C" fn unused(
@@ -422,12 +670,51 @@ impl Default for MagazineStorage {
         ) {
         }
 
-        Self {
-            // Safe to leave this as garbage: we never read past
-            // `num_allocated_slow`.
-            allocations: unsafe { MaybeUninit::uninit().assume_init() },
-            link: None,
-            num_allocated_slow: 0,
+        let layout = Self::layout(capacity);
+        let ptr = unsafe { std::alloc::alloc(layout) } as *mut MagazineStorage;
+        if ptr.is_null() {
+            std::alloc::handle_alloc_error(layout);
+        }
+
+        unsafe {
+            // Safe to leave the `allocations` array as garbage: we
+            // never read past `num_allocated_slow`.
+            ptr.write(MagazineStorage {
+                link: None,
+                num_allocated_slow: 0,
+                capacity,
+                limit: capacity,
+                num_zeroed: 0,
+                allocations: [],
+            });
+            &mut *ptr
+        }
+    }
+
+    /// Returns the number of elements in the `allocations` array.
+    #[inline(always)]
+    pub fn capacity(&self) -> usize {
+        self.capacity as usize
+    }
+
+    /// Returns the number of allocations in a full magazine.
+    #[inline(always)]
+    pub fn limit(&self) -> usize {
+        self.limit as usize
+    }
+
+    /// Returns the `allocations` array, with all its `capacity` slots.
+    #[inline(always)]
+    fn slots(&self) -> &[MaybeUninit<LinearRef>] {
+        // `allocate` always reserves `capacity` elements after
+        // the header.
+        unsafe { std::slice::from_raw_parts(self.allocations.as_ptr(), self.capacity as usize) }
+    }
+
+    #[inline(always)]
+    fn slots_mut(&mut self) -> &mut [MaybeUninit<LinearRef>] {
+        unsafe {
+            std::slice::from_raw_parts_mut(self.allocations.as_mut_ptr(), self.capacity as usize)
         }
     }
 }
@@ -526,3 +813,128 @@ fn magazine_fill_up() {
 
     rack.release_empty_magazine(crate::magazine::Magazine(pop_mag));
 }
+
+#[test]
+fn magazine_batch_fill_up() {
+    let rack = crate::rack::get_default_rack();
+    let mut mag = rack.allocate_empty_magazine::</*PUSH_MAG=*/true>().0;
+
+    // One more than what the magazine can hold, with a hole.
+    let mut src: Vec<Option<LinearRef>> = (1..=MAGAZINE_SIZE as usize + 2)
+        .map(|i| {
+            if i == 2 {
+                None
+            } else {
+                Some(LinearRef::from_address(i))
+            }
+        })
+        .collect();
+
+    assert_eq!(mag.put_many(&mut src), MAGAZINE_SIZE as usize + 1);
+    assert!(mag.is_full());
+    assert!(src.iter().take(MAGAZINE_SIZE as usize + 1).all(|x| x.is_none()));
+
+    // The last entry didn't fit.
+    let leftover = src.pop().unwrap().expect("should not have been consumed");
+    assert_eq!(leftover.get().as_ptr() as usize, MAGAZINE_SIZE as usize + 2);
+    std::mem::forget(leftover);
+
+    let mut pop_mag = mag.into_pop();
+    let mut dst: Vec<Option<LinearRef>> = (0..MAGAZINE_SIZE as usize + 1).map(|_| None).collect();
+
+    assert_eq!(pop_mag.get_many(&mut dst[0..1]), 1);
+    assert_eq!(pop_mag.get_many(&mut dst[1..]), MAGAZINE_SIZE as usize - 1);
+    assert!(pop_mag.is_empty());
+    assert!(dst[MAGAZINE_SIZE as usize].is_none());
+
+    let mut addresses: Vec<usize> = dst
+        .into_iter()
+        .flatten()
+        .map(|x| x.convert_to_non_null().as_ptr() as usize)
+        .collect();
+    addresses.sort_unstable();
+
+    let expected: Vec<usize> = (1..=MAGAZINE_SIZE as usize + 1).filter(|i| *i != 2).collect();
+    assert_eq!(addresses, expected);
+
+    rack.release_empty_magazine(crate::magazine::Magazine(pop_mag));
+}
+
+#[test]
+fn magazine_limit() {
+    let rack = crate::rack::get_default_rack();
+    let mut mag = rack.allocate_empty_magazine::</*PUSH_MAG=*/true>().0;
+
+    assert_eq!(mag.limit(), MAGAZINE_SIZE as usize);
+    mag.set_limit(2);
+    assert_eq!(mag.limit(), 2);
+
+    // The push magazine is now full after two allocations.
+    assert_eq!(mag.put(LinearRef::from_address(1)), None);
+    assert_eq!(mag.put(LinearRef::from_address(2)), None);
+    assert!(mag.is_full());
+
+    let failed_insert = mag.put(LinearRef::from_address(3)).expect("should fail");
+    std::mem::forget(failed_insert);
+
+    // We can't go under the current contents, nor over capacity.
+    mag.set_limit(1);
+    assert_eq!(mag.limit(), 2);
+    mag.set_limit(usize::MAX);
+    assert_eq!(mag.limit(), MAGAZINE_SIZE as usize);
+    assert_eq!(mag.len(), 2);
+    assert!(!mag.is_full());
+
+    let mut pop_mag = mag.into_pop();
+    for expected in [2usize, 1].iter() {
+        let popped = pop_mag.get().expect("has value");
+        assert_eq!(popped.get().as_ptr() as usize, *expected);
+        std::mem::forget(popped);
+    }
+
+    rack.release_empty_magazine(crate::magazine::Magazine(pop_mag));
+}
+
+#[test]
+fn magazine_known_zero_prefix() {
+    let rack = crate::rack::get_default_rack();
+    let mut mag = rack.allocate_empty_magazine::</*PUSH_MAG=*/false>().0;
+
+    assert_eq!(mag.get_unzeroed().len(), 0);
+
+    let mut push_mag = mag.into_push();
+    assert_eq!(push_mag.put(LinearRef::from_address(1)), None);
+    assert_eq!(push_mag.put(LinearRef::from_address(2)), None);
+
+    mag = push_mag.into_pop();
+    assert_eq!(mag.get_unzeroed().len(), 2);
+    mag.mark_zeroed();
+    assert_eq!(mag.get_unzeroed().len(), 0);
+
+    // Releases after the zeroed prefix must be zeroed again.
+    let mut push_mag = mag.into_push();
+    assert_eq!(push_mag.put(LinearRef::from_address(3)), None);
+
+    mag = push_mag.into_pop();
+    assert_eq!(mag.get_unzeroed().len(), 1);
+
+    // Popping under the prefix shrinks it.
+    for _ in 0..2 {
+        std::mem::forget(mag.get().expect("has value"));
+    }
+
+    mag = mag.into_push().into_pop();
+    assert_eq!(mag.len(), 1);
+    assert_eq!(mag.get_unzeroed().len(), 0);
+
+    let mut push_mag = mag.into_push();
+    assert_eq!(push_mag.put(LinearRef::from_address(4)), None);
+
+    mag = push_mag.into_pop();
+    assert_eq!(mag.get_unzeroed().len(), 1);
+    for _ in 0..2 {
+        std::mem::forget(mag.get().expect("has value"));
+    }
+
+    rack.release_empty_magazine(crate::magazine::Magazine(mag));
+}
@@ -1,5 +1,9 @@
 //! A `MagazineStack` is a thread-safe single-linked intrusive stack
 //! of magazines.
+//!
+//! Under contention, the C implementation backs off exponentially,
+//! and pairs up concurrent pushes and pops in an elimination array.
+//! Each stack counts its CAS failures and eliminated pushes.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -14,6 +18,7 @@ use disabled_contracts::*;
 use std::mem::MaybeUninit;
 use std::ptr::NonNull;
 use std::sync::atomic::AtomicPtr;
+use std::sync::atomic::AtomicU64;
 use std::sync::atomic::AtomicUsize;
 use std::sync::atomic::Ordering;
 
@@ -27,10 +32,20 @@ use crate::magazine_impl::MagazineStorage;
 /// `Rack`s never free them, and simply cache empty magazines in
 /// a `MagazineStack`.
 #[repr(C)]
-#[repr(align(16))]
+#[repr(align(64))]
 pub struct MagazineStack {
     top_of_stack: AtomicPtr<MagazineStorage>,
     generation: AtomicUsize,
+    stats: StackStats,
+}
+
+/// The statistics live on their own cache line, away from the
+/// contended top of stack.
+#[repr(C)]
+#[repr(align(64))]
+struct StackStats {
+    cas_failures: AtomicU64,
+    eliminations: AtomicU64,
 }
 
 // These are declared in stack.h
@@ -48,9 +63,27 @@ impl MagazineStack {
         Self {
             top_of_stack: Default::default(),
             generation: AtomicUsize::new(0),
+            stats: StackStats {
+                cas_failures: AtomicU64::new(0),
+                eliminations: AtomicU64::new(0),
+            },
         }
     }
 
+    /// Returns the number of times an operation on this stack failed
+    /// to update its top because of contention.
+    #[inline]
+    pub fn cas_failures(&self) -> u64 {
+        self.stats.cas_failures.load(Ordering::Relaxed)
+    }
+
+    /// Returns the number of pushes that were directly handed over
+    /// to a concurrent pop, without going through the stack.
+    #[inline]
+    pub fn eliminations(&self) -> u64 {
+        self.stats.eliminations.load(Ordering::Relaxed)
+    }
+
     #[requires(mag.check_rep(None).is_ok(),
                "Magazine must make sense.")]
     #[inline(always)]
@@ -123,3 +156,49 @@ fn magazine_stack_smoke_test() {
 
     assert!(stack.pop::<true>().is_none());
 }
+
+#[test]
+fn magazine_stack_contention_test() {
+    use std::sync::Arc;
+
+    const NUM_THREADS: usize = 4;
+    const MAGS_PER_THREAD: usize = 4;
+
+    let stack = Arc::new(MagazineStack::new());
+    let barrier = Arc::new(std::sync::Barrier::new(NUM_THREADS));
+    let workers: Vec<_> = (0..NUM_THREADS)
+        .map(|_| {
+            let stack = stack.clone();
+            let barrier = barrier.clone();
+
+            std::thread::spawn(move || {
+                let rack = crate::rack::get_default_rack();
+
+                for _ in 0..MAGS_PER_THREAD {
+                    stack.push(rack.allocate_empty_magazine::<true>());
+                }
+
+                // Every pop follows a push, so pops never fail.
+                barrier.wait();
+                for _ in 0..100_000 {
+                    let mag = stack.pop::<false>().expect("must pop");
+                    stack.push(mag);
+                }
+            })
+        })
+        .collect();
+
+    for worker in workers {
+        worker.join().expect("Thread should succeed");
+    }
+
+    // We must find all the magazines we pushed, exactly once.
+    let rack = crate::rack::get_default_rack();
+    let mut count = 0;
+    while let Some(mag) = stack.pop::<true>() {
+        rack.release_empty_magazine(mag);
+        count += 1;
+    }
+
+    assert_eq!(count, NUM_THREADS * MAGS_PER_THREAD);
+}
@@ -1,21 +1,35 @@
 //! Rust bindings for the support code in C that calls out to mmap.
 //!
 //! TODO: wrap strerror_r usefully.
+use std::convert::TryFrom;
 use std::ptr::NonNull;
 use std::{ffi::c_void, fs::File};
 
 // These helpers are declared in `c/map.h`.
 extern "C" {
     fn slitter__page_size() -> i64;
+    fn slitter__getcpu(OUT_cpu: *mut u32, OUT_node: *mut u32) -> i32;
     fn slitter__reserve_region(size: usize, OUT_errno: *mut i32) -> Option<NonNull<c_void>>;
+    fn slitter__reserve_fixed_region(base: NonNull<c_void>, size: usize) -> i32;
     fn slitter__release_region(base: NonNull<c_void>, size: usize) -> i32;
-    fn slitter__allocate_region(base: NonNull<c_void>, size: usize) -> i32;
+    fn slitter__allocate_region(base: NonNull<c_void>, size: usize, node: i32) -> i32;
+    fn slitter__allocate_huge_region(
+        base: NonNull<c_void>,
+        size: usize,
+        node: i32,
+        hugetlb: bool,
+    ) -> i32;
     fn slitter__allocate_fd_region(
         fd: i32,
         offset: usize,
         base: NonNull<c_void>,
         size: usize,
+        node: i32,
     ) -> i32;
+    fn slitter__populate_region(base: NonNull<c_void>, size: usize) -> i32;
+    fn slitter__purge_region(base: NonNull<c_void>, size: usize) -> i32;
+    fn slitter__punch_fd_region(fd: i32, offset: usize, size: usize) -> i32;
+    fn slitter__advise_cold_region(base: NonNull<c_void>, size: usize, pageout: bool) -> i32;
 }
 
 fn page_size_or_die() -> usize {
@@ -38,6 +52,42 @@ pub fn page_size() -> usize {
     *PAGE_SIZE
 }
 
+/// Returns the number of NUMA nodes on this machine, according to
+/// `/sys/devices/system/node/possible`, or 1 if we can't tell.
+pub fn numa_node_count() -> usize {
+    fn count_nodes() -> Option<usize> {
+        let possible = std::fs::read_to_string("/sys/devices/system/node/possible").ok()?;
+        let mut max_node = 0;
+
+        // The file lists ranges like "0-3,8".
+        for range in possible.trim().split(',') {
+            let last = range.rsplit('-').next()?;
+            max_node = max_node.max(last.parse::<usize>().ok()?);
+        }
+
+        Some(max_node + 1)
+    }
+
+    lazy_static::lazy_static! {
+        static ref NUMA_NODE_COUNT: usize = count_nodes().unwrap_or(1);
+    }
+
+    *NUMA_NODE_COUNT
+}
+
+/// Returns the calling thread's current CPU and NUMA node, or
+/// `None` if the system can't tell us.
+pub fn current_cpu_and_node() -> Option<(u32, u32)> {
+    let mut cpu = 0;
+    let mut node = 0;
+
+    if unsafe { slitter__getcpu(&mut cpu, &mut node) } == 0 {
+        Some((cpu, node))
+    } else {
+        None
+    }
+}
+
 /// Attempts to reserve an *address space* region of `size` bytes.
 ///
 /// The `size` argument must be a multiple of the page size.
@@ -58,6 +108,27 @@ pub fn reserve_region(size: usize) -> Result<NonNull<c_void>, i32> {
     }
 }
 
+/// Attempts to reserve the *address space* region of `size` bytes
+/// at `base`, exactly.
+///
+/// The `base` and `size` arguments must be multiples of the page size.
+pub fn reserve_fixed_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+    assert!(
+        size > 0 && (size % page_size()) == 0 && (base.as_ptr() as usize % page_size()) == 0,
+        "Bad region base={:?} size={} page_size={}",
+        base,
+        size,
+        page_size()
+    );
+
+    let ret = unsafe { slitter__reserve_fixed_region(base, size) };
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
 /// Releases a region of `size` bytes starting at `base`.
 ///
 /// The size argument must be a multiple of the page size.
@@ -82,11 +153,17 @@ pub fn release_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
     }
 }
 
+/// Converts an optional NUMA node to the C side's representation,
+/// where negative values mean no preference.
+fn node_or_negative(node: Option<u32>) -> i32 {
+    node.and_then(|n| i32::try_from(n).ok()).unwrap_or(-1)
+}
+
 /// Backs a region of `size` bytes starting at `base` with
-/// (demand-faulted) memory.
+/// (demand-faulted) memory, preferably from NUMA `node`.
 ///
 /// The size argument must be a multiple of the page size.
-pub fn allocate_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+pub fn allocate_region(base: NonNull<c_void>, size: usize, node: Option<u32>) -> Result<(), i32> {
     if size == 0 {
         return Ok(());
     }
@@ -98,7 +175,7 @@ pub fn allocate_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
         page_size()
     );
 
-    let ret = unsafe { slitter__allocate_region(base, size) };
+    let ret = unsafe { slitter__allocate_region(base, size, node_or_negative(node)) };
 
     if ret == 0 {
         Ok(())
@@ -108,20 +185,144 @@ pub fn allocate_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
 }
 
 /// Backs a region of `size` bytes starting at `base` with
-/// (demand-faulted) memory from `file`.  The `file` must be empty on
-/// entry.
+/// (demand-faulted) memory, preferably from NUMA `node`, and
+/// preferably with huge pages.
+///
+/// When `hugetlb` is true, we first try to use explicit huge pages
+/// (`MAP_HUGETLB`), and otherwise fall back to transparent huge pages
+/// (`MADV_HUGEPAGE`).
 ///
 /// The size argument must be a multiple of the page size.
-pub fn allocate_file_region(file: File, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
-    use std::os::unix::io::FromRawFd;
-    use std::os::unix::io::IntoRawFd;
-
-    assert_eq!(
-        file.metadata().expect("has metadata").len(),
-        0,
-        "The file must be empty on entry"
+pub fn allocate_huge_region(
+    base: NonNull<c_void>,
+    size: usize,
+    node: Option<u32>,
+    hugetlb: bool,
+) -> Result<(), i32> {
+    if size == 0 {
+        return Ok(());
+    }
+
+    assert!(
+        (size % page_size()) == 0,
+        "Bad region size={} page_size={}",
+        size,
+        page_size()
     );
 
+    let ret = unsafe { slitter__allocate_huge_region(base, size, node_or_negative(node), hugetlb) };
+
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
+/// Backs a region of `size` bytes starting at `base` with
+/// (demand-faulted) shared memory from the `size` bytes at `offset`
+/// in `file`, preferably from NUMA `node`.  The `file` must be at
+/// least `offset + size` bytes long.
+///
+/// The offset and size arguments must be multiples of the page size.
+pub fn allocate_file_region(
+    file: &File,
+    offset: usize,
+    base: NonNull<c_void>,
+    size: usize,
+    node: Option<u32>,
+) -> Result<(), i32> {
+    use std::os::unix::io::AsRawFd;
+
+    if size == 0 {
+        return Ok(());
+    }
+
+    assert!(
+        (size % page_size()) == 0 && (offset % page_size()) == 0,
+        "Bad region offset={} size={} page_size={}",
+        offset,
+        size,
+        page_size()
+    );
+    assert!(
+        file.metadata().expect("has metadata").len() >= (offset + size) as u64,
+        "The file must cover the region"
+    );
+
+    let ret = unsafe {
+        slitter__allocate_fd_region(file.as_raw_fd(), offset, base, size, node_or_negative(node))
+    };
+
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
+/// Deallocates the `size` bytes at `offset` in `file`, without
+/// changing the file's size.  Shared mappings of that range read back
+/// as zeros.
+///
+/// The offset and size arguments must be multiples of the page size.
+pub fn punch_file_region(file: &File, offset: usize, size: usize) -> Result<(), i32> {
+    use std::os::unix::io::AsRawFd;
+
+    if size == 0 {
+        return Ok(());
+    }
+
+    assert!(
+        (size % page_size()) == 0 && (offset % page_size()) == 0,
+        "Bad region offset={} size={} page_size={}",
+        offset,
+        size,
+        page_size()
+    );
+
+    let ret = unsafe { slitter__punch_fd_region(file.as_raw_fd(), offset, size) };
+
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
+/// Populates the pages of an already backed region of `size` bytes
+/// starting at `base`, as if they had been written to.  The region's
+/// contents do not change, even if other threads concurrently access
+/// it.
+///
+/// The size argument must be a multiple of the page size.
+pub fn populate_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+    if size == 0 {
+        return Ok(());
+    }
+
+    assert!(
+        (size % page_size()) == 0,
+        "Bad region size={} page_size={}",
+        size,
+        page_size()
+    );
+
+    let ret = unsafe { slitter__populate_region(base, size) };
+
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
+/// Lets the kernel reclaim the pages in the region of `size` bytes
+/// starting at `base`.  The region stays mapped, but its contents
+/// become undefined (either zero or the old contents, page by page).
+///
+/// The size argument must be a multiple of the page size.
+pub fn purge_region(base: NonNull<c_void>, size: usize) -> Result<(), i32> {
     if size == 0 {
         return Ok(());
     }
@@ -133,12 +334,34 @@ pub fn allocate_file_region(file: File, base: NonNull<c_void>, size: usize) -> R
         page_size()
     );
 
-    file.set_len(size as u64).map_err(|_| 0)?;
-    let fd = file.into_raw_fd();
-    let ret = unsafe { slitter__allocate_fd_region(fd, 0, base, size) };
+    let ret = unsafe { slitter__purge_region(base, size) };
+
+    if ret == 0 {
+        Ok(())
+    } else {
+        Err(-ret)
+    }
+}
+
+/// Tells the kernel that the pages in the region of `size` bytes
+/// starting at `base` are cold (`MADV_COLD`), or, if `pageout` is
+/// true, asks it to reclaim them now (`MADV_PAGEOUT`).  The region's
+/// contents do not change.
+///
+/// The size argument must be a multiple of the page size.
+pub fn advise_cold_region(base: NonNull<c_void>, size: usize, pageout: bool) -> Result<(), i32> {
+    if size == 0 {
+        return Ok(());
+    }
 
-    // Make sure to drop the file before returning.
-    unsafe { File::from_raw_fd(fd) };
+    assert!(
+        (size % page_size()) == 0,
+        "Bad region size={} page_size={}",
+        size,
+        page_size()
+    );
+
+    let ret = unsafe { slitter__advise_cold_region(base, size, pageout) };
 
     if ret == 0 {
         Ok(())
@@ -155,6 +378,13 @@ fn test_page_size() {
     assert_eq!(page_size(), 4096);
 }
 
+#[test]
+fn test_numa_topology() {
+    let (_cpu, node) = current_cpu_and_node().expect("getcpu should succeed");
+
+    assert!((node as usize) < numa_node_count());
+}
+
 // Simulate a data + metadata allocation workflow: overallocate, trim
 // the slop, and ask for real memory in some of the remaining space.
 #[test]
@@ -183,8 +413,14 @@ fn smoke_test() {
         .expect("Should be non-null");
 
     // Start by allocating the bottom and remainder regions.
-    allocate_region(bottom, page_size()).expect("should allocate bottom");
-    allocate_region(remainder, region_size - 2 * page_size()).expect("should allocate remainder");
+    allocate_region(bottom, page_size(), None).expect("should allocate bottom");
+    // Node 0 always exists.
+    allocate_region(remainder, region_size - 2 * page_size(), Some(0))
+        .expect("should allocate remainder");
+    populate_region(remainder, region_size - 2 * page_size()).expect("should populate remainder");
+    purge_region(remainder, region_size - 2 * page_size()).expect("should purge remainder");
+    advise_cold_region(remainder, region_size - 2 * page_size(), false)
+        .expect("should advise the remainder is cold");
 
     // And now release everything.
     release_region(base, region_size).expect("should release everything");
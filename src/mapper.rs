@@ -23,6 +23,9 @@ use std::sync::Mutex;
 ))]
 use crate::debug_arange_map;
 
+use crate::huge_page_mapper::HugePageMapper;
+use crate::huge_page_mapper::HugePagePolicy;
+
 pub use crate::mill::GUARD_PAGE_SIZE;
 
 #[allow(clippy::inline_fn_without_body)]
@@ -89,10 +92,43 @@ pub trait Mapper: std::fmt::Debug + Sync {
     /// write access.  The `allocate`d range is always a subset of a
     /// range that was returned by a single `reserve` call.
     ///
+    /// When `node` is `Some`, the range should preferably be backed
+    /// by memory from that NUMA node.  That's only a hint: mappers
+    /// may ignore it.
+    ///
     /// On successful return, the range must be zero-filled.
     #[requires(debug_arange_map::can_mark_data(base.as_ptr() as usize, size).is_ok())]
     #[ensures(ret.is_ok() -> debug_arange_map::mark_data(base.as_ptr() as usize, size).is_ok())]
-    fn allocate_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32>;
+    fn allocate_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        node: Option<u32>,
+    ) -> Result<(), i32>;
+
+    /// Lets the operating system reclaim the memory behind a
+    /// page-aligned range of object data, which only contains free
+    /// objects.  The range must remain mapped, with undefined
+    /// contents.
+    ///
+    /// Purging is only an optimisation: mappers that can't do it
+    /// should return `Err`.  The default implementation assumes
+    /// regular private mappings, and uses `MADV_FREE`.
+    fn purge_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        crate::map::purge_region(base, size)
+    }
+
+    /// Tells the operating system that a page-aligned range of object
+    /// data is cold, and should be reclaimed (e.g., swapped out to
+    /// the backing file) before hotter memory.  When `pageout` is
+    /// true, the range should be reclaimed right away.  The contents
+    /// of the range must not change.
+    ///
+    /// Like purging, this is only a hint.  The default implementation
+    /// uses `MADV_COLD` and `MADV_PAGEOUT`.
+    fn advise_cold_data(&self, base: NonNull<c_void>, size: usize, pageout: bool) -> Result<(), i32> {
+        crate::map::advise_cold_region(base, size, pageout)
+    }
 }
 
 #[derive(Debug)]
@@ -102,7 +138,9 @@ lazy_static::lazy_static! {
     static ref NAMED_MAPPERS: Mutex<HashMap<String, &'static dyn Mapper>> = {
         let mut map: HashMap<String, &'static dyn Mapper> = HashMap::new();
 
-        map.insert("file".to_string(), Box::leak(Box::new(crate::file_backed_mapper::FileBackedMapper{})));
+        map.insert("file".to_string(), Box::leak(Box::new(crate::file_backed_mapper::FileBackedMapper::default())));
+        map.insert("thp".to_string(), Box::leak(Box::new(HugePageMapper::new(HugePagePolicy::Transparent))));
+        map.insert("hugetlb".to_string(), Box::leak(Box::new(HugePageMapper::new(HugePagePolicy::HugeTlb))));
         Mutex::new(map)
     };
 }
@@ -157,10 +195,15 @@ impl Mapper for DefaultMapper {
     }
 
     fn allocate_meta(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
-        crate::map::allocate_region(base, size)
+        crate::map::allocate_region(base, size, None)
     }
 
-    fn allocate_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
-        crate::map::allocate_region(base, size)
+    fn allocate_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        node: Option<u32>,
+    ) -> Result<(), i32> {
+        crate::map::allocate_region(base, size, node)
     }
 }
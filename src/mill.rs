@@ -11,12 +11,31 @@
 //!
 //! | guard | meta | guard | data ... data | guard |
 //!
-//! where the guard and meta(data) regions are 2 MB each, and the
-//! data is 1 GB, aligned to 1 GB.
+//! where the guard regions are 2 MB each, the meta(data) region 18 MB
+//! (2 MB of span metadata, and a 16 MB free bitmap), and the data is
+//! 1 GB, aligned to 1 GB.
 //!
 //! Each chunk is divided 64 K spans of 16 KB each.  Each span is
 //! associated with a metadata object in the parallel flat array that
 //! lives in the metadata range.
+//!
+//! On NUMA machines, each `Mill` owns one current chunk per node, and
+//! asks its `Mapper` to back that chunk with memory from that node.
+//! Spans go to the chunk for the caller's current node, so a
+//! `Press` refilled on a node gets memory local to that node.
+//!
+//! Mapping a new chunk is slow, so, once the current chunk is
+//! `set_chunk_premap_threshold` percent full, a background thread
+//! maps the next chunk ahead of time; switching to that chunk is then
+//! only a pointer swap.
+//!
+//! When the current chunk doesn't have enough spans left for a
+//! request, we still switch to a new chunk, but first save the
+//! leftover tail of the old chunk in a size-segregated index.  Later
+//! requests that fit in one of these tails (e.g., presses for small
+//! classes) carve their spans from that tail instead of from the
+//! current chunk, so we don't waste the address space and metadata
+//! at the end of chunks.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -33,7 +52,10 @@ use std::ffi::c_void;
 use std::num::NonZeroU32;
 use std::num::NonZeroUsize;
 use std::ptr::NonNull;
+use std::sync::atomic::AtomicBool;
+use std::sync::atomic::AtomicU64;
 use std::sync::atomic::AtomicUsize;
+use std::sync::atomic::Ordering;
 use std::sync::Mutex;
 
 #[cfg(any(
@@ -46,13 +68,15 @@ use crate::mapper::Mapper;
 
 /// Data chunks are naturally aligned to their size, 1GB.
 #[cfg(not(feature = "test_only_small_constants"))]
-const DATA_ALIGNMENT: usize = 1 << 30;
+pub const DATA_ALIGNMENT: usize = 1 << 30;
 /// We use 2 MB sizes to enable huge pages.  3 guard superpages + 1
 /// metadata superpage per chunk is still less than 1% overhead.
+/// The metadata region also holds the 16 MB free bitmap, which is
+/// only backed by memory as objects are freed.
 #[cfg(not(feature = "test_only_small_constants"))]
 pub const GUARD_PAGE_SIZE: usize = 2 << 20;
 #[cfg(not(feature = "test_only_small_constants"))]
-const METADATA_PAGE_SIZE: usize = 2 << 20;
+pub const METADATA_PAGE_SIZE: usize = (2 << 20) + FREE_BITMAP_SIZE;
 
 /// Spans are aligned to 16 KB, within the chunk.
 #[cfg(not(feature = "test_only_small_constants"))]
@@ -62,18 +86,26 @@ pub const SPAN_ALIGNMENT: usize = 16 << 10;
 // up the metadata page size a little, since we also
 // want a smaller span alignment (and the metadata
 // array must include one entry per potential span).
-// Keep `GUARD_PAGE_SIZE` equal to `METADATA_PAGE_SIZE`
-// to better match production.
+// Keep `GUARD_PAGE_SIZE` equal to the size of the metadata
+// array to better match production.
 #[cfg(feature = "test_only_small_constants")]
-const DATA_ALIGNMENT: usize = 2 << 20;
+pub const DATA_ALIGNMENT: usize = 2 << 20;
 #[cfg(feature = "test_only_small_constants")]
 pub const GUARD_PAGE_SIZE: usize = 16 << 10;
 #[cfg(feature = "test_only_small_constants")]
-const METADATA_PAGE_SIZE: usize = 16 << 10;
+pub const METADATA_PAGE_SIZE: usize = (16 << 10) + FREE_BITMAP_SIZE;
 
 #[cfg(feature = "test_only_small_constants")]
 pub const SPAN_ALIGNMENT: usize = 4 << 10;
 
+/// The free bitmap has one bit for each `FREE_BITMAP_GRANULE` bytes
+/// of data: objects are at least that large, and aligned to it.
+pub const FREE_BITMAP_GRANULE: usize = 8;
+
+/// The free bitmap lives right after the metadata array, in the
+/// metadata region, and takes up this many bytes.
+const FREE_BITMAP_SIZE: usize = DATA_ALIGNMENT / FREE_BITMAP_GRANULE / 8;
+
 /// Maximum size in bytes we can service for a single span.  The
 /// higher this value, the more bytes we may lose to fragmentation
 /// when the remaining bytes in a chunk aren't enough.
@@ -92,6 +124,18 @@ pub const DEFAULT_DESIRED_SPAN_SIZE: usize = (8 << 10) - SPAN_ALIGNMENT;
 
 static_assertions::const_assert!(DEFAULT_DESIRED_SPAN_SIZE <= MAX_SPAN_SIZE);
 
+/// Chunk tails are always shorter than `MAX_SPAN_SIZE`: we only let
+/// go of a chunk when it can't satisfy a request, and requests are at
+/// most `MAX_SPAN_SIZE` bytes.  Bin `i` in the `TailIndex` holds tails
+/// with `[2^i, 2^(i + 1))` spans, so this many bins cover all tails.
+const NUM_TAIL_BINS: usize = (MAX_SPAN_SIZE / SPAN_ALIGNMENT).trailing_zeros() as usize;
+
+/// By default, we start mapping the next chunk once the current one
+/// is half full.
+const DEFAULT_PREMAP_THRESHOLD_PERCENT: usize = 50;
+
+static PREMAP_THRESHOLD_PERCENT: AtomicUsize = AtomicUsize::new(DEFAULT_PREMAP_THRESHOLD_PERCENT);
+
 /// Grabbing an address space of at least this many bytes should be
 /// enough to find a spot for the span + its metadata.
 ///
@@ -127,6 +171,13 @@ static_assertions::const_assert!(
 
 static_assertions::const_assert!(std::mem::size_of::<MetaArray>() <= METADATA_PAGE_SIZE);
 
+// The free bitmap must fit after the metadata array, and its words
+// must be aligned.
+static_assertions::const_assert!(
+    std::mem::size_of::<MetaArray>() + FREE_BITMAP_SIZE <= METADATA_PAGE_SIZE
+);
+static_assertions::const_assert_eq!(std::mem::size_of::<MetaArray>() % 8, 0);
+
 #[derive(Debug)]
 #[repr(C)]
 pub struct SpanMetadata {
@@ -183,10 +234,43 @@ struct Chunk {
 /// accidental sharing.  That's why it's safe to `Send` them.
 unsafe impl Send for Chunk {}
 
+/// Leftover spans at the end of chunks we switched away from.  Each
+/// tail is a `Chunk` whose bump pointer is partway through the chunk,
+/// so we can carve from a tail like from any other chunk.
+#[derive(Debug, Default)]
+struct TailIndex {
+    bins: [Vec<Chunk>; NUM_TAIL_BINS],
+}
+
+/// The chunks for one NUMA node.
+#[derive(Debug, Default)]
+struct NodeChunks {
+    /// We allocate spans from this chunk.
+    current: Mutex<Option<Chunk>>,
+    /// A background thread may pre-map the next chunk here.
+    next: Mutex<Option<Chunk>>,
+    /// Tails of previous chunks.  Only locked with `current` held.
+    tails: Mutex<TailIndex>,
+    /// True when a background thread is mapping `next`, or
+    /// `next` is populated.
+    premapping: AtomicBool,
+}
+
 #[derive(Debug)]
 pub struct Mill {
     mapper: &'static dyn Mapper,
-    current_chunk: Mutex<Option<Chunk>>,
+    /// One set of chunks per NUMA node; there's only one entry on
+    /// non-NUMA machines.
+    chunks: Box<[NodeChunks]>,
+}
+
+/// Updates the fill level, in percent, at which a `Mill`'s current
+/// chunk triggers the pre-mapping of the next chunk in a background
+/// thread.  A value of 100 or more disables pre-mapping.
+///
+/// The default is 50%.
+pub fn set_chunk_premap_threshold(percent: usize) {
+    PREMAP_THRESHOLD_PERCENT.store(percent, Ordering::Relaxed);
 }
 
 /// Returns a reference to the `Mill` for that `mapper_name`,
@@ -196,17 +280,21 @@ pub struct Mill {
 ///
 /// Returns `Err` if no such mapper is defined.
 pub fn get_mill(mapper_name: Option<&str>) -> Result<&'static Mill, &'static str> {
+    Ok(get_mill_for_mapper(crate::mapper::get_mapper(mapper_name)?))
+}
+
+/// Returns a reference to the `Mill` for `mapper`.
+pub fn get_mill_for_mapper(mapper: &'static dyn Mapper) -> &'static Mill {
     lazy_static::lazy_static! {
         // The keys are the addresses of `&'static dyn Mapper`.
         static ref MILLS: Mutex<HashMap<usize, &'static Mill>> = Default::default();
     }
 
-    let mapper: &'static _ = crate::mapper::get_mapper(mapper_name)?;
     let address = mapper as *const _ as *const () as usize;
     let mut mills = MILLS.lock().unwrap();
-    Ok(mills
+    mills
         .entry(address)
-        .or_insert_with(|| Box::leak(Box::new(Mill::new(mapper)))))
+        .or_insert_with(|| Box::leak(Box::new(Mill::new(mapper))))
 }
 
 impl SpanMetadata {
@@ -220,6 +308,30 @@ impl SpanMetadata {
     }
 }
 
+/// Returns the array of span metadata for the chunk with data at
+/// `data`.
+///
+/// # Safety
+///
+/// The chunk's metadata region must be mapped, and the caller must
+/// not race with the chunk's `Mill` or `Press`es.
+pub unsafe fn chunk_span_metadata(data: usize) -> &'static mut [SpanMetadata] {
+    let meta = SpanMetadata::from_allocation_address(data);
+
+    std::slice::from_raw_parts_mut(meta, DATA_ALIGNMENT / SPAN_ALIGNMENT)
+}
+
+/// Maps a Press-allocated address to the word in its chunk's free
+/// bitmap that tracks it, and to its bit in that word.
+pub fn free_bit_for_address(address: usize) -> (&'static AtomicU64, u64) {
+    let base = address - (address % DATA_ALIGNMENT);
+    let granule = (address - base) / FREE_BITMAP_GRANULE;
+    let bitmap = base - GUARD_PAGE_SIZE - METADATA_PAGE_SIZE + std::mem::size_of::<MetaArray>();
+    let word = unsafe { &*(bitmap as *const AtomicU64).add(granule / 64) };
+
+    (word, 1u64 << (granule % 64))
+}
+
 /// We track the exact way we want to partition a range of address
 /// space in an `AllocatedChunk`.
 ///
@@ -249,6 +361,8 @@ struct AllocatedChunk<'a> {
     pub data: *mut c_void,
     pub data_end: usize,
     top_slop_begin: usize, // page-aligned
+    // Preferred NUMA node for the data region.
+    node: Option<u32>,
 }
 
 impl<'a> AllocatedChunk<'a> {
@@ -260,7 +374,7 @@ impl<'a> AllocatedChunk<'a> {
     /// Returns `Err` when the mapper itself fails.  Failures downstream
     /// indicate that the mapper returned an invalid range, and result
     /// in panic.
-    pub fn new(mapper: &'a dyn Mapper) -> Result<AllocatedChunk<'a>, i32> {
+    pub fn new(mapper: &'a dyn Mapper, node: Option<u32>) -> Result<AllocatedChunk<'a>, i32> {
         let page_size = mapper.page_size();
         let mut size = MAPPED_REGION_SIZE;
         if (size % page_size) > 0 {
@@ -273,6 +387,7 @@ impl<'a> AllocatedChunk<'a> {
             mapper,
             NonZeroUsize::new(region.as_ptr() as usize).expect("NonNull should be NonZero"),
             actual,
+            node,
         )
         .expect("mapper returned a bad region"))
     }
@@ -284,6 +399,7 @@ impl<'a> AllocatedChunk<'a> {
         mapper: &'a dyn Mapper,
         base: NonZeroUsize,
         size: usize,
+        node: Option<u32>,
     ) -> Result<AllocatedChunk<'a>, &'static str> {
         let page_size = mapper.page_size();
 
@@ -352,6 +468,7 @@ impl<'a> AllocatedChunk<'a> {
             data: data as *mut c_void,
             data_end,
             top_slop_begin: suffix_end,
+            node,
         })
     }
 
@@ -487,7 +604,7 @@ impl<'a> AllocatedChunk<'a> {
             page_size,
             self.data as usize,
             DATA_ALIGNMENT,
-            |begin, size| self.mapper.allocate_data(begin, size),
+            |begin, size| self.mapper.allocate_data(begin, size, self.node),
         )
     }
 
@@ -519,6 +636,53 @@ impl<'a> AllocatedChunk<'a> {
     }
 }
 
+impl Chunk {
+    /// Returns the number of spans left in this chunk.
+    fn remaining(&self) -> usize {
+        self.span_count.saturating_sub(self.next_free_span)
+    }
+}
+
+impl TailIndex {
+    /// Returns the index of the bin for tails of `span_count` spans.
+    #[requires(span_count > 0)]
+    #[ensures(ret < NUM_TAIL_BINS)]
+    fn bin(span_count: usize) -> usize {
+        let log = (usize::BITS - 1 - span_count.leading_zeros()) as usize;
+
+        log.min(NUM_TAIL_BINS - 1)
+    }
+
+    /// Saves the remainder of `chunk`, if any.
+    fn insert(&mut self, chunk: Chunk) {
+        let remaining = chunk.remaining();
+
+        if remaining > 0 {
+            self.bins[TailIndex::bin(remaining)].push(chunk);
+        }
+    }
+
+    /// Attempts to carve at least `min` and up to `desired` spans
+    /// from the smallest bin that has a large enough tail.
+    #[requires(min > 0)]
+    fn allocate_span(&mut self, min: usize, desired: usize) -> Option<MilledRange> {
+        for bin in TailIndex::bin(min)..NUM_TAIL_BINS {
+            // Only the first bin may have tails shorter than `min`.
+            let tails = &mut self.bins[bin];
+            if let Some(pos) = tails.iter().position(|tail| tail.remaining() >= min) {
+                let mut tail = tails.swap_remove(pos);
+                let range = Mill::allocate_span(&mut tail, min, desired)
+                    .expect("tail must have enough spans");
+
+                self.insert(tail);
+                return Some(range);
+            }
+        }
+
+        None
+    }
+}
+
 impl Mill {
     pub fn new(mapper: &'static dyn Mapper) -> Self {
         extern "C" {
@@ -542,7 +706,75 @@ impl Mill {
 
         Self {
             mapper,
-            current_chunk: Default::default(),
+            chunks: (0..crate::map::numa_node_count())
+                .map(|_| Default::default())
+                .collect(),
+        }
+    }
+
+    /// Maps the next `count` chunks from this mill's `Mapper`, which
+    /// must hold spans from a previous process, and saves their
+    /// unused spans for later allocations.  Unlike fresh chunks,
+    /// these chunks need not be zero-filled: we find their first
+    /// unused span from their metadata, since mills carve spans from
+    /// each chunk in address order.
+    ///
+    /// Spans with a class id stay out of the mill's hands; they are
+    /// the caller's to recover.
+    pub fn adopt_chunks(&self, count: usize) -> Result<(), i32> {
+        let slot = &self.chunks[0];
+        let _current = slot.current.lock().unwrap();
+
+        for _ in 0..count {
+            let mut chunk = Mill::allocate_chunk(self.mapper, None)?;
+            let meta = unsafe { chunk.meta.as_ref() }.expect("must be valid");
+
+            chunk.next_free_span = meta
+                .chunk_meta
+                .iter()
+                .rposition(|span| span.class_id.is_some())
+                .map_or(0, |last| last + 1);
+            slot.tails.lock().unwrap().insert(chunk);
+        }
+
+        Ok(())
+    }
+
+    /// Returns the page size for this mill's `Mapper`.
+    pub fn page_size(&self) -> usize {
+        self.mapper.page_size()
+    }
+
+    /// Lets the OS reclaim the memory behind `size` bytes of free
+    /// object data at `base`.  See `Mapper::purge_data`.
+    pub fn purge_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        self.mapper.purge_data(base, size)
+    }
+
+    /// Tells the OS that `size` bytes of object data at `base` are
+    /// cold.  See `Mapper::advise_cold_data`.
+    pub fn advise_cold_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        pageout: bool,
+    ) -> Result<(), i32> {
+        self.mapper.advise_cold_data(base, size, pageout)
+    }
+
+    /// Returns the calling thread's current NUMA node, if we should
+    /// care about NUMA placement.
+    #[ensures(ret.is_none() || (ret.unwrap() as usize) < self.chunks.len())]
+    fn local_node(&self) -> Option<u32> {
+        if self.chunks.len() <= 1 {
+            return None;
+        }
+
+        let (_, node) = crate::map::current_cpu_and_node()?;
+        if (node as usize) < self.chunks.len() {
+            Some(node)
+        } else {
+            None
         }
     }
 
@@ -555,9 +787,17 @@ impl Mill {
               debug_arange_map::is_data(ret.as_ref().unwrap().spans,
                                         ret.as_ref().unwrap().span_count * SPAN_ALIGNMENT).is_ok(),
               "The data region is marked as such.")]
-    fn allocate_chunk(mapper: &dyn Mapper) -> Result<Chunk, i32> {
-        AllocatedChunk::new(mapper)?.call_with_chunk(|chunk| {
+    fn allocate_chunk(mapper: &dyn Mapper, node: Option<u32>) -> Result<Chunk, i32> {
+        extern "C" {
+            fn slitter__register_chunk(data: usize);
+        }
+
+        AllocatedChunk::new(mapper, node)?.call_with_chunk(|chunk| {
             let meta = unsafe { chunk.meta.as_mut() }.expect("must be valid");
+
+            // The metadata page is backed, so `Class::of` may now
+            // look up addresses in this chunk.
+            unsafe { slitter__register_chunk(chunk.data as usize) };
             Ok(Chunk {
                 meta,
                 spans: chunk.data as usize,
@@ -595,7 +835,7 @@ impl Mill {
         }
 
         let remaining = chunk.span_count - chunk.next_free_span;
-        // TODO: it would be nice to save these unused spans somewhere.
+        // `get_span` saves the remainder in its `TailIndex`.
         if remaining < min {
             return None;
         }
@@ -621,7 +861,14 @@ impl Mill {
     /// Attempts to return a fresh range of allocation space.  On
     /// success, the newly milled range will contain at least
     /// `min_size` bytes, but the implementation tries to get
-    /// `desired_size`, if possible.
+    /// `desired_size`, if possible.  The range comes from the chunk
+    /// for the caller's NUMA node, and may trigger the pre-mapping of
+    /// the next chunk in a background thread.
+    ///
+    /// We first look for a leftover chunk tail that's large enough
+    /// for `min_size`, and only then carve from the current chunk,
+    /// or from a new chunk, in which case the current chunk's tail
+    /// goes in the tail index.
     ///
     /// The `min_size` must be at most `MAX_SPAN_SIZE`.
     ///
@@ -631,7 +878,7 @@ impl Mill {
     #[requires(min_size <= MAX_SPAN_SIZE)]
     #[requires(min_size <= desired_size.unwrap_or(min_size))]
     pub fn get_span(
-        &self,
+        &'static self,
         min_size: usize,
         desired_size: Option<usize>,
     ) -> Result<MilledRange, i32> {
@@ -646,10 +893,17 @@ impl Mill {
         let desired_span_count =
             (desired / SPAN_ALIGNMENT) + ((desired % SPAN_ALIGNMENT) > 0) as usize;
 
-        let mut chunk_or = self.current_chunk.lock().unwrap();
+        let node = self.local_node();
+        let slot = &self.chunks[node.unwrap_or(0) as usize];
+        let mut chunk_or = slot.current.lock().unwrap();
+        let mut tails = slot.tails.lock().unwrap();
+
+        if let Some(range) = tails.allocate_span(min_span_count, desired_span_count) {
+            return Ok(range);
+        }
 
         if chunk_or.is_none() {
-            *chunk_or = Some(Mill::allocate_chunk(self.mapper)?);
+            *chunk_or = Some(self.next_chunk(slot, node)?);
         }
 
         if let Some(range) = Mill::allocate_span(
@@ -657,10 +911,12 @@ impl Mill {
             min_span_count,
             desired_span_count,
         ) {
+            self.maybe_premap(slot, node, chunk_or.as_ref().unwrap());
             return Ok(range);
         }
 
-        *chunk_or = Some(Mill::allocate_chunk(self.mapper)?);
+        let old = chunk_or.replace(self.next_chunk(slot, node)?);
+        tails.insert(old.expect("must have a current chunk"));
         Ok(Mill::allocate_span(
             chunk_or.as_mut().unwrap(),
             min_span_count,
@@ -668,6 +924,44 @@ impl Mill {
         )
         .expect("New chunk must have a span"))
     }
+
+    /// Returns the pre-mapped chunk in `slot`, if any, and otherwise
+    /// maps a new chunk on `node`.
+    fn next_chunk(&self, slot: &NodeChunks, node: Option<u32>) -> Result<Chunk, i32> {
+        if let Some(chunk) = slot.next.lock().unwrap().take() {
+            slot.premapping.store(false, Ordering::Relaxed);
+            return Ok(chunk);
+        }
+
+        Mill::allocate_chunk(self.mapper, node)
+    }
+
+    /// Starts mapping the next chunk for `slot` in the background, if
+    /// `current` is full enough and no one is doing that already.
+    fn maybe_premap(&'static self, slot: &'static NodeChunks, node: Option<u32>, current: &Chunk) {
+        let threshold = PREMAP_THRESHOLD_PERCENT.load(Ordering::Relaxed);
+
+        if threshold >= 100
+            || current.next_free_span * 100 < threshold * current.span_count
+            || slot.premapping.load(Ordering::Relaxed)
+            || slot.premapping.swap(true, Ordering::Relaxed)
+        {
+            return;
+        }
+
+        let mapper = self.mapper;
+        let spawned = std::thread::Builder::new()
+            .name("slitter-premap".to_string())
+            .spawn(move || match Mill::allocate_chunk(mapper, node) {
+                Ok(chunk) => *slot.next.lock().unwrap() = Some(chunk),
+                // We'll try again, synchronously, when we need the chunk.
+                Err(_) => slot.premapping.store(false, Ordering::Relaxed),
+            });
+
+        if spawned.is_err() {
+            slot.premapping.store(false, Ordering::Relaxed);
+        }
+    }
 }
 
 #[test]
@@ -687,6 +981,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(mapper.page_size()).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     at_start.check_rep();
@@ -699,6 +994,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(usize::MAX - MAPPED_REGION_SIZE - mapper.page_size() + 1).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     at_end.check_rep();
@@ -707,6 +1003,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(DATA_ALIGNMENT).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     aligned.check_rep();
@@ -715,6 +1012,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(DATA_ALIGNMENT + mapper.page_size()).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     unaligned.check_rep();
@@ -723,6 +1021,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(DATA_ALIGNMENT - GUARD_PAGE_SIZE).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     offset_guard.check_rep();
@@ -731,6 +1030,7 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(DATA_ALIGNMENT - GUARD_PAGE_SIZE - METADATA_PAGE_SIZE).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     offset_meta.check_rep();
@@ -742,6 +1042,7 @@ fn test_allocated_span_valid() {
         )
         .unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     off_by_one.check_rep();
@@ -750,7 +1051,76 @@ fn test_allocated_span_valid() {
         mapper,
         NonZeroUsize::new(DATA_ALIGNMENT - 2 * GUARD_PAGE_SIZE - METADATA_PAGE_SIZE).unwrap(),
         MAPPED_REGION_SIZE,
+        None,
     )
     .expect("must construct");
     exact_fit.check_rep();
 }
+
+#[test]
+fn test_premap_next_chunk() {
+    let mapper = crate::mapper::get_mapper(None).expect("Default mapper exists");
+    let mill: &'static Mill = Box::leak(Box::new(Mill::new(mapper)));
+    let span_size = DEFAULT_DESIRED_SPAN_SIZE;
+    let chunk_of = |range: &MilledRange| range.data as usize / DATA_ALIGNMENT;
+
+    let first = mill.get_span(span_size, Some(span_size)).expect("must allocate");
+    let mut last = chunk_of(&first);
+
+    // Fill the first chunk (and maybe spill in the next one).
+    while chunk_of(&mill.get_span(span_size, Some(span_size)).expect("must allocate")) == last {}
+
+    // Wait for the background thread to pre-map another chunk.
+    let slot = &mill.chunks[0];
+    last = chunk_of(&mill.get_span(span_size, Some(span_size)).expect("must allocate"));
+    let start = std::time::Instant::now();
+    while slot.next.lock().unwrap().is_none() {
+        assert!(start.elapsed() < std::time::Duration::from_secs(10));
+        if chunk_of(&mill.get_span(span_size, Some(span_size)).expect("must allocate")) != last {
+            // We switched chunks before the pre-map finished.
+            return;
+        }
+
+        std::thread::sleep(std::time::Duration::from_millis(1));
+    }
+
+    let premapped = slot.next.lock().unwrap().as_ref().unwrap().spans / DATA_ALIGNMENT;
+    loop {
+        let current = chunk_of(&mill.get_span(span_size, Some(span_size)).expect("must allocate"));
+
+        if current != last {
+            assert_eq!(current, premapped);
+            break;
+        }
+    }
+}
+
+#[test]
+fn test_reuse_chunk_tail() {
+    let mapper = crate::mapper::get_mapper(None).expect("Default mapper exists");
+    let mill: &'static Mill = Box::leak(Box::new(Mill::new(mapper)));
+    // 21 spans of 3/4 `MAX_SPAN_SIZE` leave a tail of 1/4 `MAX_SPAN_SIZE`.
+    let large = 3 * (MAX_SPAN_SIZE / 4);
+    let chunk_of = |range: &MilledRange| range.data as usize / DATA_ALIGNMENT;
+
+    let first = chunk_of(&mill.get_span(large, Some(large)).expect("must allocate"));
+    for _ in 1..21 {
+        let range = mill.get_span(large, Some(large)).expect("must allocate");
+        assert_eq!(chunk_of(&range), first);
+    }
+
+    // The first chunk is too full for this one.
+    let second = chunk_of(&mill.get_span(large, Some(large)).expect("must allocate"));
+    assert_ne!(second, first);
+
+    // But smaller spans come from its tail, until it's exhausted.
+    let small = MAX_SPAN_SIZE / 16;
+    for _ in 0..4 {
+        let range = mill.get_span(small, Some(small)).expect("must allocate");
+        assert_eq!(chunk_of(&range), first);
+        assert_eq!(range.data_size, small);
+    }
+
+    let range = mill.get_span(small, Some(small)).expect("must allocate");
+    assert_eq!(chunk_of(&range), second);
+}
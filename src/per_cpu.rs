@@ -0,0 +1,226 @@
+//! With the `per_cpu_cache` feature, the C fast path caches
+//! magazines for each CPU rather than for each thread (see
+//! `c/per_cpu.h`), when the kernel and libc support restartable
+//! sequences.  This module implements the slow paths for that
+//! per-CPU cache: they trade whole magazines with the `ClassInfo`.
+//!
+//! Batch calls still go through the thread-local cache.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::cell::RefCell;
+
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_allocation_map;
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_type_map;
+
+use crate::linear_ref::LinearRef;
+use crate::magazine::LocalMagazineCache;
+use crate::magazine::Magazine;
+use crate::magazine::MagazinePacer;
+use crate::magazine::PopMagazine;
+use crate::magazine::PushMagazine;
+use crate::magazine_impl::MagazineImpl;
+use crate::magazine_impl::MagazineStorage;
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::press;
+use crate::Class;
+
+// Per-CPU magazines have no owning thread, but the slow-path rate
+// is still a per-thread signal: each thread keeps its own pacers,
+// indexed by class id.
+thread_local!(static PACERS: RefCell<Vec<MagazinePacer>> = RefCell::new(Vec::new()));
+
+/// Calls `f` with the calling thread's pacer for `class`.
+fn with_pacer<T>(class: Class, f: impl FnOnce(&mut MagazinePacer) -> T) -> T {
+    let index = class.id().get() as usize;
+    let mut cell = Some(f);
+
+    PACERS
+        .try_with(|pacers| {
+            let mut pacers = pacers.borrow_mut();
+
+            if pacers.len() <= index {
+                pacers.resize_with(index + 1, Default::default);
+            }
+
+            (cell.take().unwrap())(&mut pacers[index])
+        })
+        // During thread shutdown, use a throwaway pacer.
+        .unwrap_or_else(|_| (cell.take().unwrap())(&mut Default::default()))
+}
+
+/// Returns a fresh allocation for `class`, and writes a magazine of
+/// more allocations (if any) to `out_storage`.
+#[ensures(ret.is_some() ->
+          debug_allocation_map::can_be_allocated(class, ret.as_ref().unwrap().get()).is_ok(),
+          "Successful allocations must be in the correct class and not double allocate")]
+#[ensures(ret.is_some() ->
+          debug_type_map::is_class(class, ret.as_ref().unwrap()).is_ok(),
+          "Successful allocations must match the class of the address range.")]
+#[ensures(ret.is_some() ->
+          press::check_allocation(class, ret.as_ref().unwrap().get().as_ptr() as usize).is_ok(),
+          "Sucessful allocations must have the allocation metadata set correctly.")]
+#[no_mangle]
+pub extern "C" fn slitter__per_cpu_refill(
+    class: Class,
+    out_storage: &mut Option<&'static mut MagazineStorage>,
+) -> Option<LinearRef> {
+    let mut mag: PopMagazine = Default::default();
+
+    let ret = with_pacer(class, |pacer| {
+        class
+            .info()
+            .refill_magazine(&mut mag, &mut LocalMagazineCache::Nothing, pacer)
+    });
+
+    assert!(ret.is_some(), "Allocation failed");
+    // Count the whole magazine as allocated: we'll back out whatever
+    // remains when the magazine leaves the CPU's slot.
+    class.info().counters.fold(1 + mag.len() as u64, 0);
+    *out_storage = mag.0.storage();
+    ret
+}
+
+/// Acquires ownership of `spilled`, and returns a magazine with room
+/// for more deallocations.
+#[requires(debug_allocation_map::has_been_released(class, spilled.get()).is_ok(),
+           "Blocks passed to `release` must have already been marked as released.")]
+#[requires(debug_type_map::is_class(class, &spilled).is_ok(),
+           "Deallocated blocks must match the class of the address range.")]
+#[requires(press::check_allocation(class, spilled.get().as_ptr() as usize).is_ok(),
+          "Deallocated block must have the allocation metadata set correctly.")]
+#[no_mangle]
+pub extern "C" fn slitter__per_cpu_clear(
+    class: Class,
+    spilled: LinearRef,
+) -> Option<&'static mut MagazineStorage> {
+    let mut mag: PushMagazine = Default::default();
+
+    with_pacer(class, |pacer| {
+        class
+            .info()
+            .clear_magazine(&mut mag, &mut LocalMagazineCache::Nothing, pacer, spilled)
+    });
+
+    mag.0.storage()
+}
+
+/// Acquires ownership of a magazine evicted from a per-CPU slot:
+/// the release slot if `release` is true, and the allocation slot
+/// otherwise.
+///
+/// Per-CPU slots use the same storage representation for allocation
+/// and release magazines, but only allocation magazines are
+/// zero-filled, when the class asks for that.
+///
+/// Objects in release slots count as released once they leave the
+/// slot (and that includes the `spilled` object passed to
+/// `slitter__per_cpu_clear`).
+#[no_mangle]
+pub extern "C" fn slitter__per_cpu_release(
+    class: Class,
+    release: bool,
+    storage: &'static mut MagazineStorage,
+) {
+    if release {
+        let mag: PushMagazine = Magazine(MagazineImpl::new(Some(storage)));
+
+        class.info().counters.fold(0, mag.len() as u64);
+        class.info().release_magazine(mag, None);
+    } else {
+        let mag: PopMagazine = Magazine(MagazineImpl::new(Some(storage)));
+
+        class.info().counters.unallocate(mag.len() as u64);
+        class.info().release_magazine(mag, None);
+    }
+}
+
+/// Returns whether the C fast path uses the per-CPU cache.
+#[cfg(test)]
+fn is_active() -> bool {
+    extern "C" {
+        fn slitter__per_cpu_active() -> bool;
+    }
+
+    unsafe { slitter__per_cpu_active() }
+}
+
+#[test]
+fn per_cpu_smoke_test() {
+    use crate::ClassConfig;
+
+    // The per-CPU cache only turns on when libc registered rseq for
+    // the main thread; otherwise, the C fast path uses thread caches,
+    // and there is nothing to test here.
+    if !is_active() {
+        return;
+    }
+
+    let class = Class::new(ClassConfig::for_test("per_cpu", 8)).expect("Should build");
+
+    // Cycle through more than a few magazines' worth of objects.
+    let mut allocs = Vec::new();
+    for _ in 0..1000 {
+        allocs.push(class.allocate().expect("Should allocate"));
+    }
+
+    for alloc in allocs.drain(..) {
+        class.release(alloc);
+    }
+
+    for _ in 0..1000 {
+        allocs.push(class.allocate().expect("Should allocate"));
+    }
+
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    extern "C" {
+        fn slitter__per_cpu_enabled(id: u32) -> bool;
+        fn slitter__per_cpu_exchange(
+            id: u32,
+            release: bool,
+            fresh: *mut MagazineStorage,
+        ) -> *mut MagazineStorage;
+    }
+
+    // Only the first `SLITTER__PER_CPU_MAX_CLASSES` classes have
+    // per-CPU slots, and other tests may already have used them up.
+    if !unsafe { slitter__per_cpu_enabled(class.id().get()) } {
+        return;
+    }
+
+    // The CPU's slots now hold magazines for our class: take them
+    // out, and hand them back to the class.  The exchange only fails
+    // (returns NULL) when preempted, so retry a few times.
+    for release in [false, true].iter() {
+        let storage = (0..100)
+            .map(|_| unsafe {
+                slitter__per_cpu_exchange(class.id().get(), *release, std::ptr::null_mut())
+            })
+            .find(|storage| !storage.is_null())
+            .expect("The per-CPU cache should hold a magazine");
+
+        slitter__per_cpu_release(class, *release, unsafe { &mut *storage });
+    }
+}
@@ -0,0 +1,845 @@
+//! A `PersistentMapper` backs its chunks with files in a named
+//! directory, at fixed addresses, so that a later process can map the
+//! same files at the same addresses and pick up where the previous
+//! one left off: pointers between persistent objects stay valid
+//! across restarts.
+//!
+//! Each chunk's file holds everything the mill and presses know about
+//! that chunk: its metadata region (span metadata, with each span's
+//! bump pointer, and the free bitmap) at offset 0, followed by its
+//! data.  Chunk `k` always lives in file `chunk-<k>`, with `k`
+//! zero-padded to six digits (e.g., `chunk-000000`), and its data at
+//! `base + (2k + 1) * DATA_ALIGNMENT`, and mappers reserve the
+//! address space for all their chunks upfront.
+//!
+//! Span metadata refer to classes by runtime id, and ids change
+//! between processes, so the directory's `heap` file also records the
+//! name, object layout and `isolate_cache_lines` flag of each class
+//! that allocated from the heap.  When we open an existing heap, we
+//! retag every span with its class's index in the `heap` file (as a
+//! "pending" class id past all runtime ids), and `Class::new` hands
+//! these spans over to the new class with the same name, as long as
+//! it has the same layout and flag (otherwise, `Class::new` fails).
+//! The class recovers the objects in its depot (free bit set) and
+//! past each span's bump pointer as free, and everything else as
+//! live.
+//!
+//! Recovery assumes that the previous process exited cleanly, after
+//! flushing its thread caches (`flush_thread_cache`), and that only
+//! one process uses a heap at a time; it is not crash-consistent.
+//! We have no record of objects that were allocated but never came
+//! back to the depot: objects in thread caches, CPU caches, or arenas
+//! look live after a restart, and leak.  The heap's layout depends on
+//! the build's chunk constants, which we check when opening a heap.
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use contracts::*;
+#[cfg(not(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+)))]
+use disabled_contracts::*;
+
+use std::alloc::Layout;
+use std::collections::HashMap;
+use std::ffi::c_void;
+use std::fs::File;
+use std::fs::OpenOptions;
+use std::num::NonZeroU32;
+use std::path::Path;
+use std::path::PathBuf;
+use std::ptr::NonNull;
+use std::sync::atomic::AtomicPtr;
+use std::sync::atomic::AtomicU32;
+use std::sync::atomic::Ordering;
+use std::sync::Mutex;
+
+#[cfg(any(
+    all(test, feature = "check_contracts_in_tests"),
+    feature = "check_contracts"
+))]
+use crate::debug_allocation_map;
+
+use crate::class::ClassInfo;
+use crate::linear_ref::LinearRef;
+use crate::magazine::PushMagazine;
+use crate::mill;
+use crate::mill::SpanMetadata;
+use crate::mill::DATA_ALIGNMENT;
+use crate::mill::GUARD_PAGE_SIZE;
+use crate::mill::METADATA_PAGE_SIZE;
+use crate::mill::SPAN_ALIGNMENT;
+use crate::Mapper;
+
+/// A heap remembers at most this many classes.
+const MAX_PERSISTENT_CLASSES: usize = 256;
+
+/// Persistent class names, with their NUL terminator, must fit in
+/// this many bytes.
+const MAX_CLASS_NAME_SIZE: usize = 48;
+
+/// Spans that wait for the class at index `i` in the heap file have
+/// class id `u32::MAX - i`; runtime class ids stay below this value.
+pub const FIRST_PENDING_ID: u32 = u32::MAX - (MAX_PERSISTENT_CLASSES as u32 - 1);
+
+/// Identifies heap files, and the version of their layout.
+const HEAP_MAGIC: u64 = u64::from_le_bytes(*b"slitter1");
+
+#[derive(Debug)]
+#[repr(C)]
+struct PersistentClass {
+    /// NUL-padded; unused entries have an empty name.
+    name: [u8; MAX_CLASS_NAME_SIZE],
+    size: u64,
+    align: u64,
+    /// The class's id in the current process, or 0.
+    id: AtomicU32,
+    /// 1 if the class isolates cache lines, 0 otherwise.
+    isolate_cache_lines: u32,
+}
+
+/// The contents of the `heap` file.  New files are zero-filled,
+/// and all zeros is an empty heap, except for the layout fields.
+#[derive(Debug)]
+#[repr(C)]
+struct HeapHeader {
+    magic: u64,
+    base: u64,
+    data_alignment: u64,
+    metadata_page_size: u64,
+    span_alignment: u64,
+    root: AtomicPtr<c_void>,
+    classes: [PersistentClass; MAX_PERSISTENT_CLASSES],
+}
+
+/// A run of spans metadata (span head and trail) from a previous
+/// process, waiting for its class.
+#[derive(Debug)]
+pub(crate) struct PendingSpan {
+    /// Address of the head `SpanMetadata`.
+    meta: usize,
+    /// Number of `SpanMetadata` for the span, including the head.
+    count: usize,
+}
+
+#[derive(Debug)]
+pub struct PersistentMapper {
+    dir: PathBuf,
+    base: usize,
+    max_chunks: usize,
+    /// Mapped for the lifetime of the process.
+    header: NonNull<HeapHeader>,
+    state: Mutex<MapperState>,
+}
+
+/// The header is shared memory, and only updated with the state
+/// lock held (or atomically).
+unsafe impl Send for PersistentMapper {}
+unsafe impl Sync for PersistentMapper {}
+
+#[derive(Debug, Default)]
+struct MapperState {
+    /// The next chunk `reserve` hands out.
+    next_chunk: usize,
+    /// The backing file for each chunk we've seen so far.
+    files: Vec<File>,
+    /// Recovered spans, indexed by class index in the header.
+    pending: HashMap<usize, Vec<PendingSpan>>,
+}
+
+lazy_static::lazy_static! {
+    static ref PERSISTENT_MAPPERS: Mutex<HashMap<String, &'static PersistentMapper>> = Default::default();
+}
+
+fn to_errno(e: std::io::Error) -> i32 {
+    e.raw_os_error().unwrap_or(0)
+}
+
+/// Rounds `x` up to a multiple of the page size.
+fn round_up_to_page(x: usize) -> usize {
+    let page_size = crate::map::page_size();
+
+    (x + page_size - 1) & !(page_size - 1)
+}
+
+/// Chunk files start with the metadata region, then the data.
+fn data_file_offset() -> usize {
+    round_up_to_page(METADATA_PAGE_SIZE)
+}
+
+impl PersistentMapper {
+    /// Returns the address of the data for chunk `index`.
+    fn chunk_data(&self, index: usize) -> usize {
+        self.base + (2 * index + 1) * DATA_ALIGNMENT
+    }
+
+    /// Returns the address of the metadata region for chunk `index`,
+    /// where the mill expects to find it.
+    fn chunk_meta(&self, index: usize) -> usize {
+        self.chunk_data(index) - GUARD_PAGE_SIZE - METADATA_PAGE_SIZE
+    }
+
+    /// Returns the index of the chunk whose reserved range includes
+    /// `address`.
+    fn chunk_index(&self, address: usize) -> usize {
+        (address - self.base) / (2 * DATA_ALIGNMENT)
+    }
+
+    fn header(&self) -> &HeapHeader {
+        unsafe { self.header.as_ref() }
+    }
+
+    /// Returns the file for chunk `index`, and creates it if
+    /// necessary.
+    fn chunk_file<'a>(&self, state: &'a mut MapperState, index: usize) -> Result<&'a File, i32> {
+        while state.files.len() <= index {
+            let path = self.dir.join(format!("chunk-{:06}", state.files.len()));
+            let file = OpenOptions::new()
+                .read(true)
+                .write(true)
+                .create(true)
+                .open(path)
+                .map_err(to_errno)?;
+            let size = (data_file_offset() + DATA_ALIGNMENT) as u64;
+
+            if file.metadata().map_err(to_errno)?.len() < size {
+                file.set_len(size).map_err(to_errno)?;
+            }
+
+            state.files.push(file);
+        }
+
+        Ok(&state.files[index])
+    }
+
+    /// Maps the `size` bytes at `base` to `offset` + their offset
+    /// from `begin` in the file for chunk `index`.
+    fn map_chunk_range(
+        &self,
+        index: usize,
+        begin: usize,
+        offset: usize,
+        base: NonNull<c_void>,
+        size: usize,
+    ) -> Result<(), i32> {
+        let mut state = self.state.lock().unwrap();
+        let file = self.chunk_file(&mut state, index)?;
+        let address = base.as_ptr() as usize;
+
+        assert!(address >= begin);
+        crate::map::allocate_file_region(file, offset + (address - begin), base, size, None)
+    }
+
+    /// Returns the file offset for the data at `address`.
+    fn data_offset(&self, address: usize) -> usize {
+        data_file_offset() + (address - self.chunk_data(self.chunk_index(address)))
+    }
+
+    /// Maps the metadata regions of all the chunks in `self.dir`,
+    /// and retags their spans as pending.  Returns the number of
+    /// chunks.
+    fn recover_chunks(&self) -> Result<usize, i32> {
+        extern "C" {
+            fn slitter__register_chunk(data: usize);
+        }
+
+        let header = self.header();
+        let mut state = self.state.lock().unwrap();
+        let mut count = 0;
+
+        while count < self.max_chunks && self.dir.join(format!("chunk-{:06}", count)).exists() {
+            let meta = self.chunk_meta(count);
+            let file = self.chunk_file(&mut state, count)?;
+
+            crate::map::allocate_file_region(
+                file,
+                0,
+                NonNull::new(meta as *mut c_void).expect("must be valid"),
+                round_up_to_page(METADATA_PAGE_SIZE),
+                None,
+            )?;
+
+            // The metadata page is backed, so `Class::of` may look up
+            // addresses in this chunk; it returns `None` until their
+            // span is claimed.
+            unsafe { slitter__register_chunk(self.chunk_data(count)) };
+
+            let spans = unsafe { mill::chunk_span_metadata(self.chunk_data(count)) };
+            let mut i = 0;
+            while i < spans.len() {
+                let id = match spans[i].class_id {
+                    Some(id) => id.get(),
+                    None => {
+                        i += 1;
+                        continue;
+                    }
+                };
+                let begin = spans[i].span_begin;
+                let span_count = spans[i..]
+                    .iter()
+                    .take_while(|meta| {
+                        meta.class_id.map(|id| id.get()) == Some(id) && meta.span_begin == begin
+                    })
+                    .count();
+
+                // The previous process may have died before
+                // claiming all its spans.
+                let index = if id >= FIRST_PENDING_ID {
+                    Some((u32::MAX - id) as usize)
+                } else {
+                    header
+                        .classes
+                        .iter()
+                        .position(|class| class.id.load(Ordering::Relaxed) == id)
+                };
+
+                // Spans with an unknown id (e.g., an unnamed class)
+                // stay unclaimed for good.
+                if let Some(index) = index {
+                    let tag = NonZeroU32::new(u32::MAX - index as u32);
+
+                    for meta in spans[i..i + span_count].iter_mut() {
+                        meta.class_id = tag;
+                    }
+
+                    state.pending.entry(index).or_default().push(PendingSpan {
+                        meta: &spans[i] as *const SpanMetadata as usize,
+                        count: span_count,
+                    });
+                }
+
+                i += span_count;
+            }
+
+            count += 1;
+        }
+
+        for class in header.classes.iter() {
+            class.id.store(0, Ordering::Relaxed);
+        }
+
+        Ok(count)
+    }
+}
+
+/// Opens the heap header in `dir`, and initialises it if the heap
+/// is new.
+///
+/// # Errors
+///
+/// Returns `Err(EINVAL)` if the heap was created for a different
+/// base address or with different layout constants.
+fn open_header(dir: &Path, base: usize) -> Result<NonNull<HeapHeader>, i32> {
+    let file = OpenOptions::new()
+        .read(true)
+        .write(true)
+        .create(true)
+        .open(dir.join("heap"))
+        .map_err(to_errno)?;
+    let size = round_up_to_page(std::mem::size_of::<HeapHeader>());
+
+    if file.metadata().map_err(to_errno)?.len() < size as u64 {
+        file.set_len(size as u64).map_err(to_errno)?;
+    }
+
+    let region = crate::map::reserve_region(size)?;
+    crate::map::allocate_file_region(&file, 0, region, size, None)?;
+
+    let header = region.cast::<HeapHeader>();
+    let layout = [
+        base as u64,
+        DATA_ALIGNMENT as u64,
+        METADATA_PAGE_SIZE as u64,
+        SPAN_ALIGNMENT as u64,
+    ];
+    let fields = |header: &HeapHeader| {
+        [
+            header.base,
+            header.data_alignment,
+            header.metadata_page_size,
+            header.span_alignment,
+        ]
+    };
+
+    let header_ref = unsafe { &mut *header.as_ptr() };
+    if header_ref.magic == 0 {
+        header_ref.base = layout[0];
+        header_ref.data_alignment = layout[1];
+        header_ref.metadata_page_size = layout[2];
+        header_ref.span_alignment = layout[3];
+        header_ref.magic = HEAP_MAGIC;
+    } else if header_ref.magic != HEAP_MAGIC || fields(header_ref) != layout {
+        // The header stays mapped, but that's a few pages in a
+        // failure path.
+        return Err(libc_errno::EINVAL);
+    }
+
+    Ok(header)
+}
+
+/// The few errno values we return ourselves.
+mod libc_errno {
+    pub const ENOMEM: i32 = 12;
+    pub const EEXIST: i32 = 17;
+    pub const EINVAL: i32 = 22;
+}
+
+/// Registers a persistent mapper called `name`, backed by the files
+/// in directory `dir`.  The mapper's chunks, up to `max_size` bytes
+/// of data in total, live at fixed addresses in the range that
+/// starts at `base`, which must be aligned to the chunk size (1 GB).
+/// The range spans twice as many bytes as the data, because of the
+/// guard and metadata regions around each chunk.
+///
+/// If `dir` already holds a heap, the mapper maps the heap's chunks
+/// back at the same addresses; classes that use this mapper then
+/// recover their spans, by name, when they're (re-)registered.
+///
+/// # Errors
+///
+/// Returns `Err(errno)` when the mapper can't reserve its address
+/// range or open its files, `EINVAL` on an invalid `base` or `dir`
+/// contents, and `EEXIST` if `name` is already persistent.
+pub fn register_persistent_mapper(
+    name: &str,
+    dir: &Path,
+    base: usize,
+    max_size: usize,
+) -> Result<(), i32> {
+    let mut mappers = PERSISTENT_MAPPERS.lock().unwrap();
+
+    if mappers.contains_key(name) {
+        return Err(libc_errno::EEXIST);
+    }
+
+    let max_chunks = ((max_size + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT).max(1);
+    let range_size = max_chunks
+        .checked_mul(2 * DATA_ALIGNMENT)
+        .ok_or(libc_errno::EINVAL)?;
+    if base == 0 || base % DATA_ALIGNMENT != 0 || base.checked_add(range_size).is_none() {
+        return Err(libc_errno::EINVAL);
+    }
+
+    std::fs::create_dir_all(dir).map_err(to_errno)?;
+    let header = open_header(dir, base)?;
+    crate::map::reserve_fixed_region(
+        NonNull::new(base as *mut c_void).expect("base is non-zero"),
+        range_size,
+    )?;
+
+    let mapper: &'static PersistentMapper = Box::leak(Box::new(PersistentMapper {
+        dir: dir.to_owned(),
+        base,
+        max_chunks,
+        header,
+        state: Default::default(),
+    }));
+
+    let recovered = mapper.recover_chunks()?;
+    mill::get_mill_for_mapper(mapper).adopt_chunks(recovered)?;
+
+    crate::mapper::register_mapper(name.to_string(), mapper);
+    mappers.insert(name.to_string(), mapper);
+    Ok(())
+}
+
+/// Returns the root pointer for the persistent mapper `name`, or
+/// `None` if there is no such mapper.  The root survives restarts,
+/// and is initially NULL; programs usually point it to a persistent
+/// object from which they can find all their other objects.
+pub fn persistent_root(name: &str) -> Option<&'static AtomicPtr<c_void>> {
+    let mapper: &'static PersistentMapper = *PERSISTENT_MAPPERS.lock().unwrap().get(name)?;
+
+    Some(&unsafe { &*mapper.header.as_ptr() }.root)
+}
+
+/// Assigns the runtime `class_id` of `class_name`, a class with
+/// (padded) object `layout`, to its entry in the heap for
+/// `mapper_name`.  Returns the spans from a previous process for
+/// that class, or nothing if `mapper_name` isn't persistent.
+///
+/// # Errors
+///
+/// Returns `Err` if the class can't be persistent (e.g., it doesn't
+/// have a name), or doesn't match its entry in the heap.  The entry
+/// and its spans are left as they were, for a matching class.
+pub(crate) fn claim_spans(
+    mapper_name: Option<&str>,
+    class_name: Option<&str>,
+    layout: Layout,
+    isolate_cache_lines: bool,
+    class_id: u32,
+) -> Result<Vec<PendingSpan>, &'static str> {
+    let mapper: &'static PersistentMapper =
+        match mapper_name.and_then(|name| PERSISTENT_MAPPERS.lock().unwrap().get(name).copied()) {
+            Some(mapper) => mapper,
+            None => return Ok(Vec::new()),
+        };
+
+    let name = class_name.ok_or("persistent classes must have a name")?;
+    if name.is_empty() || name.len() >= MAX_CLASS_NAME_SIZE || name.contains('\0') {
+        return Err("invalid persistent class name");
+    }
+
+    let mut state = mapper.state.lock().unwrap();
+    let header = unsafe { &mut *mapper.header.as_ptr() };
+    let matches = |entry: &PersistentClass| {
+        let len = entry
+            .name
+            .iter()
+            .position(|c| *c == 0)
+            .unwrap_or(MAX_CLASS_NAME_SIZE);
+
+        &entry.name[..len] == name.as_bytes()
+    };
+
+    let index = match header.classes.iter().position(matches) {
+        Some(index) => {
+            let entry = &header.classes[index];
+
+            if entry.size != layout.size() as u64 || entry.align != layout.align() as u64 {
+                return Err("persistent class layout mismatch");
+            }
+
+            if entry.isolate_cache_lines != isolate_cache_lines as u32 {
+                return Err("persistent class isolate_cache_lines mismatch");
+            }
+
+            if entry.id.load(Ordering::Relaxed) != 0 {
+                return Err("persistent class already registered");
+            }
+
+            index
+        }
+        None => {
+            let index = header
+                .classes
+                .iter()
+                .position(|entry| entry.name[0] == 0)
+                .ok_or("too many persistent classes")?;
+            let entry = &mut header.classes[index];
+
+            entry.name[..name.len()].copy_from_slice(name.as_bytes());
+            entry.size = layout.size() as u64;
+            entry.align = layout.align() as u64;
+            entry.isolate_cache_lines = isolate_cache_lines as u32;
+            index
+        }
+    };
+
+    // The heap file may still disagree with itself; better fail
+    // here than when the press adopts the spans.
+    let spans = state.pending.get(&index).map_or(&[][..], |spans| &spans[..]);
+    for span in spans {
+        let meta = unsafe { &*(span.meta as *const SpanMetadata) };
+
+        if meta.bump_limit as usize != span.count * SPAN_ALIGNMENT / layout.size() {
+            return Err("persistent span does not match its class's layout");
+        }
+    }
+
+    header.classes[index].id.store(class_id, Ordering::Relaxed);
+    Ok(state.pending.remove(&index).unwrap_or_default())
+}
+
+#[contract_trait]
+impl Mapper for PersistentMapper {
+    fn page_size(&self) -> usize {
+        crate::map::page_size()
+    }
+
+    fn reserve(
+        &self,
+        _desired_size: usize,
+        data_size: usize,
+        prefix: usize,
+        suffix: usize,
+    ) -> Result<(NonNull<c_void>, usize), i32> {
+        assert_eq!(data_size, DATA_ALIGNMENT);
+        assert!(prefix < DATA_ALIGNMENT && suffix < DATA_ALIGNMENT);
+
+        let mut state = self.state.lock().unwrap();
+        let index = state.next_chunk;
+        if index >= self.max_chunks {
+            return Err(libc_errno::ENOMEM);
+        }
+
+        // We reserved the whole range upfront.
+        state.next_chunk += 1;
+        let data = self.chunk_data(index);
+        let page_size = crate::map::page_size();
+        let begin = (data - prefix) & !(page_size - 1);
+        let end = round_up_to_page(data + data_size + suffix);
+
+        Ok((
+            NonNull::new(begin as *mut c_void).expect("must be valid"),
+            end - begin,
+        ))
+    }
+
+    fn release(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        // Keep our address range to ourselves.
+        crate::map::release_region(base, size)?;
+        let _ = crate::map::reserve_fixed_region(base, size);
+        Ok(())
+    }
+
+    fn allocate_meta(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        let index = self.chunk_index(base.as_ptr() as usize);
+
+        self.map_chunk_range(index, self.chunk_meta(index), 0, base, size)
+    }
+
+    fn allocate_data(
+        &self,
+        base: NonNull<c_void>,
+        size: usize,
+        _node: Option<u32>,
+    ) -> Result<(), i32> {
+        let index = self.chunk_index(base.as_ptr() as usize);
+
+        self.map_chunk_range(
+            index,
+            self.chunk_data(index),
+            data_file_offset(),
+            base,
+            size,
+        )
+    }
+
+    fn purge_data(&self, base: NonNull<c_void>, size: usize) -> Result<(), i32> {
+        let mut state = self.state.lock().unwrap();
+        let address = base.as_ptr() as usize;
+        let file = self.chunk_file(&mut state, self.chunk_index(address))?;
+
+        crate::map::punch_file_region(file, self.data_offset(address), size)
+    }
+}
+
+impl ClassInfo {
+    /// Takes over `spans` from a previous process: objects in the
+    /// depot or never allocated go back in the depot, and the others
+    /// count as live allocations.
+    ///
+    /// That's every object below a span's bump pointer and with a
+    /// clear free bit, including objects the previous process left
+    /// in thread caches (or arenas, or CPU caches): they leak.
+    /// The purger and `Class::stats` treat them as live.
+    pub(crate) fn adopt_persistent_spans(&self, spans: Vec<PendingSpan>) {
+        let new_magazine = || {
+            let mut mag: PushMagazine = self.rack.allocate_empty_magazine();
+
+            // Partial magazines must stay below the limit, for
+            // `allocate_non_full_magazine`.
+            mag.set_limit(self.magazine_limit());
+            mag
+        };
+
+        let mut mag = new_magazine();
+        let mut live = 0;
+        for span in spans {
+            let meta_ptr = span.meta as *mut SpanMetadata;
+            let meta = unsafe { &mut *meta_ptr };
+            let trail = unsafe { std::slice::from_raw_parts_mut(meta_ptr.add(1), span.count - 1) };
+            let (begin, allocated, owned) =
+                self.press
+                    .adopt_span(meta, trail, span.count * SPAN_ALIGNMENT);
+
+            for i in 0..owned {
+                let address = begin + i * self.layout.size();
+                let block = NonNull::new(address as *mut c_void).expect("spans are never at NULL");
+                let (word, bit) = mill::free_bit_for_address(address);
+
+                // Depot objects go back in the depot, which sets their
+                // bit again.
+                if i < allocated && word.fetch_and(!bit, Ordering::Relaxed) & bit == 0 {
+                    #[cfg(any(
+                        all(test, feature = "check_contracts_in_tests"),
+                        feature = "check_contracts"
+                    ))]
+                    debug_allocation_map::mark_recovered(self.id, &block)
+                        .expect("Recovered objects must be fresh");
+
+                    live += 1;
+                    continue;
+                }
+
+                if let Some(block) = mag.put(LinearRef::new(block)) {
+                    let full = std::mem::replace(&mut mag, new_magazine());
+
+                    self.release_magazine(full, None);
+                    assert_eq!(mag.put(block), None);
+                }
+            }
+        }
+
+        self.counters.fold(live, 0);
+        self.release_magazine(mag, None);
+    }
+}
+
+/// Runs `restart_child` in a fresh process for `phase`, and checks
+/// it completed.
+#[cfg(test)]
+fn run_restart_child(dir: &Path, phase: &str) {
+    let done = dir.join(format!("{}.done", phase));
+    let _ = std::fs::remove_file(&done);
+    let status = std::process::Command::new(std::env::current_exe().expect("has exe"))
+        .args(&[
+            "--exact",
+            "persistent_mapper::restart_child",
+            "--ignored",
+            "--test-threads=1",
+        ])
+        .env("SLITTER_PERSISTENT_TEST_DIR", dir)
+        .env("SLITTER_PERSISTENT_TEST_PHASE", phase)
+        .status()
+        .expect("should spawn");
+
+    assert!(status.success());
+    assert!(done.exists(), "child did not run the {} phase", phase);
+}
+
+#[test]
+fn persistent_restart_test() {
+    let dir = tempfile::tempdir().expect("should create tempdir");
+
+    run_restart_child(dir.path(), "write");
+    run_restart_child(dir.path(), "read");
+    run_restart_child(dir.path(), "read");
+    run_restart_child(dir.path(), "release");
+    run_restart_child(dir.path(), "empty");
+}
+
+/// Builds a linked list in a persistent heap on the "write" phase,
+/// checks it on "read" phases, frees it with `release_any` on the
+/// "release" phase, and checks that the heap is empty on the "empty"
+/// phase.  Only `persistent_restart_test`
+/// runs this test, each time in a new process.
+#[test]
+#[ignore]
+fn restart_child() {
+    use crate::Class;
+    use crate::ClassConfig;
+
+    #[repr(C)]
+    struct Node {
+        value: usize,
+        next: *mut Node,
+    }
+
+    const COUNT: usize = 1000;
+
+    let dir = PathBuf::from(std::env::var_os("SLITTER_PERSISTENT_TEST_DIR").expect("has dir"));
+    let phase = std::env::var("SLITTER_PERSISTENT_TEST_PHASE").expect("has phase");
+    let config = |name: &str, mapper_name| ClassConfig {
+        mapper_name,
+        ..ClassConfig::for_test(name, std::mem::size_of::<Node>())
+    };
+
+    // Shift class ids around between phases.
+    if phase != "write" {
+        Class::new(config("persistent_padding", None)).expect("Should build");
+    }
+
+    register_persistent_mapper(
+        "persistent_test",
+        &dir,
+        0x3d00_0000_0000,
+        4 * DATA_ALIGNMENT,
+    )
+    .expect("Should register");
+    let class = Class::new(config("persistent_node", Some("persistent_test".into())))
+        .expect("Should build");
+    let root = persistent_root("persistent_test").expect("Should have a root");
+
+    let allocate = || class.allocate().expect("Should allocate").as_ptr() as *mut Node;
+    if phase == "write" || phase == "empty" {
+        assert!(root.load(Ordering::Relaxed).is_null());
+    }
+
+    // `flush_thread_cache` leaves objects in per-CPU caches, and they
+    // come back as live.
+    let exact_live_count = !cfg!(feature = "per_cpu_cache");
+
+    if phase == "empty" {
+        if exact_live_count {
+            assert_eq!(class.stats().live_objects, 0);
+        }
+
+        // The heap remembers the class's alignment.
+        let misaligned = ClassConfig {
+            layout: std::alloc::Layout::from_size_align(16, 16).expect("valid layout"),
+            ..config("persistent_node", Some("persistent_test".into()))
+        };
+        assert!(Class::new(misaligned).is_err());
+    } else if phase == "release" {
+        if exact_live_count {
+            assert_eq!(class.stats().live_objects, COUNT as u64);
+        }
+
+        let mut node = root.load(Ordering::Relaxed) as *mut Node;
+        while !node.is_null() {
+            let next = unsafe { (*node).next };
+
+            assert_eq!(
+                crate::usable_size(node as *const c_void),
+                std::mem::size_of::<Node>()
+            );
+            crate::release_any(NonNull::new(node as *mut c_void).expect("non-null"));
+            node = next;
+        }
+
+        root.store(std::ptr::null_mut(), Ordering::Relaxed);
+    } else if phase == "write" {
+        let mut head: *mut Node = std::ptr::null_mut();
+        for value in (0..COUNT).rev() {
+            let node = allocate();
+
+            unsafe { node.write(Node { value, next: head }) };
+            head = node;
+
+            // Leave some holes.
+            let garbage = allocate();
+            unsafe { (*garbage).value = usize::MAX };
+            class.release(NonNull::new(garbage as *mut c_void).expect("non-null"));
+        }
+
+        root.store(head as *mut c_void, Ordering::Relaxed);
+    } else {
+        // Freed objects are back in the depot.
+        assert!(class.stats().depot_magazines > 0);
+
+        let mut nodes = Vec::new();
+        let mut node = root.load(Ordering::Relaxed) as *mut Node;
+
+        while !node.is_null() {
+            assert_eq!(unsafe { (*node).value }, nodes.len());
+            assert_eq!(Class::of(node as *const c_void), Some(class));
+            nodes.push(node);
+            node = unsafe { (*node).next };
+        }
+
+        assert_eq!(nodes.len(), COUNT);
+
+        // New allocations never overwrite live objects.
+        let fresh: Vec<_> = (0..2 * COUNT).map(|_| allocate()).collect();
+        for node in fresh.iter() {
+            assert!(!nodes.contains(node));
+            unsafe { (**node).value = usize::MAX };
+        }
+
+        for node in fresh {
+            class.release(NonNull::new(node as *mut c_void).expect("non-null"));
+        }
+
+        for (i, node) in nodes.iter().enumerate() {
+            assert_eq!(unsafe { (**node).value }, i);
+        }
+    }
+
+    crate::flush_thread_cache();
+    File::create(dir.join(format!("{}.done", phase))).expect("should create");
+}
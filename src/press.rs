@@ -8,6 +8,12 @@
 //!
 //! We enable mostly lock-free operations by guaranteeing that each
 //! span and corresponding metadata is immortal once allocated.
+//!
+//! Replacing an exhausted span is lock-free as well, in the common
+//! case: each press keeps a fully initialised spare span, milled
+//! ahead of need, and threads that exhaust the current span swap the
+//! spare in with a CAS.  Only milling spans goes through the `Mill`'s
+//! locks, and threads only wait on them when the spare is missing.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -51,33 +57,122 @@ use crate::mill::Mill;
 use crate::mill::SpanMetadata;
 use crate::mill::MAX_SPAN_SIZE;
 use crate::Class;
+use crate::Prefault;
 
 /// We batch-allocate at most this many elements at once.  This limit
 /// makes it clear that a 64-bit counter will not wraparound.
 ///
 /// In practice, callers ask for one more than the magazine size, at
 /// most, and that's less than this limit.
-const MAX_ALLOCATION_BATCH: usize = 100;
+const MAX_ALLOCATION_BATCH: usize = 512;
 
 static_assertions::const_assert!(
-    (crate::magazine_impl::MAGAZINE_SIZE as usize) < MAX_ALLOCATION_BATCH
+    (crate::magazine_impl::MAX_MAGAZINE_SIZE as usize) < MAX_ALLOCATION_BATCH
 );
 
+/// Classes that isolate cache lines never hand out objects from the
+/// same line of this many bytes in different bump allocations.  That's
+/// a pair of lines, because of adjacent-line prefetching.
+pub const CACHE_LINE_SIZE: usize = 128;
+
+static_assertions::const_assert!(CACHE_LINE_SIZE <= mill::SPAN_ALIGNMENT);
+
+/// Returns the number of `object_size`-byte objects in the smallest
+/// run of objects that covers a whole number of cache lines.
+#[requires(object_size > 0)]
+#[ensures(ret > 0 && (ret * object_size) % CACHE_LINE_SIZE == 0)]
+fn cache_line_stride(object_size: usize) -> usize {
+    let gcd = |mut x: usize, mut y: usize| {
+        while y != 0 {
+            let r = x % y;
+            x = y;
+            y = r;
+        }
+
+        x
+    };
+
+    CACHE_LINE_SIZE / gcd(object_size, CACHE_LINE_SIZE)
+}
+
 /// We don't guarantee alignment greater than this value.
 pub const MAX_OBJECT_ALIGNMENT: usize = 4096;
 
 static_assertions::const_assert!(MAX_OBJECT_ALIGNMENT <= mill::MAX_SPAN_SIZE);
 
+// Spans start at multiples of `SPAN_ALIGNMENT`, and we pad object
+// sizes to their alignment, so each object in a span is aligned.
+static_assertions::const_assert!(MAX_OBJECT_ALIGNMENT <= mill::SPAN_ALIGNMENT);
+
 #[derive(Debug)]
 pub struct Press {
     /// The current span that services bump pointer allocation.
     bump: AtomicPtr<SpanMetadata>,
 
-    /// Writes to the bump itself (i.e., updating the `AtomicPtr`
-    /// itself) go through this lock.
+    /// A fresh span that's ready to replace `bump`, or NULL.  The
+    /// spare only leaves this slot once it has been published in
+    /// `bump`, so spans never go missing.
+    spare: AtomicPtr<SpanMetadata>,
+
+    /// Milling new spans (for `spare`) goes through this lock.
     mill: Mutex<&'static Mill>,
     layout: Layout,
     class: Class,
+    prefault: Prefault,
+
+    /// We bump-allocate objects in multiples of this many objects,
+    /// 1 unless the class isolates cache lines.
+    bump_stride: usize,
+
+    /// Number of spans we obtained from the mill (including the
+    /// spare), and their total size in bytes.  Only updated with the
+    /// `mill` lock held.
+    span_count: AtomicUsize,
+    span_bytes: AtomicUsize,
+
+    /// The data range (begin, size) of each of these spans.
+    spans: Mutex<Vec<(usize, usize)>>,
+}
+
+/// Populates the `size` bytes of span data at `begin` in the
+/// background prefault thread, or inline if we can't spawn that
+/// thread.
+fn prefault_in_background(begin: usize, size: usize) {
+    use std::sync::mpsc::Sender;
+
+    lazy_static::lazy_static! {
+        // `None` if we failed to spawn the worker thread.
+        static ref PREFAULT_QUEUE: Mutex<Option<Sender<(usize, usize)>>> = {
+            let (sender, receiver) = std::sync::mpsc::channel::<(usize, usize)>();
+
+            let worker = std::thread::Builder::new()
+                .name("slitter-prefault".into())
+                .spawn(move || {
+                    for (begin, size) in receiver {
+                        prefault_span(begin, size);
+                    }
+                });
+
+            Mutex::new(worker.ok().map(|_| sender))
+        };
+    }
+
+    let queued = match PREFAULT_QUEUE.lock().unwrap().as_ref() {
+        Some(sender) => sender.send((begin, size)).is_ok(),
+        None => false,
+    };
+
+    if !queued {
+        prefault_span(begin, size);
+    }
+}
+
+/// Populates the `size` bytes of span data at `begin`.  This is only
+/// an optimisation, so we ignore failures.
+fn prefault_span(begin: usize, size: usize) {
+    let base = NonNull::new(begin as *mut c_void).expect("spans are never at NULL");
+
+    let _ = crate::map::populate_region(base, size);
 }
 
 /// Returns Ok if the allocation `address` might have come from a `Press` for `class`.
@@ -100,10 +195,17 @@ pub fn check_allocation(class: Class, address: usize) -> Result<(), &'static str
 impl Press {
     /// Returns a fresh `Press` for an object `class` with that object
     /// `layout`, and the underlying mapper `mapper_name` (`None` for
-    /// the default `Mapper` / `Mill`).
+    /// the default `Mapper` / `Mill`).  The press populates new spans
+    /// according to its `prefault` policy.
     ///
     /// All presses with the same `mapper_name` share the same `Mill`.
     ///
+    /// When `isolate_cache_lines` is true, each bump allocation
+    /// starts and ends on a cache line boundary, so objects
+    /// allocated in different calls (e.g., for different magazines)
+    /// never share a cache line.  The press may skip up to a few
+    /// objects at the end of each allocation; it never pads objects.
+    ///
     /// # Errors
     ///
     /// Returns `Err` when the layout violates the allocator's constraints,
@@ -112,6 +214,8 @@ impl Press {
         class: Class,
         mut layout: Layout,
         mapper_name: Option<&str>,
+        prefault: Prefault,
+        isolate_cache_lines: bool,
     ) -> Result<Self, &'static str> {
         if layout.align() > MAX_OBJECT_ALIGNMENT {
             return Err("slitter only supports alignment up to 4 KB");
@@ -125,13 +229,74 @@ impl Press {
         } else {
             Ok(Self {
                 bump: Default::default(),
+                spare: Default::default(),
                 mill: Mutex::new(mill::get_mill(mapper_name)?),
                 layout,
                 class,
+                prefault,
+                bump_stride: if isolate_cache_lines {
+                    cache_line_stride(layout.size())
+                } else {
+                    1
+                },
+                span_count: AtomicUsize::new(0),
+                span_bytes: AtomicUsize::new(0),
+                spans: Default::default(),
             })
         }
     }
 
+    /// Returns the number of spans this press has allocated from, and
+    /// their total size in bytes.
+    pub fn span_stats(&self) -> (usize, usize) {
+        (
+            self.span_count.load(Ordering::Relaxed),
+            self.span_bytes.load(Ordering::Relaxed),
+        )
+    }
+
+    /// Lets the OS reclaim the whole pages in `[begin, end)`, a range
+    /// of free objects for `self.class`.  The objects keep their
+    /// class, but their contents become undefined.
+    ///
+    /// Returns the number of bytes purged.
+    pub fn purge_free_range(&self, begin: usize, end: usize) -> usize {
+        let mill: &'static Mill = *self.mill.lock().unwrap();
+        let page_size = mill.page_size();
+        let first_page = (begin + page_size - 1) & !(page_size - 1);
+        let last_page = end & !(page_size - 1);
+
+        if first_page >= last_page {
+            return 0;
+        }
+
+        let base = NonNull::new(first_page as *mut c_void).expect("spans are never at NULL");
+        match mill.purge_data(base, last_page - first_page) {
+            Ok(()) => last_page - first_page,
+            Err(_) => 0,
+        }
+    }
+
+    /// Tells the OS that all the spans for `self.class` are cold, or,
+    /// if `pageout` is true, that it should reclaim them right away.
+    /// The objects' contents do not change.
+    ///
+    /// Returns the number of bytes advised, or the first error.
+    pub fn advise_cold(&self, pageout: bool) -> Result<usize, i32> {
+        let mill: &'static Mill = *self.mill.lock().unwrap();
+        let spans = self.spans.lock().unwrap().clone();
+        let mut advised = 0;
+
+        for (begin, size) in spans {
+            let base = NonNull::new(begin as *mut c_void).expect("spans are never at NULL");
+
+            mill.advise_cold_data(base, size, pageout)?;
+            advised += size;
+        }
+
+        Ok(advised)
+    }
+
     /// Associates the `count` allocations starting at `begin` with `self.class`.
     #[cfg(any(
         all(test, feature = "check_contracts_in_tests"),
@@ -175,15 +340,18 @@ impl Press {
     }
 
     /// Attempts to allocate up to `max_count` consecutive object by
-    /// bumping the metadata pointer.
+    /// bumping the metadata pointer.  Classes that isolate cache lines
+    /// always bump whole strides: we round `max_count` down to a
+    /// stride when we can, and otherwise return one full stride,
+    /// i.e., more than `max_count` objects.
     ///
     /// Returns the address of the first object and the number of
     /// allocations on success.
     #[requires(debug_arange_map::is_metadata(meta as * mut SpanMetadata as usize,
                                              std::mem::size_of::<SpanMetadata>()).is_ok(),
                "The `meta` reference must come from a metadata range.")]
-    #[ensures(ret.is_some() -> ret.unwrap().1.get() <= max_count.get(),
-              "We never return more than `max_count` allocations.")]
+    #[ensures(ret.is_some() -> ret.unwrap().1.get() <= max_count.get().max(self.bump_stride),
+              "We never return more than `max_count` allocations, or one stride.")]
     #[ensures(ret.is_some() -> ret.unwrap().0.get() as usize % self.layout.align() == 0,
               "The base address is correctly aligned.")]
     #[ensures(ret.is_some() -> self.associate_range(ret.unwrap().0.get(), ret.unwrap().1.get()).is_ok(),
@@ -198,8 +366,11 @@ impl Press {
         meta: &mut SpanMetadata,
         max_count: NonZeroUsize,
     ) -> Option<(NonZeroUsize, NonZeroUsize)> {
-        let desired = max_count.get().clamp(0, MAX_ALLOCATION_BATCH);
         let limit = meta.bump_limit as usize;
+        // Always reserve whole strides, so every allocation starts at
+        // a multiple of `bump_stride`.
+        let stride = self.bump_stride;
+        let desired = (max_count.get().clamp(0, MAX_ALLOCATION_BATCH) / stride).max(1) * stride;
 
         let allocated_id = meta.bump_ptr.fetch_add(desired, Ordering::Relaxed);
         if allocated_id >= limit {
@@ -213,7 +384,9 @@ impl Press {
         let actual = (limit - allocated_id).clamp(0, desired);
 
         // `meta.bump_ptr` is incremented atomically, so
-        // we always return fresh addresses.
+        // we always return fresh addresses.  `span_begin` is
+        // span-aligned, and the object size a multiple of the
+        // layout's alignment, so every object is correctly aligned.
         //
         // XXX: This expression has to satisfy the `ensures`
         // postconditions; they're checked in
@@ -255,32 +428,22 @@ impl Press {
     #[inline]
     fn assert_new_bump_is_safe(&self, _bump: *mut SpanMetadata) {}
 
-    /// Attempts to replace our bump pointer with a new one.
-    #[ensures(ret.is_ok() ->
-              self.bump.load(Ordering::Relaxed) != old(self.bump.load(Ordering::Relaxed)),
-              "On success, the bump Span has been updated.")]
-    #[ensures(debug_arange_map::is_metadata(self.bump.load(Ordering::Relaxed) as usize,
-                                            std::mem::size_of::<SpanMetadata>()).is_ok(),
-              "The bump struct must point to a valid metadata range.")]
-    fn try_replace_span(&self, expected: *mut SpanMetadata) -> Result<(), i32> {
-        if self.bump.load(Ordering::Relaxed) != expected {
-            // Someone else made progress.
-
-            return Ok(());
-        }
-
-        let mill = self.mill.lock().unwrap();
-        // Check again with the lock held, before allocating a new span.
-        if self.bump.load(Ordering::Relaxed) != expected {
-            return Ok(());
-        }
-
+    /// Obtains a new span from `mill`, and initialises its metadata
+    /// for `self.class`.  The span isn't published anywhere yet.
+    fn mill_span(&self, mill: &'static Mill) -> Result<&'static mut SpanMetadata, i32> {
         // Get a new span.  It must have enough bytes for one
         // allocation, but will usually have more (the default desired
         // size, nearly 1 MB).
         let range = mill.get_span(self.layout.size(), None)?;
         let meta: &mut _ = range.meta;
 
+        self.span_count.fetch_add(1, Ordering::Relaxed);
+        self.span_bytes.fetch_add(range.data_size, Ordering::Relaxed);
+        self.spans
+            .lock()
+            .unwrap()
+            .push((range.data as usize, range.data_size));
+
         // We should have a fresh Metadata struct before claiming it as ours.
         assert_eq!(meta.class_id, None);
         meta.class_id = Some(self.class.id());
@@ -297,15 +460,170 @@ impl Press {
             // This Metadata struct must not already be allocated.
             assert_eq!(trailing_meta.class_id, None);
             trailing_meta.class_id = Some(self.class.id());
+            // Let `free_bitmap` find object boundaries from any
+            // address in the span.
+            trailing_meta.span_begin = range.data as usize;
+        }
+
+        // Spans are page-aligned, and their size a multiple of the
+        // page size.  Populating a span doesn't change its contents,
+        // so it's safe to do in the background, even once the span
+        // is published.
+        match self.prefault {
+            Prefault::Never => (),
+            Prefault::Inline => prefault_span(range.data as usize, range.data_size),
+            Prefault::Background => prefault_in_background(range.data as usize, range.data_size),
         }
 
-        // Publish the metadata for our fresh span.
-        assert_eq!(self.bump.load(Ordering::Relaxed), expected);
         self.assert_new_bump_is_safe(meta);
-        self.bump.store(meta, Ordering::Release);
+        Ok(meta)
+    }
+
+    /// Takes over the span for `meta` and its `trail`, which a
+    /// previous process milled for a class with our layout: see
+    /// `persistent_mapper.rs`.  The span's `data_size` bytes are
+    /// already mapped, and may hold live objects.
+    ///
+    /// Returns the span's first object address, the number of
+    /// objects the previous process bump-allocated, and the number
+    /// of objects (from the beginning of the span) the caller now
+    /// owns.  The press keeps the others: when it has no bump span
+    /// yet, it bump-allocates from the rest of this span.
+    pub fn adopt_span(
+        &self,
+        meta: &'static mut SpanMetadata,
+        trail: &mut [SpanMetadata],
+        data_size: usize,
+    ) -> (usize, usize, usize) {
+        // Span statistics only change with the `mill` lock held.
+        let _mill = self.mill.lock().unwrap();
+        let limit = meta.bump_limit as usize;
+
+        debug_assert_eq!(
+            limit,
+            data_size / self.layout.size(),
+            "`claim_spans` only returns spans that match the class's layout."
+        );
+
+        meta.class_id = Some(self.class.id());
+        for trailing_meta in trail {
+            trailing_meta.class_id = Some(self.class.id());
+        }
+
+        self.span_count.fetch_add(1, Ordering::Relaxed);
+        self.span_bytes.fetch_add(data_size, Ordering::Relaxed);
+        self.spans
+            .lock()
+            .unwrap()
+            .push((meta.span_begin, data_size));
+
+        // `bump_ptr` overshoots the limit once the span is exhausted.
+        let allocated = meta.bump_ptr.load(Ordering::Relaxed).min(limit);
+        let begin = meta.span_begin;
+        let meta_ptr: *mut SpanMetadata = meta;
+        let owned = if allocated < limit
+            && self
+                .bump
+                .compare_exchange(
+                    std::ptr::null_mut(),
+                    meta_ptr,
+                    Ordering::AcqRel,
+                    Ordering::Relaxed,
+                )
+                .is_ok()
+        {
+            allocated
+        } else {
+            unsafe { &*meta_ptr }
+                .bump_ptr
+                .store(limit, Ordering::Relaxed);
+            limit
+        };
+
+        #[cfg(any(
+            all(test, feature = "check_contracts_in_tests"),
+            feature = "check_contracts"
+        ))]
+        self.associate_range(begin, owned)
+            .expect("Adopted objects must be fresh");
+
+        (begin, allocated, owned)
+    }
+
+    /// Mills a new spare span if we don't have one, with the `mill`
+    /// lock held.
+    fn fill_spare(&self, mill: &'static Mill) -> Result<(), i32> {
+        if self.spare.load(Ordering::Relaxed).is_null() {
+            let meta = self.mill_span(mill)?;
+
+            // Only `fill_spare` populates `spare`, with the lock held.
+            self.spare.store(meta, Ordering::Release);
+        }
+
         Ok(())
     }
 
+    /// Attempts to replace our bump pointer with a new one.
+    #[ensures(ret.is_ok() -> self.bump.load(Ordering::Relaxed) != expected,
+              "On success, the bump Span has been updated.")]
+    #[ensures(debug_arange_map::is_metadata(self.bump.load(Ordering::Relaxed) as usize,
+                                            std::mem::size_of::<SpanMetadata>()).is_ok(),
+              "The bump struct must point to a valid metadata range.")]
+    fn try_replace_span(&self, expected: *mut SpanMetadata) -> Result<(), i32> {
+        loop {
+            if self.bump.load(Ordering::Relaxed) != expected {
+                // Someone else made progress.
+
+                return Ok(());
+            }
+
+            let spare = self.spare.load(Ordering::Acquire);
+            if spare.is_null() {
+                // No spare: wait for the mill, then try again.
+                let mill: &'static Mill = *self.mill.lock().unwrap();
+
+                self.fill_spare(mill)?;
+                continue;
+            }
+
+            if spare == expected {
+                // The spare was published and exhausted before the
+                // thread that published it cleared it from `spare`.
+                let _ = self.spare.compare_exchange(
+                    spare,
+                    std::ptr::null_mut(),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                );
+                continue;
+            }
+
+            // Publish the metadata for our fresh span.  Span metadata
+            // are immortal and never reused, so there's no ABA.
+            if self
+                .bump
+                .compare_exchange(expected, spare, Ordering::AcqRel, Ordering::Relaxed)
+                .is_ok()
+            {
+                // The spare is now in use.  Clear it, and mill the
+                // next one ahead of need, unless someone is already
+                // milling a span; we'll try again next time.
+                let _ = self.spare.compare_exchange(
+                    spare,
+                    std::ptr::null_mut(),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                );
+
+                if let Ok(mill) = self.mill.try_lock() {
+                    let _ = self.fill_spare(*mill);
+                }
+
+                return Ok(());
+            }
+        }
+    }
+
     /// Attempts to allocate up to `max_count` objects.  Returns Ok()
     /// if we tried to allocate from the current bump region.
     ///
@@ -315,8 +633,8 @@ impl Press {
     ///
     /// Returns `Err` if we failed to grab a new bump region.
     #[ensures(ret.is_ok() && ret.unwrap().is_some() ->
-              ret.unwrap().unwrap().1.get() <= max_count.get(),
-              "We never overallocate.")]
+              ret.unwrap().unwrap().1.get() <= max_count.get().max(self.bump_stride),
+              "We never overallocate by more than a stride.")]
     #[ensures(ret.is_ok() && ret.unwrap().is_some() ->
               self.is_range_associated_and_free(ret.unwrap().unwrap().0.get(), ret.unwrap().unwrap().1.get()).is_ok(),
               "Successful allocations are fresh, or match the class and avoid double-allocation.")]
@@ -341,10 +659,11 @@ impl Press {
         self.try_replace_span(meta_ptr).map(|_| None)
     }
 
-    /// Tries to allocate up to `max_count` objects.  Only fails on OOM.
+    /// Tries to allocate up to `max_count` objects, or one stride of
+    /// objects.  Only fails on OOM.
     #[ensures(ret.is_some() ->
-              ret.unwrap().1.get() <= max_count.get(),
-              "We never overallocate.")]
+              ret.unwrap().1.get() <= max_count.get().max(self.bump_stride),
+              "We never overallocate by more than a stride.")]
     #[ensures(ret.is_some() ->
               self.is_range_associated_and_free(ret.unwrap().0.get(), ret.unwrap().1.get()).is_ok(),
               "Successful allocations are fresh, or match the class and avoid double-allocation.")]
@@ -371,14 +690,31 @@ impl Press {
               check_allocation(self.class, ret.as_ref().unwrap().get().as_ptr() as usize).is_ok(),
               "Sucessful allocations must have the allocation metadata set correctly.")]
     pub fn allocate_one_object(&self) -> Option<LinearRef> {
-        let (address, _count) = self.try_allocate(NonZeroUsize::new(1).unwrap())?;
+        let (address, count) = self.try_allocate(NonZeroUsize::new(1).unwrap())?;
 
-        debug_assert_eq!(_count.get(), 1);
+        self.release_surplus(address.get() + self.layout.size(), count.get() - 1);
         Some(LinearRef::new(unsafe {
             NonNull::new_unchecked(address.get() as *mut c_void)
         }))
     }
 
+    /// Hands the `count` fresh objects at `begin`, which we bumped
+    /// past what the caller asked for, to the class's depot.  They
+    /// share cache lines with the caller's objects, but that's better
+    /// than leaking them.
+    fn release_surplus(&self, begin: usize, count: usize) {
+        if count == 0 {
+            return;
+        }
+
+        let elsize = self.layout.size();
+        self.class
+            .info()
+            .release_free_objects((0..count).map(|i| {
+                LinearRef::new(unsafe { NonNull::new_unchecked((begin + i * elsize) as *mut c_void) })
+            }));
+    }
+
     /// Attempts to allocate multiple objects: first the second return
     /// value, and then as many elements in `dst` as possible.
     ///
@@ -429,9 +765,91 @@ impl Press {
                 }
 
                 debug_assert!(populated <= count.get());
+                self.release_surplus(address, count.get() - 1 - populated);
                 (populated, ret)
             }
             None => (0, None),
         }
     }
 }
+
+#[test]
+fn concurrent_span_replacement() {
+    use std::collections::HashSet;
+
+    use crate::ClassConfig;
+
+    // Only a few objects fit in each span, so threads constantly
+    // replace the press's span.
+    let size = MAX_SPAN_SIZE / 4;
+    let class = Class::new(ClassConfig::for_test("concurrent_span_replacement", size))
+        .expect("Should build");
+
+    let workers: Vec<_> = (0..4)
+        .map(|_| {
+            std::thread::spawn(move || {
+                (0..50)
+                    .map(|_| {
+                        class
+                            .info()
+                            .press
+                            .allocate_one_object()
+                            .expect("Should allocate")
+                            .convert_to_non_null()
+                            .as_ptr() as usize
+                    })
+                    .collect::<Vec<usize>>()
+            })
+        })
+        .collect();
+
+    let mut addresses = HashSet::new();
+    for worker in workers {
+        for address in worker.join().expect("worker should succeed") {
+            assert!(addresses.insert(address), "Addresses must be unique");
+        }
+    }
+
+    // We always mill a spare ahead of need.
+    let (span_count, _) = class.info().press.span_stats();
+    assert!(span_count >= 2);
+}
+
+#[test]
+fn isolate_cache_lines() {
+    use crate::ClassConfig;
+
+    assert_eq!(cache_line_stride(8), CACHE_LINE_SIZE / 8);
+    assert_eq!(cache_line_stride(24), CACHE_LINE_SIZE / 8);
+    assert_eq!(cache_line_stride(96), 4);
+    assert_eq!(cache_line_stride(2 * CACHE_LINE_SIZE), 1);
+
+    let class = Class::new(ClassConfig {
+        isolate_cache_lines: true,
+        ..ClassConfig::for_test("isolate_cache_lines", 24)
+    })
+    .expect("Should build");
+    let press = &class.info().press;
+
+    // Each batch of objects starts and ends on its own lines.
+    let mut lines = std::collections::HashSet::new();
+    for _ in 0..100 {
+        let mut dst: [MaybeUninit<LinearRef>; 4] = unsafe { MaybeUninit::uninit().assume_init() };
+        let (count, first) = press.allocate_many_objects(&mut dst);
+        let first = first.expect("Should allocate").convert_to_non_null().as_ptr() as usize;
+
+        assert_eq!(first % CACHE_LINE_SIZE, 0);
+        for line in first / CACHE_LINE_SIZE..=(first + (count + 1) * 24 - 1) / CACHE_LINE_SIZE {
+            assert!(lines.insert(line), "Batches must not share cache lines");
+        }
+
+        for uninit in dst.iter().take(count) {
+            let _ = unsafe { uninit.as_ptr().read() }.convert_to_non_null();
+        }
+    }
+
+    // The rest of each stride went to the depot (strides may be cut
+    // short at the end of a span).
+    let surplus = class.stats().depot_objects;
+    assert!(surplus > 0 && surplus <= 100 * (cache_line_stride(24) - 5) as u64);
+}
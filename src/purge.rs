@@ -0,0 +1,132 @@
+//! Spans are immortal, so the only way to shrink a class's footprint
+//! after a spike is to let the OS reclaim the pages behind cached
+//! objects, without changing the pages' mapping or class.
+//!
+//! Purging only looks at magazines in the class's depot: objects in
+//! thread (or CPU) caches are part of the working set.  A page is
+//! purged when all the objects that overlap with it are free in the
+//! depot; the objects stay in their magazines, ready for reuse.
+//!
+//! Classes can also tell the OS that all their pages are cold, live
+//! objects included, so they get swapped out first (to the backing
+//! file, with the file-backed mapper) under memory pressure, or
+//! right away.
+use crate::class::Class;
+use crate::magazine::PopMagazine;
+
+impl Class {
+    /// Lets the OS reclaim the pages that only back free objects of
+    /// this `Class` in its depot, except for (at least) `keep`
+    /// objects in the most recently cached magazines.
+    ///
+    /// Purged objects remain allocated to the class (reads and writes
+    /// stay safe), but their contents become undefined until they are
+    /// reallocated.
+    ///
+    /// Returns the number of bytes purged.
+    pub fn purge(self, keep: usize) -> usize {
+        let info = self.info();
+        let object_size = info.layout.size();
+        let mags: Vec<(usize, PopMagazine)> = info.depot.pop_all();
+
+        // Most recently cached magazines are at the top of each
+        // stack, so `pop_all` returns them first.
+        let mut kept = 0;
+        let mut objects: Vec<usize> = Vec::new();
+        for (_, mag) in mags.iter() {
+            let populated = mag.get_populated();
+
+            if kept < keep {
+                kept += populated.len();
+                continue;
+            }
+
+            objects.extend(
+                populated
+                    .iter()
+                    .map(|slot| unsafe { (*slot.as_ptr()).get().as_ptr() as usize }),
+            );
+        }
+
+        objects.sort_unstable();
+
+        // Coalesce adjacent free objects into ranges, and purge the
+        // pages that are fully covered by each range.
+        let mut purged = 0;
+        let mut current: Option<(usize, usize)> = None;
+        for begin in objects {
+            match current.as_mut() {
+                Some(range) if range.1 == begin => range.1 += object_size,
+                _ => {
+                    if let Some((begin, end)) = current.replace((begin, begin + object_size)) {
+                        purged += info.press.purge_free_range(begin, end);
+                    }
+                }
+            }
+        }
+
+        if let Some((begin, end)) = current {
+            purged += info.press.purge_free_range(begin, end);
+        }
+
+        // Purged or not, the objects are still free: send the
+        // magazines back to the depot shards they came from.
+        for (shard, mag) in mags {
+            info.depot.push_to_shard(shard, mag);
+        }
+
+        purged
+    }
+
+    /// Tells the OS that all the pages behind this `Class`'s objects
+    /// are cold (`MADV_COLD`), or, if `pageout` is true, asks it to
+    /// reclaim them now (`MADV_PAGEOUT`).  Objects keep their
+    /// contents, but reads and writes may page fault.
+    ///
+    /// Returns the number of bytes advised.
+    ///
+    /// # Errors
+    ///
+    /// Returns `Err(errno)` when the mapper or kernel rejects the
+    /// advice, e.g., `EINVAL` on kernels older than 5.4 or for
+    /// hugetlb mappings.
+    pub fn advise_cold(self, pageout: bool) -> Result<usize, i32> {
+        self.info().press.advise_cold(pageout)
+    }
+}
+
+#[test]
+fn purge_smoke_test() {
+    use std::ffi::c_void;
+    use std::ptr::NonNull;
+
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig::for_test("purge", 64)).expect("Should build");
+
+    let allocs: Vec<NonNull<c_void>> = (0..20000)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+
+    for alloc in allocs {
+        unsafe { std::ptr::write_bytes(alloc.as_ptr() as *mut u8, 42, 64) };
+        class.release(alloc);
+    }
+
+    // Holding back everything purges nothing.
+    assert_eq!(class.purge(usize::MAX), 0);
+    assert!(class.purge(0) > 0);
+
+    // Purged objects are still usable, and zero-initialised on
+    // allocation.
+    let allocs: Vec<NonNull<c_void>> = (0..20000)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+
+    for alloc in allocs {
+        assert!(unsafe { std::slice::from_raw_parts(alloc.as_ptr() as *const u8, 64) }
+            .iter()
+            .all(|x| *x == 0));
+        class.release(alloc);
+    }
+}
@@ -1,5 +1,6 @@
 //! A `Rack` manages empty `Magazine`s: it allocates them as needed,
-//! and recycles unused empty ones.
+//! and recycles unused empty ones.  There is one global `Rack` per
+//! magazine capacity bucket.
 #[cfg(any(
     all(test, feature = "check_contracts_in_tests"),
     feature = "check_contracts"
@@ -13,18 +14,21 @@ use disabled_contracts::*;
 
 use crate::magazine::Magazine;
 use crate::magazine_impl::MagazineImpl;
+use crate::magazine_impl::MagazineStorage;
+use crate::magazine_impl::MAGAZINE_SIZE;
+use crate::magazine_impl::MAGAZINE_SIZE_BUCKETS;
 use crate::magazine_stack::MagazineStack;
 
-/// A `Rack` allocates and recycles empty magazines.
+/// A `Rack` allocates and recycles empty magazines, all with the
+/// same capacity.
 pub struct Rack {
+    magazine_size: u32,
     freelist: MagazineStack,
 }
 
 impl Rack {
-    pub fn new() -> Self {
-        use crate::magazine_impl::MagazineStorage;
-        use crate::magazine_impl::MAGAZINE_SIZE;
-
+    #[requires(magazine_size > 0)]
+    pub fn new(magazine_size: u32) -> Self {
         extern "C" {
             fn slitter__magazine_size() -> usize;
             fn slitter__magazine_storage_sizeof() -> usize;
@@ -56,30 +60,66 @@ impl Rack {
         }
 
         Self {
+            magazine_size,
             freelist: MagazineStack::new(),
         }
     }
+
+    /// Returns the capacity of the magazines in this rack.
+    #[inline(always)]
+    pub fn magazine_size(&self) -> usize {
+        self.magazine_size as usize
+    }
 }
 
-/// Returns a reference to the global default magazine rack.
-pub fn get_default_rack() -> &'static Rack {
-    lazy_static::lazy_static! { static ref RACK: Rack = Rack::new(); };
+/// Returns a reference to the global rack for the smallest capacity
+/// bucket that fits `magazine_size` allocations.  Requests larger
+/// than the largest bucket get that largest bucket.
+#[ensures(ret.magazine_size() >= magazine_size.min(crate::magazine_impl::MAX_MAGAZINE_SIZE as usize))]
+pub fn get_rack(magazine_size: usize) -> &'static Rack {
+    lazy_static::lazy_static! {
+        static ref RACKS: Vec<Rack> = MAGAZINE_SIZE_BUCKETS
+            .iter()
+            .map(|size| Rack::new(*size))
+            .collect();
+    };
+
+    RACKS
+        .iter()
+        .find(|rack| rack.magazine_size() >= magazine_size)
+        .unwrap_or_else(|| RACKS.last().expect("MAGAZINE_SIZE_BUCKETS is not empty"))
+}
 
-    &RACK
+/// Returns a reference to the global rack for the default
+/// magazine size.
+#[ensures(ret.magazine_size() == MAGAZINE_SIZE as usize)]
+pub fn get_default_rack() -> &'static Rack {
+    get_rack(MAGAZINE_SIZE as usize)
 }
 
 impl Rack {
     #[ensures(ret.has_storage() && ret.is_empty(), "Newly allocated magazines are empty.")]
+    #[ensures(ret.0.capacity() == self.magazine_size(),
+              "Magazines match the rack's capacity.")]
+    #[ensures(ret.0.limit() == self.magazine_size(),
+              "Magazines start with their full capacity available.")]
     #[inline(always)]
     pub fn allocate_empty_magazine<const PUSH_MAG: bool>(&self) -> Magazine<PUSH_MAG> {
-        self.freelist.pop().unwrap_or_else(|| {
-            Magazine(MagazineImpl::new(Some(Box::leak(Box::new(
-                Default::default(),
-            )))))
-        })
+        match self.freelist.pop() {
+            Some(mut mag) => {
+                // The previous user may have lowered the limit.
+                mag.0.set_limit(self.magazine_size());
+                mag
+            }
+            None => Magazine(MagazineImpl::new(Some(MagazineStorage::allocate(
+                self.magazine_size as u16,
+            )))),
+        }
     }
 
     #[requires(!mag.has_storage() || mag.is_empty(), "Only empty magazines are released to the Rack.")]
+    #[requires(!mag.has_storage() || mag.0.capacity() == self.magazine_size(),
+               "Magazines must go back to the rack for their capacity.")]
     pub fn release_empty_magazine<const PUSH_MAG: bool>(&self, mag: Magazine<PUSH_MAG>) {
         // This function is only called during thread shutdown, and
         // things will really break if mag is actually non-empty.
@@ -95,3 +135,17 @@ fn smoke_test_rack() {
 
     rack.release_empty_magazine(mag);
 }
+
+#[test]
+fn rack_buckets() {
+    assert_eq!(get_rack(1).magazine_size(), MAGAZINE_SIZE_BUCKETS[0] as usize);
+    assert_eq!(get_rack(15).magazine_size(), 30);
+    assert_eq!(get_rack(30).magazine_size(), 30);
+    assert_eq!(get_rack(usize::MAX).magazine_size(), 510);
+
+    let rack = get_rack(200);
+    let mag = rack.allocate_empty_magazine::<false>();
+    assert_eq!(mag.0.capacity(), 254);
+
+    rack.release_empty_magazine(mag);
+}
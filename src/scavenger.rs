@@ -0,0 +1,92 @@
+//! Long-lived threads that go idle pin their cached magazines until
+//! they exit.  The optional scavenger thread periodically scans all
+//! thread caches, and scavenges the ones that did not enter their
+//! slow path since the previous scan.
+//!
+//! The scavenger only reclaims the slow path's spare magazines and
+//! inboxes, which it returns to their classes.  It never touches the
+//! magazines on the allocation and release fast paths: idle threads
+//! keep these until they exit or call `flush_thread_cache`.
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::Ordering;
+use std::sync::Arc;
+use std::sync::Mutex;
+use std::sync::Once;
+use std::time::Duration;
+
+use crate::cache::SharedCache;
+
+lazy_static::lazy_static! {
+    static ref THREAD_CACHES: Mutex<Vec<Arc<SharedCache>>> = Default::default();
+}
+
+/// Milliseconds between two scans; 0 pauses the scavenger.
+static SCAVENGE_PERIOD_MS: AtomicU64 = AtomicU64::new(0);
+
+/// When the scavenger is paused, it checks for a new period this often.
+const PAUSED_POLL_PERIOD: Duration = Duration::from_secs(1);
+
+/// Makes `cache` visible to the scavenger.
+pub(crate) fn register(cache: Arc<SharedCache>) {
+    THREAD_CACHES.lock().unwrap().push(cache);
+}
+
+/// Undoes a call to `register(cache)`.
+pub(crate) fn unregister(cache: &Arc<SharedCache>) {
+    THREAD_CACHES
+        .lock()
+        .unwrap()
+        .retain(|other| !Arc::ptr_eq(other, cache));
+}
+
+/// Scans all registered thread caches once, and returns the number of
+/// idle caches we scavenged.
+pub(crate) fn scan() -> usize {
+    // Don't block thread creation and exit while we scavenge.
+    let caches = THREAD_CACHES.lock().unwrap().clone();
+    let infos = crate::class::class_infos_from(1);
+
+    caches
+        .iter()
+        .filter(|cache| cache.scavenge_if_idle(&infos))
+        .count()
+}
+
+/// Updates the period between two scavenger scans, and starts the
+/// scavenger thread if necessary.  A thread is idle when it doesn't
+/// enter any slow path for a full period.  A zero `period` pauses
+/// the scavenger, which is the default.
+pub fn set_cache_scavenge_period(period: Duration) {
+    static START: Once = Once::new();
+
+    let period_ms = period.as_millis().min(u64::MAX as u128) as u64;
+    // Don't let a sub-millisecond period pause the scavenger.
+    let period_ms = if period.is_zero() {
+        0
+    } else {
+        period_ms.max(1)
+    };
+
+    SCAVENGE_PERIOD_MS.store(period_ms, Ordering::Relaxed);
+    if period_ms == 0 {
+        return;
+    }
+
+    START.call_once(|| {
+        // If we fail to spawn the thread, idle threads keep their
+        // caches, as if the scavenger were paused.
+        let _ = std::thread::Builder::new()
+            .name("slitter-scavenger".into())
+            .spawn(|| loop {
+                match SCAVENGE_PERIOD_MS.load(Ordering::Relaxed) {
+                    0 => std::thread::sleep(PAUSED_POLL_PERIOD),
+                    period_ms => {
+                        std::thread::sleep(Duration::from_millis(period_ms));
+                        if SCAVENGE_PERIOD_MS.load(Ordering::Relaxed) != 0 {
+                            scan();
+                        }
+                    }
+                }
+            });
+    });
+}
@@ -0,0 +1,157 @@
+//! Per-class statistics.
+//!
+//! The allocation and release fast paths only update plain counters
+//! in each thread's cache, next to that thread's magazines (see
+//! `Magazines` in `cache.rs`).  The thread folds these counters into
+//! the class's atomic `ClassCounters` whenever it hits a slow path,
+//! and when its cache is destroyed.  Classes in the per-CPU cache
+//! instead count whole magazines as they enter and leave CPU slots.
+//!
+//! Snapshots thus lag behind the fast paths, but the allocation and
+//! release counts lag together: the difference between them (the
+//! number of live objects) is only off by about a magazine's worth
+//! of objects per thread (or CPU).
+use std::sync::atomic::AtomicU64;
+use std::sync::atomic::Ordering;
+
+use crate::class::Class;
+
+/// Global totals for a class, updated on slow paths.
+#[derive(Debug, Default)]
+pub(crate) struct ClassCounters {
+    allocations: AtomicU64,
+    releases: AtomicU64,
+    slow_allocations: AtomicU64,
+    slow_releases: AtomicU64,
+}
+
+/// A snapshot of a class's statistics, as returned by
+/// `Class::stats` and `slitter_class_stats`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct ClassStats {
+    /// Number of objects currently allocated, up to the lag in the
+    /// per-thread counters.
+    pub live_objects: u64,
+    /// Total number of allocations and releases.
+    pub allocations: u64,
+    pub releases: u64,
+    /// Number of spans the class has ever obtained, and their total
+    /// size in bytes.  Spans are immortal.
+    pub span_count: u64,
+    pub bytes_mapped: u64,
+    /// Number of magazines in the class's depot, and of free objects
+    /// in these magazines.
+    pub depot_magazines: u64,
+    pub depot_objects: u64,
+    /// Number of times threads refilled or flushed a magazine for
+    /// this class.
+    pub slow_allocations: u64,
+    pub slow_releases: u64,
+    /// Number of magazines threads found in their local depot shard,
+    /// and stole from remote shards.
+    pub depot_local_pops: u64,
+    pub depot_remote_pops: u64,
+    /// Number of failed updates to the depot's stacks, under
+    /// contention, and of magazines handed over directly from a
+    /// releasing thread to an allocating one.
+    pub depot_cas_failures: u64,
+    pub depot_eliminations: u64,
+}
+
+impl ClassCounters {
+    /// Adds a thread's allocation and release counts to the totals.
+    #[inline]
+    pub fn fold(&self, allocations: u64, releases: u64) {
+        if allocations > 0 {
+            self.allocations.fetch_add(allocations, Ordering::Relaxed);
+        }
+
+        if releases > 0 {
+            self.releases.fetch_add(releases, Ordering::Relaxed);
+        }
+    }
+
+    /// Backs out allocations that were counted ahead of time, but
+    /// did not happen.
+    #[cfg(feature = "per_cpu_cache")]
+    #[inline]
+    pub fn unallocate(&self, count: u64) {
+        if count > 0 {
+            self.allocations.fetch_sub(count, Ordering::Relaxed);
+        }
+    }
+
+    #[inline]
+    pub fn observe_slow_allocation(&self) {
+        self.slow_allocations.fetch_add(1, Ordering::Relaxed);
+    }
+
+    #[inline]
+    pub fn observe_slow_release(&self) {
+        self.slow_releases.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+impl Class {
+    /// Returns a snapshot of this class's statistics.
+    pub fn stats(self) -> ClassStats {
+        let info = self.info();
+        let counters = &info.counters;
+        let (span_count, bytes_mapped) = info.press.span_stats();
+        let (depot_magazines, depot_objects) = info.depot.occupancy();
+        let depot = info.depot.stats();
+
+        // Read releases first: concurrent updates can then only
+        // overestimate the number of live objects.
+        let releases = counters.releases.load(Ordering::Relaxed);
+        let allocations = counters.allocations.load(Ordering::Relaxed);
+
+        ClassStats {
+            live_objects: allocations.saturating_sub(releases),
+            allocations,
+            releases,
+            span_count: span_count as u64,
+            bytes_mapped: bytes_mapped as u64,
+            depot_magazines: depot_magazines as u64,
+            depot_objects: depot_objects as u64,
+            slow_allocations: counters.slow_allocations.load(Ordering::Relaxed),
+            slow_releases: counters.slow_releases.load(Ordering::Relaxed),
+            depot_local_pops: depot.local_pops,
+            depot_remote_pops: depot.remote_pops,
+            depot_cas_failures: depot.cas_failures,
+            depot_eliminations: depot.eliminations,
+        }
+    }
+}
+
+#[test]
+fn class_stats_smoke_test() {
+    use crate::ClassConfig;
+
+    let class = Class::new(ClassConfig::for_test("stats", 32)).expect("Should build");
+
+    assert_eq!(class.stats(), Default::default());
+
+    let allocs: Vec<_> = (0..1000)
+        .map(|_| class.allocate().expect("Should allocate"))
+        .collect();
+
+    let stats = class.stats();
+    assert!(stats.span_count >= 1);
+    assert!(stats.bytes_mapped >= 32 * 1000);
+    assert!(stats.slow_allocations > 0);
+    // Counts lag by at most a couple magazines.
+    let slop = 2 * crate::magazine_impl::MAX_MAGAZINE_SIZE as u64;
+    assert!(stats.live_objects <= 1000 + slop);
+    assert!(stats.live_objects + slop >= 1000);
+
+    for alloc in allocs {
+        class.release(alloc);
+    }
+
+    let stats = class.stats();
+    assert!(stats.slow_releases > 0);
+    assert!(stats.depot_objects > 0);
+    assert!(stats.live_objects <= slop);
+}